@@ -0,0 +1,221 @@
+/*
+ * DragonWalk.cpp
+ *
+ *  Created on: 2026-10-19
+ *
+ * C entry points of the walk kernels. Each one picks the instantiation of
+ * dragon_walk matching its arguments: 32 bits coordinates when the walk
+ * can not overflow them (every power up to 32), and the bounds policy
+ * given by the caller.
+ */
+
+#include <stdio.h>
+
+#include "DragonWalk.h"
+
+void walk_out_of_range(void)
+{
+	printf("index is out of range\n");
+}
+
+static inline int64_t walk_abs(int64_t v)
+{
+	return v < 0 ? -v : v;
+}
+
+/*
+ * A range of L segments stays within a few sqrt(L) of its first position:
+ * it is covered by two blocks of the curve of at most 2L segments. With
+ * L <= 2^32 the walk moves by less than 2^22, and 2x + dx in walk_cell
+ * still fits in 32 bits when |p| < 2^28.
+ */
+static inline bool walk_fits_int32(xy_t p, uint64_t steps)
+{
+	int64_t m = walk_abs(p.x) > walk_abs(p.y) ? walk_abs(p.x) : walk_abs(p.y);
+	return steps <= (1ULL << 32) && m < (1LL << 28);
+}
+
+template <typename Coord, class Emit>
+static bool walk_from(uint64_t start, uint64_t end, xy_t *position, xy_t *orientation, Emit &emit)
+{
+	Coord px = position->x, py = position->y;
+	Coord ox = orientation->x, oy = orientation->y;
+	bool ok = dragon_walk(start, end, px, py, ox, oy, emit);
+	position->x = px;
+	position->y = py;
+	orientation->x = ox;
+	orientation->y = oy;
+	return ok;
+}
+
+template <typename Coord>
+static void limit_walk(int64_t start, int64_t end, piece_t *m)
+{
+	EmitLimits<Coord> emit;
+	emit.minx = m->limits.minimums.x;
+	emit.miny = m->limits.minimums.y;
+	emit.maxx = m->limits.maximums.x;
+	emit.maxy = m->limits.maximums.y;
+	walk_from<Coord>(start, end, &m->position, &m->orientation, emit);
+	m->limits.minimums.x = emit.minx;
+	m->limits.minimums.y = emit.miny;
+	m->limits.maximums.x = emit.maxx;
+	m->limits.maximums.y = emit.maxy;
+}
+
+void piece_limit(int64_t start, int64_t end, piece_t *m)
+{
+	if (end <= start)
+		return;
+	xy_t lo = m->limits.minimums, hi = m->limits.maximums;
+	if (walk_fits_int32(m->position, end - start) &&
+			walk_fits_int32(lo, 0) && walk_fits_int32(hi, 0))
+		limit_walk<int32_t>(start, end, m);
+	else
+		limit_walk<int64_t>(start, end, m);
+}
+
+template <typename Coord, int Bounds, int Packed>
+static int draw_walk(uint64_t start, uint64_t end, xy_t position, xy_t orientation,
+		char *dragon, int width, int height, char id)
+{
+	EmitCanvas<Coord, Bounds, Packed> emit;
+	emit.dragon = dragon;
+	emit.width = width;
+	emit.height = height;
+	emit.value = id + 1;
+	return walk_from<Coord>(start, end, &position, &orientation, emit) ? 0 : -1;
+}
+
+template <typename Coord, int Packed>
+static int draw_bounds(uint64_t start, uint64_t end, xy_t position, xy_t orientation,
+		char *dragon, int width, int height, char id, int flags)
+{
+	if (flags & WALK_CLIP)
+		return draw_walk<Coord, BOUNDS_CLIP, Packed>(start, end, position, orientation, dragon, width, height, id);
+	if (flags & WALK_CHECK)
+		return draw_walk<Coord, BOUNDS_CHECK, Packed>(start, end, position, orientation, dragon, width, height, id);
+	return draw_walk<Coord, BOUNDS_NONE, Packed>(start, end, position, orientation, dragon, width, height, id);
+}
+
+template <typename Coord>
+static int draw_packing(uint64_t start, uint64_t end, xy_t position, xy_t orientation,
+		char *dragon, int width, int height, char id, int flags)
+{
+	if ((flags & WALK_PACKED) && (flags & WALK_SHARED))
+		return draw_bounds<Coord, PACKING_SHARED>(start, end, position, orientation, dragon, width, height,
+				id, flags);
+	if (flags & WALK_PACKED)
+		return draw_bounds<Coord, PACKING_OWNED>(start, end, position, orientation, dragon, width, height,
+				id, flags);
+	return draw_bounds<Coord, PACKING_NONE>(start, end, position, orientation, dragon, width, height,
+			id, flags);
+}
+
+/* draw dragon in raw matrix */
+int dragon_draw_walk(uint64_t start, uint64_t end, char *dragon, int width, int height, limits_t limits,
+		char id, int flags)
+{
+	struct dragon_walk walk;
+
+	if (end < start)
+		printf("error: start=%" PRId64 " > end=%" PRId64 "\n", start, end);
+
+	if (end <= start)
+		return 0;
+
+	dragon_walk_init(&walk, start, limits);
+	return dragon_draw_from(start, end, &walk, dragon, width, height, id, flags);
+}
+
+/* draw segments ]start, end] from the state of the walk at start, see dragon_walk_init */
+int dragon_draw_from(uint64_t start, uint64_t end, struct dragon_walk *walk, char *dragon, int width,
+		int height, char id, int flags)
+{
+	if (end <= start)
+		return 0;
+	if (walk_fits_int32(walk->position, end - start))
+		return draw_packing<int32_t>(start, end, walk->position, walk->orientation, dragon, width, height,
+				id, flags);
+	return draw_packing<int64_t>(start, end, walk->position, walk->orientation, dragon, width, height,
+			id, flags);
+}
+
+int dragon_draw_raw(uint64_t start, uint64_t end, char *dragon, int width, int height, limits_t limits, char id)
+{
+	return dragon_draw_walk(start, end, dragon, width, height, limits, id, WALK_CHECK);
+}
+
+void dragon_walk_init(struct dragon_walk *walk, uint64_t start, limits_t limits)
+{
+	walk->position = compute_position(start);
+	walk->orientation = compute_orientation(start);
+	walk->position.x -= limits.minimums.x;
+	walk->position.y -= limits.minimums.y;
+}
+
+template <typename Coord, int Bounds>
+static int bin_walk(uint64_t start, uint64_t end, struct dragon_walk *walk, struct dragon_bins *bins,
+		int width, int height, uint64_t tile_bytes)
+{
+	EmitBins<Coord, Bounds> emit;
+	emit.bins = bins;
+	emit.width = width;
+	emit.height = height;
+	emit.tile_bytes = tile_bytes;
+	return walk_from<Coord>(start, end, &walk->position, &walk->orientation, emit) ? 0 : -1;
+}
+
+/* trace segments ]start, end] into the bins, the walk is left at end */
+int dragon_bin_raw(uint64_t start, uint64_t end, struct dragon_walk *walk, struct dragon_bins *bins,
+		int width, int height, uint64_t tile_bytes)
+{
+	const int bounds = (DRAW_FLAGS & WALK_CHECK) ? BOUNDS_CHECK : BOUNDS_NONE;
+
+	if (end <= start)
+		return 0;
+	if (walk_fits_int32(walk->position, end - start))
+		return bin_walk<int32_t, bounds>(start, end, walk, bins, width, height, tile_bytes);
+	return bin_walk<int64_t, bounds>(start, end, walk, bins, width, height, tile_bytes);
+}
+
+template <typename Coord, int Bounds>
+static int accum_walk(uint64_t start, uint64_t end, xy_t position, xy_t orientation,
+		struct dragon_accum *acc, struct rgb color)
+{
+	EmitAccum<Coord, Bounds> emit;
+	emit.acc = acc;
+	emit.color = color;
+	return walk_from<Coord>(start, end, &position, &orientation, emit) ? 0 : -1;
+}
+
+template <typename Coord>
+static int accum_bounds(uint64_t start, uint64_t end, xy_t position, xy_t orientation,
+		struct dragon_accum *acc, struct rgb color, int flags)
+{
+	if (flags & WALK_CLIP)
+		return accum_walk<Coord, BOUNDS_CLIP>(start, end, position, orientation, acc, color);
+	if (flags & WALK_CHECK)
+		return accum_walk<Coord, BOUNDS_CHECK>(start, end, position, orientation, acc, color);
+	return accum_walk<Coord, BOUNDS_NONE>(start, end, position, orientation, acc, color);
+}
+
+/*
+ * Accumulate segments ]start, end] in the pixels of the image. The sums are
+ * not atomic: concurrent callers must use their own accumulator.
+ */
+int dragon_accum_raw(uint64_t start, uint64_t end, struct dragon_accum *acc, limits_t limits,
+		struct rgb color, int flags)
+{
+	if (end <= start)
+		return 0;
+
+	xy_t position = compute_position(start);
+	xy_t orientation = compute_orientation(start);
+	position.x -= limits.minimums.x;
+	position.y -= limits.minimums.y;
+
+	if (walk_fits_int32(position, end - start))
+		return accum_bounds<int32_t>(start, end, position, orientation, acc, color, flags);
+	return accum_bounds<int64_t>(start, end, position, orientation, acc, color, flags);
+}
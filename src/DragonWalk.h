@@ -0,0 +1,215 @@
+/*
+ * DragonWalk.h
+ *
+ *  Created on: 2026-10-19
+ *
+ * Walk of the dragon curve, specialized at compile time. The walk is the
+ * same for every kernel, only what is done with each segment changes: the
+ * emitter is a template parameter, as are the width of the coordinates and
+ * the bounds policy, so that the inner loop of each instantiation has no
+ * indirect call and no test that does not belong to its kernel.
+ */
+
+#ifndef DRAGONWALK_H_
+#define DRAGONWALK_H_
+
+#include <stdint.h>
+
+extern "C" {
+#include "dragon.h"
+#include "progress.h"
+}
+
+/* what an emitter does with a segment out of the canvas */
+enum walk_bounds {
+	BOUNDS_NONE,	/* the limits cover the range, nothing is tested */
+	BOUNDS_CHECK,	/* the walk stops with an error */
+	BOUNDS_CLIP,	/* the segment is skipped */
+};
+
+/*
+ * Walk segments ]start, end] from (px, py) facing (ox, oy). For each
+ * segment, emit.segment() gets the position before the step, then
+ * emit.moved() gets the position after the step. The state is left at end,
+ * false is returned if the emitter stopped the walk or the render was
+ * cancelled, which is checked once per chunk.
+ */
+template <typename Coord, class Emit>
+static inline bool dragon_walk(uint64_t start, uint64_t end, Coord &px, Coord &py,
+		Coord &ox, Coord &oy, Emit &emit)
+{
+	Coord x = px, y = py, dx = ox, dy = oy, t;
+	uint64_t n, chunk_end;
+	bool ok = true;
+
+	for (n = start + 1; n <= end && ok; ) {
+		chunk_end = n + PROGRESS_CHUNK - 1;
+		if (chunk_end > end)
+			chunk_end = end;
+		if (!progress_chunk(Emit::counter, chunk_end - n + 1)) {
+			ok = false;
+			break;
+		}
+		for (; n <= chunk_end; n++) {
+			if (!emit.segment(x, y, dx, dy)) {
+				ok = false;
+				break;
+			}
+			x += dx;
+			y += dy;
+			emit.moved(x, y);
+			t = dx;
+			if (((n & -n) << 1) & n) {
+				dx = -dy;	/* rotate_left */
+				dy = t;
+			} else {
+				dx = dy;	/* rotate_right */
+				dy = -t;
+			}
+		}
+	}
+	px = x;
+	py = y;
+	ox = dx;
+	oy = dy;
+	return ok;
+}
+
+/* cell of the canvas crossed by the segment leaving (x, y) */
+template <typename Coord>
+static inline void walk_cell(Coord x, Coord y, Coord dx, Coord dy, int &i, int &j)
+{
+	j = (int) ((x + (x + dx)) >> 1);
+	i = (int) ((y + (y + dy)) >> 1);
+}
+
+/* running bounding box of the positions */
+template <typename Coord>
+struct EmitLimits {
+	static const int counter = PROGRESS_SEGMENTS_LIMITED;
+	Coord minx, miny, maxx, maxy;
+
+	inline bool segment(Coord, Coord, Coord, Coord) { return true; }
+	inline void moved(Coord x, Coord y)
+	{
+		if (minx > x) minx = x;
+		if (miny > y) miny = y;
+		if (maxx < x) maxx = x;
+		if (maxy < y) maxy = y;
+	}
+};
+
+void walk_out_of_range(void);
+
+/* how EmitCanvas writes a cell */
+enum walk_packing {
+	PACKING_NONE,	/* one byte per cell */
+	PACKING_OWNED,	/* or'ed in its byte, no other writer */
+	PACKING_SHARED,	/* or'ed in atomically, the byte may hold a cell of another thread */
+};
+
+/*
+ * Write id + 1 in the raw canvas, the position is relative to the minimums.
+ * The bytes of a packed canvas start at zero.
+ */
+template <typename Coord, int Bounds, int Packed>
+struct EmitCanvas {
+	static const int counter = PROGRESS_SEGMENTS_DRAWN;
+	char *dragon;
+	int width;
+	int height;
+	char value;
+
+	inline bool segment(Coord x, Coord y, Coord dx, Coord dy)
+	{
+		int i, j;
+		walk_cell(x, y, dx, dy, i, j);
+		if (Bounds == BOUNDS_CLIP) {
+			if ((unsigned) j >= (unsigned) width || (unsigned) i >= (unsigned) height)
+				return true;
+		} else if (Bounds == BOUNDS_CHECK) {
+			if ((unsigned) j >= (unsigned) width || (unsigned) i >= (unsigned) height) {
+				walk_out_of_range();
+				return false;
+			}
+		}
+		if (Packed != PACKING_NONE) {
+			uint64_t index = (uint64_t) i * width + j;
+			char bits = (char) (value << ((index & 1) << 2));
+			if (Packed == PACKING_SHARED)
+				__atomic_fetch_or(&dragon[index >> 1], bits, __ATOMIC_RELAXED);
+			else
+				dragon[index >> 1] |= bits;
+		} else {
+			dragon[i * width + j] = value;
+		}
+		return true;
+	}
+	inline void moved(Coord, Coord) {}
+};
+
+/* push the canvas index in the bin of its tile */
+template <typename Coord, int Bounds>
+struct EmitBins {
+	static const int counter = PROGRESS_SEGMENTS_DRAWN;
+	struct dragon_bins *bins;
+	int width;
+	int height;
+	uint64_t tile_bytes;
+
+	inline bool segment(Coord x, Coord y, Coord dx, Coord dy)
+	{
+		int i, j;
+		walk_cell(x, y, dx, dy, i, j);
+		if (Bounds != BOUNDS_NONE &&
+				((unsigned) j >= (unsigned) width || (unsigned) i >= (unsigned) height)) {
+			if (Bounds == BOUNDS_CLIP)
+				return true;
+			walk_out_of_range();
+			return false;
+		}
+		uint32_t index = i * width + j;
+		int tile = index / tile_bytes;
+		if (bins->len[tile] == bins->cap[tile] && bins_grow(bins, tile) < 0)
+			return false;
+		bins->index[tile][bins->len[tile]++] = index;
+		return true;
+	}
+	inline void moved(Coord, Coord) {}
+};
+
+/*
+ * Add the color of the segment to the image pixel it falls in, so that
+ * the image is rendered without a canvas. The layout of the cells is the
+ * one scale_dragon uses.
+ */
+template <typename Coord, int Bounds>
+struct EmitAccum {
+	static const int counter = PROGRESS_SEGMENTS_DRAWN;
+	struct dragon_accum *acc;
+	struct rgb color;
+
+	inline bool segment(Coord x, Coord y, Coord dx, Coord dy)
+	{
+		int i, j;
+		walk_cell(x, y, dx, dy, i, j);
+		if (Bounds != BOUNDS_NONE &&
+				((unsigned) j >= (unsigned) acc->dragon_width ||
+				 (unsigned) i >= (unsigned) acc->dragon_height)) {
+			if (Bounds == BOUNDS_CLIP)
+				return true;
+			walk_out_of_range();
+			return false;
+		}
+		uint64_t *sum = acc->sums + 4 * ((uint64_t) ((i + acc->deltaI) / acc->scale) *
+				acc->image_width + (j + acc->deltaJ) / acc->scale);
+		sum[0] += color.r;
+		sum[1] += color.g;
+		sum[2] += color.b;
+		sum[3] += 1;
+		return true;
+	}
+	inline void moved(Coord, Coord) {}
+};
+
+#endif /* DRAGONWALK_H_ */
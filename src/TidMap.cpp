@@ -9,63 +9,86 @@
 
 #include "tbb/tbb.h"
 #include "TidMap.h"
+extern "C" {
+#include "utils.h"
+}
 
 using std::ostream;
 using namespace tbb;
 using namespace std;
 
+/* every map gets its own serial, so that a stale cache entry never matches */
+static std::atomic<uint64_t> tidmap_serials(1);
+
+struct tidmap_cache {
+	uint64_t serial;
+	int tid;
+	int id;
+};
+
+static __thread struct tidmap_cache cache = { 0, 0, -1 };
+
 TidMap::TidMap(int size) : size(size), pos(0) {
-	array = new int[size];
+	array = new std::atomic<int>[size];
 	int i;
 	for (i = 0; i < size; i++) {
-		array[i] = 0;
+		array[i].store(0, std::memory_order_relaxed);
 	}
+	serial = tidmap_serials.fetch_add(1);
 }
 
 TidMap::~TidMap() {
 	delete[] array;
 }
 
-int TidMap::getIdFromTid(const int tid) {
-	/* start with a read only lock */
-	ArrayMutex::scoped_lock lock(mutex, false);
+/* slow path: find the slot of tid, or claim the first free one */
+int TidMap::lookup(const int tid) {
 	int i;
-	for (i = 0; i < pos; i++) {
-		if (tid == array[i])
+	for (i = 0; i < size; i++) {
+		int value = array[i].load(std::memory_order_acquire);
+		if (value == tid)
+			return i;
+		if (value != 0)
+			continue;
+		/*
+		 * a thread registering the same tid concurrently either loses
+		 * the exchange here and finds tid in the slot, or got it first
+		 */
+		if (array[i].compare_exchange_strong(value, tid)) {
+			pos.fetch_add(1);
 			return i;
-	}
-	/* the value is not found, add it to the array
-	 * updrade to write lock before modification */
-	if (!lock.upgrade_to_writer()) {
-		/* upgrade_to_write may release the lock for a short period
-		 * of time, check again if another thread already added the value */
-		for (i = 0; i < pos; i++) {
-			if (tid == array[i])
-				return i;
 		}
+		if (value == tid)
+			return i;
 	}
-	/*
-	 * write lock is held here and
-	 * the value is not in the array
-	 */
+	/* full condition */
+	return -1;
+}
 
-	/* detect full condition */
-	if (pos == size)
-		return -1;
+int TidMap::getIdFromTid(const int tid) {
+	if (cache.serial == serial && cache.tid == tid)
+		return cache.id;
+	int id = lookup(tid);
+	if (id >= 0 && tid == gettid()) {
+		cache.serial = serial;
+		cache.tid = tid;
+		cache.id = id;
+	}
+	return id;
+}
 
-	/* append to the array, increase position */
-	int ret = pos;
-	array[pos++] = tid;
-	return ret;
-	/* lock is released automatically */
+/* id of the calling thread, without a system call once cached */
+int TidMap::getId() {
+	if (cache.serial == serial)
+		return cache.id;
+	return getIdFromTid(gettid());
 }
 
 void TidMap::dump() {
-	ArrayMutex::scoped_lock lock(mutex, false);
 	int i;
-	cout << "{ ";
+	cout << pos.load() << " registered { ";
 	for (i = 0; i < size; i++) {
-		cout << i << "=" << array[i] << " ";
+		cout << i << "=" << array[i].load() << " ";
 	}
 	cout << "}\n";
 }
@@ -9,24 +9,32 @@
 #define TIDMAP_H_
 
 #include <iostream>
+#include <atomic>
+#include <stdint.h>
 #include "tbb/tbb.h"
 
 using std::ostream;
 using namespace tbb;
 using namespace std;
 
-typedef spin_rw_mutex ArrayMutex;
-
+/*
+ * Maps thread ids to dense ids in [0, size). The lookup of the calling
+ * thread is served from a thread-local cache, the registration of a new
+ * thread claims the first free slot with a compare-and-swap. No lock is
+ * ever taken.
+ */
 class TidMap {
 private:
 	int size;
-	int pos;
-	int *array;
-	ArrayMutex mutex;
+	std::atomic<int> pos;
+	std::atomic<int> *array;
+	uint64_t serial;
+	int lookup(const int tid);
 public:
 	TidMap(int size);
 	virtual ~TidMap();
 	int getIdFromTid(const int tid);
+	int getId();
 	void dump();
 };
 
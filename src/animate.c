@@ -0,0 +1,160 @@
+/*
+ * animate.c
+ *
+ *  Created on: 2026-10-19
+ *
+ * The curve is traced once, in increasing order, in the canvas of the final
+ * dragon: frame f shows the segments ]0, size f / frames]. A cell holds at
+ * most one segment, so the increments never overwrite each other and the
+ * last frame is the image of dragon_draw_serial. Only the image rows
+ * covering the bounding box of the increment are scaled and converted to
+ * YUV again before the frame is written.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "animate.h"
+#include "viewport.h"
+#include "color.h"
+#include "progress.h"
+#include "trace.h"
+
+struct y4m_frame {
+	unsigned char *planes;	/* Y, then U, then V, 4:4:4 */
+	int width;
+	int height;
+};
+
+/* BT.601, studio range */
+static void y4m_convert(struct y4m_frame *frame, struct rgb *image, int start, int end)
+{
+	uint64_t plane = (uint64_t) frame->width * frame->height;
+	unsigned char *y = frame->planes;
+	unsigned char *u = y + plane;
+	unsigned char *v = u + plane;
+	uint64_t i;
+
+	for (i = (uint64_t) start * frame->width; i < (uint64_t) end * frame->width; i++) {
+		int r = image[i].r, g = image[i].g, b = image[i].b;
+		y[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+		u[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+		v[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+	}
+}
+
+static int y4m_write_frame(FILE *out, struct y4m_frame *frame)
+{
+	uint64_t bytes = 3 * (uint64_t) frame->width * frame->height;
+
+	if (fputs("FRAME\n", out) == EOF)
+		return -1;
+	if (fwrite(frame->planes, 1, bytes, out) != bytes)
+		return -1;
+	if (fflush(out) == EOF)
+		return -1;
+	progress_add(PROGRESS_BYTES_WRITTEN, bytes);
+	return 0;
+}
+
+/* trace ]lo, hi] with the colors of dragon_draw_serial for size segments */
+static int animate_trace(char *dragon, int dragon_width, int dragon_height, limits_t limits,
+		uint64_t size, int nb_colors, uint64_t lo, uint64_t hi)
+{
+	uint64_t m = lo * nb_colors / size;
+
+	for (; m < (uint64_t) nb_colors; m++) {
+		uint64_t start = m * size / nb_colors;
+		uint64_t end = (m + 1) * size / nb_colors;
+		if (start >= hi)
+			break;
+		if (end <= lo)
+			continue;
+		if (dragon_draw_walk(start < lo ? lo : start, end > hi ? hi : end, dragon,
+				dragon_width, dragon_height, limits, m, DRAW_FLAGS) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Write frames of the growth of the dragon of size segments to out. image
+ * receives the last frame.
+ */
+int dragon_animate(FILE *out, struct rgb *image, int width, int height, uint64_t size,
+		int nb_colors, int frames)
+{
+	struct y4m_frame frame = { .planes = NULL, .width = width, .height = height };
+	struct palette *palette = NULL;
+	char *dragon = NULL;
+	limits_t limits, dirty;
+	uint64_t lo = 0, hi;
+	int dragon_width, dragon_height, scale, deltaI;
+	int f, start, end;
+	int ret = 0;
+
+	if (dragon_limits_blocks(&limits, size, nb_colors) < 0)
+		goto err;
+	dragon_width = limits.maximums.x - limits.minimums.x;
+	dragon_height = limits.maximums.y - limits.minimums.y;
+	scale = (dragon_width / width + 1 > dragon_height / height + 1 ?
+			dragon_width / width + 1 : dragon_height / height + 1);
+	deltaI = (scale * height - dragon_height) / 2;
+
+	if ((dragon = make_dragon((uint64_t) dragon_width * dragon_height)) == NULL) {
+		fprintf(stderr, "malloc error dragon\n");
+		goto err;
+	}
+	if ((palette = init_palette(nb_colors)) == NULL)
+		goto err;
+	frame.planes = (unsigned char *) malloc(3 * (uint64_t) width * height);
+	if (frame.planes == NULL)
+		goto err;
+
+	/* empty first image, then only the dirty rows */
+	scale_dragon(0, height, image, width, height, dragon, dragon_width, dragon_height, palette);
+	y4m_convert(&frame, image, 0, height);
+	if (fprintf(out, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, ANIMATE_FPS) < 0)
+		goto err;
+
+	for (f = 1; f <= frames; f++) {
+		hi = size * f / frames;
+		if (hi > lo) {
+			trace_begin("draw");
+			ret = animate_trace(dragon, dragon_width, dragon_height, limits, size, nb_colors, lo, hi);
+			trace_end("draw");
+			if (ret < 0)
+				goto err;
+
+			dragon_range_limits(lo, hi, &dirty);
+			start = (dirty.minimums.y - limits.minimums.y + deltaI) / scale;
+			end = (dirty.maximums.y - limits.minimums.y - 1 + deltaI) / scale + 1;
+			if (start < 0)
+				start = 0;
+			if (end > height)
+				end = height;
+			trace_begin("render");
+			scale_dragon(start, end, image, width, height, dragon, dragon_width, dragon_height, palette);
+			y4m_convert(&frame, image, start, end);
+			trace_end("render");
+			lo = hi;
+		}
+		trace_begin("write");
+		ret = y4m_write_frame(out, &frame);
+		trace_end("write");
+		if (ret < 0) {
+			fprintf(stderr, "Error writing frame %d\n", f);
+			goto err;
+		}
+		progress_add(PROGRESS_RENDERS, 1);
+	}
+
+done:
+	FREE(frame.planes);
+	ARENA_FREE(dragon);
+	free_palette(palette);
+	return ret;
+err:
+	ret = -1;
+	goto done;
+}
@@ -0,0 +1,23 @@
+/*
+ * animate.h
+ *
+ *  Created on: 2026-10-19
+ *
+ * Growth animation of the dragon streamed as YUV4MPEG2 frames
+ */
+
+#ifndef ANIMATE_H_
+#define ANIMATE_H_
+
+#include <stdio.h>
+#include "dragon.h"
+
+#define ANIMATE_FRAMES	64
+#define ANIMATE_FPS		25
+/* output path for stdout */
+#define ANIMATE_STDOUT	"-"
+
+int dragon_animate(FILE *out, struct rgb *image, int width, int height, uint64_t size,
+        int nb_colors, int frames);
+
+#endif /* ANIMATE_H_ */
@@ -0,0 +1,241 @@
+/*
+ * arena.c
+ *
+ *  Created on: 2026-10-19
+ *
+ * Buffers are anonymous mappings handed back to the arena instead of
+ * being unmapped, so that the next render reuses pages that are already
+ * faulted in. Large buffers are aligned on huge pages and either backed
+ * by explicit huge pages (hugetlb, when enabled and reserved) or marked
+ * for transparent huge pages.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+struct dragon_arena dragon_arena = ARENA_INITIALIZER;
+
+static uint64_t arena_round(uint64_t size, uint64_t align)
+{
+	return (size + align - 1) & ~(align - 1);
+}
+
+/* map a block of size bytes, aligned on a huge page when it is large enough */
+static void *arena_map(struct dragon_arena *arena, uint64_t size, int *huge)
+{
+	void *ptr;
+
+	*huge = 0;
+#ifdef MAP_HUGETLB
+	if (arena->hugetlb && size >= ARENA_HUGE_PAGE) {
+		ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ptr != MAP_FAILED) {
+			*huge = 1;
+			return ptr;
+		}
+	}
+#endif
+	if (size < ARENA_HUGE_PAGE) {
+		ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		return ptr == MAP_FAILED ? NULL : ptr;
+	}
+
+	/* over-allocate, then trim both ends to get a huge page alignment */
+	uint64_t span = size + ARENA_HUGE_PAGE;
+	char *raw = mmap(NULL, span, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw == MAP_FAILED)
+		return NULL;
+	char *aligned = (char *) arena_round((uintptr_t) raw, ARENA_HUGE_PAGE);
+	if (aligned > raw)
+		munmap(raw, aligned - raw);
+	if (raw + span > aligned + size)
+		munmap(aligned + size, raw + span - (aligned + size));
+#ifdef MADV_HUGEPAGE
+	madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+	return aligned;
+}
+
+static void arena_unmap(struct dragon_arena *arena, struct arena_block *block)
+{
+	munmap(block->ptr, block->capacity);
+	arena->footprint -= block->capacity;
+}
+
+/*
+ * A free block more than twice a request is not reused for it: before a
+ * new block is mapped, the largest free blocks are unmapped until at most
+ * ARENA_FREE_KEPT bytes stay free. Under arena->lock.
+ */
+static void arena_release_free(struct dragon_arena *arena)
+{
+	struct arena_block *block, *largest, **link, **largest_link;
+
+	while (arena->footprint - arena->in_use > ARENA_FREE_KEPT) {
+		largest = NULL;
+		largest_link = NULL;
+		for (link = &arena->blocks; (block = *link) != NULL; link = &block->next) {
+			if (!block->in_use && (largest == NULL || block->capacity > largest->capacity)) {
+				largest = block;
+				largest_link = link;
+			}
+		}
+		if (largest == NULL)
+			break;
+		*largest_link = largest->next;
+		arena_unmap(arena, largest);
+		free(largest);
+	}
+}
+
+static void *arena_get(struct dragon_arena *arena, uint64_t size, int zero)
+{
+	struct arena_block *block, *best = NULL, **link;
+	void *ptr = NULL;
+	int reused = 0;
+	int huge;
+
+	if (size == 0)
+		return NULL;
+	size = arena_round(size, size >= ARENA_HUGE_PAGE ? ARENA_HUGE_PAGE : 4096);
+
+	pthread_mutex_lock(&arena->lock);
+
+	/* best fit among the free blocks, never more than twice the request */
+	for (block = arena->blocks; block != NULL; block = block->next) {
+		if (block->in_use || block->capacity < size || block->capacity > 2 * size)
+			continue;
+		if (best == NULL || block->capacity < best->capacity)
+			best = block;
+	}
+	if (best != NULL) {
+		arena->reuses++;
+		reused = 1;
+		goto found;
+	}
+
+	/* free blocks too small for this request are likely outgrown (sweeps) */
+	link = &arena->blocks;
+	while ((block = *link) != NULL) {
+		if (!block->in_use && block->capacity < size) {
+			*link = block->next;
+			arena_unmap(arena, block);
+			free(block);
+		} else {
+			link = &block->next;
+		}
+	}
+	arena_release_free(arena);
+
+	if ((best = (struct arena_block *) malloc(sizeof(struct arena_block))) == NULL)
+		goto done;
+	if ((best->ptr = arena_map(arena, size, &huge)) == NULL) {
+		free(best);
+		goto done;
+	}
+	best->capacity = size;
+	best->huge = huge;
+	best->next = arena->blocks;
+	arena->blocks = best;
+	arena->maps++;
+	arena->footprint += size;
+	if (arena->footprint > arena->peak)
+		arena->peak = arena->footprint;
+
+found:
+	best->in_use = 1;
+	arena->in_use += best->capacity;
+	if (arena->in_use > arena->peak_in_use)
+		arena->peak_in_use = arena->in_use;
+	ptr = best->ptr;
+done:
+	pthread_mutex_unlock(&arena->lock);
+
+	/*
+	 * Fresh mappings are zero. A recycled block is dropped back to the zero
+	 * page, so that the cost of clearing is only paid on the pages touched.
+	 * Kernels before 5.18 refuse MADV_DONTNEED on hugetlb pages (EINVAL):
+	 * the block is then cleared by hand.
+	 */
+	if (ptr != NULL && zero && reused) {
+		if (size < ARENA_HUGE_PAGE || madvise(ptr, size, MADV_DONTNEED) < 0)
+			memset(ptr, 0, size);
+	}
+	return ptr;
+}
+
+void *arena_alloc(struct dragon_arena *arena, uint64_t size)
+{
+	return arena_get(arena, size, 0);
+}
+
+/* buffer whose content is zero */
+void *arena_alloc_zero(struct dragon_arena *arena, uint64_t size)
+{
+	return arena_get(arena, size, 1);
+}
+
+/* give the buffer back to the arena, its pages stay mapped */
+void arena_free(struct dragon_arena *arena, void *ptr)
+{
+	struct arena_block *block;
+
+	if (ptr == NULL)
+		return;
+	pthread_mutex_lock(&arena->lock);
+	for (block = arena->blocks; block != NULL; block = block->next) {
+		if (block->ptr == ptr && block->in_use) {
+			block->in_use = 0;
+			arena->in_use -= block->capacity;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&arena->lock);
+	if (block == NULL)
+		fprintf(stderr, "arena_free: %p was not allocated by the arena\n", ptr);
+}
+
+/* unmap every buffer that is not in use */
+void arena_trim(struct dragon_arena *arena)
+{
+	struct arena_block *block, **link;
+
+	pthread_mutex_lock(&arena->lock);
+	link = &arena->blocks;
+	while ((block = *link) != NULL) {
+		if (!block->in_use) {
+			*link = block->next;
+			arena_unmap(arena, block);
+			free(block);
+		} else {
+			link = &block->next;
+		}
+	}
+	pthread_mutex_unlock(&arena->lock);
+}
+
+void arena_report(struct dragon_arena *arena, FILE *out)
+{
+	struct arena_block *block;
+	int huge = 0, count = 0;
+
+	pthread_mutex_lock(&arena->lock);
+	for (block = arena->blocks; block != NULL; block = block->next) {
+		count++;
+		huge += block->huge;
+	}
+	fprintf(out, "arena: peak=%.1fMiB peak_in_use=%.1fMiB mapped=%.1fMiB "
+			"blocks=%d hugetlb=%d maps=%"PRIu64" reuses=%"PRIu64"\n",
+			arena->peak / 1048576.0, arena->peak_in_use / 1048576.0,
+			arena->footprint / 1048576.0, count, huge, arena->maps, arena->reuses);
+	pthread_mutex_unlock(&arena->lock);
+}
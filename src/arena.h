@@ -0,0 +1,59 @@
+/*
+ * arena.h
+ *
+ *  Created on: 2026-10-19
+ *
+ * Memory arena for canvases, images and scratch buffers, kept from one
+ * render to the next
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define ARENA_HUGE_PAGE (2UL * 1024 * 1024)
+/* free bytes kept mapped for the next renders, see arena_release_free */
+#define ARENA_FREE_KEPT (256UL * 1024 * 1024)
+
+struct arena_block {
+	struct arena_block *next;
+	void *ptr;
+	uint64_t capacity;
+	int in_use;
+	int huge;
+};
+
+struct dragon_arena {
+	pthread_mutex_t lock;
+	struct arena_block *blocks;
+	int hugetlb;
+	uint64_t footprint;
+	uint64_t peak;
+	uint64_t in_use;
+	uint64_t peak_in_use;
+	uint64_t maps;
+	uint64_t reuses;
+};
+
+#define ARENA_INITIALIZER { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, 0, 0, 0, 0 }
+
+/* arena used by the one-shot dragon_draw_* functions */
+extern struct dragon_arena dragon_arena;
+
+void *arena_alloc(struct dragon_arena *arena, uint64_t size);
+void *arena_alloc_zero(struct dragon_arena *arena, uint64_t size);
+void arena_free(struct dragon_arena *arena, void *ptr);
+void arena_trim(struct dragon_arena *arena);
+void arena_report(struct dragon_arena *arena, FILE *out);
+
+#define ARENA_FREE(var) do {				\
+	if (var != NULL) {				\
+		arena_free(&dragon_arena, var);		\
+		var = NULL;				\
+	}						\
+} while(0)
+
+#endif /* ARENA_H_ */
@@ -0,0 +1,167 @@
+/*
+ * async.c
+ *
+ *  Created on: 2026-10-19
+ *
+ * A render runs on its own thread with dragon_ctx_draw_job: its context stays
+ * locked until the end, the caller polls or waits. A cancellation is seen by
+ * the kernels at their next chunk of segments or row of pixels, the canvas
+ * is then freed.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "async.h"
+
+static void render_chunk(struct progress_job *job, int counter, uint64_t n)
+{
+	struct dragon_render *r = (struct dragon_render *) job;
+	uint64_t done = __sync_add_and_fetch(&r->done[counter], n);
+
+	if (r->progress != NULL)
+		r->progress(r->arg, counter, done, r->total[counter]);
+}
+
+static void *render_main(void *arg)
+{
+	struct dragon_render *r = (struct dragon_render *) arg;
+	enum dragon_render_state state;
+	char *canvas = NULL;
+	int ret;
+
+	if (r->progress != NULL)
+		r->progress(r->arg, PROGRESS_RENDERS, 0, 1);
+	ret = dragon_ctx_draw_job(r->ctx, &r->job, &canvas, r->image, r->width, r->height, r->size);
+	if (r->job.cancel) {
+		/* a partial canvas, or none if the cancel came before its allocation */
+		if (ret == 0)
+			dragon_ctx_free(r->ctx, canvas);
+		canvas = NULL;
+		state = DRAGON_RENDER_CANCELLED;
+	} else {
+		state = ret < 0 ? DRAGON_RENDER_FAILED : DRAGON_RENDER_DONE;
+	}
+	if (state == DRAGON_RENDER_DONE && r->progress != NULL)
+		r->progress(r->arg, PROGRESS_RENDERS, 1, 1);
+
+	pthread_mutex_lock(&r->lock);
+	r->canvas = canvas;
+	r->state = state;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+	return NULL;
+}
+
+/*
+ * Start the render of image on ctx, which must not be released before
+ * dragon_render_free. Returns NULL if the thread can not be started.
+ */
+struct dragon_render *dragon_render_async(struct dragon_ctx *ctx, struct rgb *image, int width, int height,
+		uint64_t size, dragon_progress_cb progress, void *arg)
+{
+	struct dragon_render *r;
+	pthread_condattr_t attr;
+
+	if ((r = calloc(1, sizeof(struct dragon_render))) == NULL)
+		return NULL;
+	r->job.chunk = render_chunk;
+	r->ctx = ctx;
+	r->image = image;
+	r->width = width;
+	r->height = height;
+	r->size = size;
+	r->progress = progress;
+	r->arg = arg;
+	r->total[PROGRESS_SEGMENTS_LIMITED] = size;
+	r->total[PROGRESS_SEGMENTS_DRAWN] = size;
+	r->total[PROGRESS_ROWS_RENDERED] = height;
+	r->state = DRAGON_RENDER_RUNNING;
+	pthread_mutex_init(&r->lock, NULL);
+	/* the timeouts of dragon_render_timedwait do not jump with the wall clock */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&r->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	if (pthread_create(&r->thread, NULL, render_main, r) != 0) {
+		pthread_mutex_destroy(&r->lock);
+		pthread_cond_destroy(&r->cond);
+		free(r);
+		return NULL;
+	}
+	return r;
+}
+
+enum dragon_render_state dragon_render_poll(struct dragon_render *r)
+{
+	enum dragon_render_state state;
+
+	pthread_mutex_lock(&r->lock);
+	state = r->state;
+	pthread_mutex_unlock(&r->lock);
+	return state;
+}
+
+/*
+ * Wait for the end of the render. When it is done, the canvas goes to the
+ * caller if canvas is not NULL, to be freed with dragon_ctx_free.
+ */
+enum dragon_render_state dragon_render_wait(struct dragon_render *r, char **canvas)
+{
+	enum dragon_render_state state;
+
+	pthread_mutex_lock(&r->lock);
+	while (r->state == DRAGON_RENDER_RUNNING)
+		pthread_cond_wait(&r->cond, &r->lock);
+	state = r->state;
+	if (canvas != NULL) {
+		*canvas = r->canvas;
+		r->canvas = NULL;
+	}
+	pthread_mutex_unlock(&r->lock);
+	if (!r->joined) {
+		pthread_join(r->thread, NULL);
+		r->joined = 1;
+	}
+	return state;
+}
+
+/*
+ * Wait for the end of the render until abstime, on CLOCK_MONOTONIC. Returns
+ * DRAGON_RENDER_RUNNING if it is still running then, dragon_render_wait
+ * takes the canvas.
+ */
+enum dragon_render_state dragon_render_timedwait(struct dragon_render *r, const struct timespec *abstime)
+{
+	enum dragon_render_state state;
+
+	pthread_mutex_lock(&r->lock);
+	while (r->state == DRAGON_RENDER_RUNNING) {
+		if (pthread_cond_timedwait(&r->cond, &r->lock, abstime) == ETIMEDOUT)
+			break;
+	}
+	state = r->state;
+	pthread_mutex_unlock(&r->lock);
+	return state;
+}
+
+/* ask the render to stop, dragon_render_wait tells when it has */
+void dragon_render_cancel(struct dragon_render *r)
+{
+	r->job.cancel = 1;
+}
+
+void dragon_render_free(struct dragon_render *r)
+{
+	if (r == NULL)
+		return;
+	dragon_render_wait(r, NULL);
+	if (r->canvas != NULL)
+		dragon_ctx_free(r->ctx, r->canvas);
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->cond);
+	free(r);
+}
@@ -0,0 +1,60 @@
+/*
+ * async.h
+ *
+ *  Created on: 2026-10-19
+ *
+ * Render in the background of the caller, with progress reports and
+ * cooperative cancellation
+ */
+
+#ifndef ASYNC_H_
+#define ASYNC_H_
+
+#include <pthread.h>
+#include <time.h>
+#include "context.h"
+
+enum dragon_render_state {
+	DRAGON_RENDER_RUNNING,
+	DRAGON_RENDER_DONE,
+	DRAGON_RENDER_FAILED,
+	DRAGON_RENDER_CANCELLED,
+};
+
+/*
+ * Progress of a render: counter is a progress_counter, done its steps so
+ * far and total the steps expected. The kernels call it from the workers,
+ * once per PROGRESS_CHUNK segments or per row, concurrently. PROGRESS_RENDERS
+ * marks the stages of the whole render: 0 of 1 when it starts, 1 of 1 when
+ * it ends.
+ */
+typedef void (*dragon_progress_cb)(void *arg, int counter, uint64_t done, uint64_t total);
+
+struct dragon_render {
+	struct progress_job job;	/* first, the kernels only see this */
+	struct dragon_ctx *ctx;
+	struct rgb *image;
+	int width;
+	int height;
+	uint64_t size;
+	char *canvas;
+	dragon_progress_cb progress;
+	void *arg;
+	uint64_t done[PROGRESS_MAX];
+	uint64_t total[PROGRESS_MAX];
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	enum dragon_render_state state;
+	int joined;
+};
+
+struct dragon_render *dragon_render_async(struct dragon_ctx *ctx, struct rgb *image, int width, int height,
+        uint64_t size, dragon_progress_cb progress, void *arg);
+enum dragon_render_state dragon_render_poll(struct dragon_render *r);
+enum dragon_render_state dragon_render_wait(struct dragon_render *r, char **canvas);
+enum dragon_render_state dragon_render_timedwait(struct dragon_render *r, const struct timespec *abstime);
+void dragon_render_cancel(struct dragon_render *r);
+void dragon_render_free(struct dragon_render *r);
+
+#endif /* ASYNC_H_ */
@@ -0,0 +1,401 @@
+/*
+ * cache.c
+ *
+ *  Created on: 2026-10-19
+ *
+ * Content-addressed cache of renders. Every entry is a file of the cache
+ * directory named after the FNV-1a hash of what it depends on:
+ *
+ *   limits-HASH   limits_t of a size
+ *   canvas-HASH   id canvas of a size drawn by a lib, with its color count
+ *   image-HASH    final PPM image, for a size, lib, color count and image size
+ *
+ * The canvas is stored raw after a header of one page, so that a hit is
+ * mapped instead of read. Its pages of empty cells are holes of a sparse
+ * file: they take no space on disk and are read back as zero pages.
+ *
+ * Entries are written to a temporary file then renamed, a reader sees a
+ * complete entry or none, even with concurrent renders of the server. A
+ * canvas is checked before use, a corrupt one is a miss: its dimensions
+ * must be the ones of the block limits of its size, and its cells ids of
+ * its colors, since they index the palette of the render.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "cache.h"
+#include "color.h"
+#include "viewport.h"
+
+#define FNV_OFFSET	0xcbf29ce484222325ULL
+#define FNV_PRIME	0x100000001b3ULL
+
+struct cache_canvas_header {
+	uint64_t magic;
+	uint64_t size;
+	int32_t colors;
+	int32_t width;
+	int32_t height;
+	char lib[32];
+};
+
+struct cache_limits_entry {
+	uint64_t magic;
+	uint64_t size;
+	limits_t limits;
+};
+
+uint64_t cache_hash(const void *data, size_t len, uint64_t hash)
+{
+	const unsigned char *p = (const unsigned char *) data;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+int cache_open(struct dragon_cache *cache, const char *dir)
+{
+	memset(cache, 0, sizeof(struct dragon_cache));
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		perror(dir);
+		return -1;
+	}
+	if ((cache->dir = strdup(dir)) == NULL)
+		return -1;
+	return 0;
+}
+
+void cache_close(struct dragon_cache *cache)
+{
+	FREE(cache->dir);
+}
+
+static char *cache_path(struct dragon_cache *cache, const char *kind, uint64_t key)
+{
+	char *path;
+	if (asprintf(&path, "%s/%s-%016"PRIx64, cache->dir, kind, key) < 0)
+		return NULL;
+	return path;
+}
+
+static uint64_t cache_key(uint64_t size, const char *lib, int colors, int width, int height)
+{
+	uint64_t hash = FNV_OFFSET;
+
+	hash = cache_hash(&size, sizeof(size), hash);
+	if (lib != NULL)
+		hash = cache_hash(lib, strlen(lib) + 1, hash);
+	hash = cache_hash(&colors, sizeof(colors), hash);
+	hash = cache_hash(&width, sizeof(width), hash);
+	hash = cache_hash(&height, sizeof(height), hash);
+	return hash;
+}
+
+static int write_all(int fd, const void *buf, size_t len, off_t offset)
+{
+	const char *p = (const char *) buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = pwrite(fd, p, len, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+		offset += n;
+	}
+	return 0;
+}
+
+/* temporary file in the cache directory, renamed over path by cache_commit */
+static int cache_tmp(struct dragon_cache *cache, char **tmp)
+{
+	int fd;
+
+	if (asprintf(tmp, "%s/.tmp-XXXXXX", cache->dir) < 0) {
+		*tmp = NULL;
+		return -1;
+	}
+	if ((fd = mkstemp(*tmp)) < 0) {
+		perror(*tmp);
+		FREE(*tmp);
+		return -1;
+	}
+	fchmod(fd, 0644);
+	return fd;
+}
+
+static int cache_commit(int fd, char *tmp, const char *path, int ret)
+{
+	if (close(fd) < 0)
+		ret = -1;
+	if (ret == 0 && rename(tmp, path) < 0) {
+		perror(path);
+		ret = -1;
+	}
+	if (ret < 0)
+		unlink(tmp);
+	free(tmp);
+	return ret;
+}
+
+int cache_get_limits(struct dragon_cache *cache, uint64_t size, limits_t *limits)
+{
+	struct cache_limits_entry entry;
+	char *path;
+	int fd, ret = -1;
+
+	if ((path = cache_path(cache, "limits", cache_key(size, NULL, 0, 0, 0))) == NULL)
+		return -1;
+	if ((fd = open(path, O_RDONLY)) >= 0) {
+		if (read(fd, &entry, sizeof(entry)) == sizeof(entry) &&
+				entry.magic == CACHE_MAGIC && entry.size == size) {
+			*limits = entry.limits;
+			ret = 0;
+		}
+		close(fd);
+	}
+	free(path);
+	if (ret == 0)
+		__sync_fetch_and_add(&cache->hits, 1);
+	else
+		__sync_fetch_and_add(&cache->misses, 1);
+	return ret;
+}
+
+int cache_put_limits(struct dragon_cache *cache, uint64_t size, limits_t *limits)
+{
+	struct cache_limits_entry entry;
+	char *path, *tmp;
+	int fd, ret;
+
+	if ((path = cache_path(cache, "limits", cache_key(size, NULL, 0, 0, 0))) == NULL)
+		return -1;
+	if ((fd = cache_tmp(cache, &tmp)) < 0) {
+		free(path);
+		return -1;
+	}
+	memset(&entry, 0, sizeof(entry));
+	entry.magic = CACHE_MAGIC;
+	entry.size = size;
+	entry.limits = *limits;
+	ret = write_all(fd, &entry, sizeof(entry), 0);
+	ret = cache_commit(fd, tmp, path, ret);
+	free(path);
+	return ret;
+}
+
+/* every cell is empty or the id + 1 of one of the colors */
+static int cache_cells_valid(const char *dragon, uint64_t area, int colors)
+{
+	const unsigned char *cell = (const unsigned char *) dragon;
+	uint64_t i;
+
+	for (i = 0; i < area; i++) {
+		if (cell[i] > colors)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Map the canvas of (size, lib). A canvas drawn with K colors also serves
+ * a render with colors dividing K when K divides size: every partition of
+ * the backends then falls on the boundaries of the K ranges, and cell id k
+ * has the color k / (K / colors).
+ */
+int cache_get_canvas(struct dragon_cache *cache, uint64_t size, const char *lib, int colors,
+		struct cache_canvas *canvas)
+{
+	struct cache_canvas_header header;
+	limits_t limits;
+	struct stat st;
+	char *path;
+	void *map;
+	int fd = -1;
+	int ret = -1;
+
+	memset(canvas, 0, sizeof(struct cache_canvas));
+	if ((path = cache_path(cache, "canvas", cache_key(size, lib, 0, 0, 0))) == NULL)
+		return -1;
+	if ((fd = open(path, O_RDONLY)) < 0)
+		goto done;
+	if (read(fd, &header, sizeof(header)) != sizeof(header) ||
+			header.magic != CACHE_MAGIC || header.size != size ||
+			strncmp(header.lib, lib, sizeof(header.lib)) != 0)
+		goto done;
+	if (header.colors <= 0 || header.colors > CHAR_MAX || (header.colors != colors &&
+			(header.colors % colors != 0 || size % header.colors != 0)))
+		goto done;
+	if (dragon_limits_blocks(&limits, size, colors) < 0 ||
+			header.width != limits.maximums.x - limits.minimums.x ||
+			header.height != limits.maximums.y - limits.minimums.y)
+		goto done;
+	if (fstat(fd, &st) < 0 ||
+			(uint64_t) st.st_size != CACHE_HEADER + (uint64_t) header.width * header.height)
+		goto done;
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		goto done;
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	if (!cache_cells_valid((char *) map + CACHE_HEADER, (uint64_t) header.width * header.height,
+			header.colors)) {
+		munmap(map, st.st_size);
+		goto done;
+	}
+	canvas->map = map;
+	canvas->map_len = st.st_size;
+	canvas->dragon = (char *) map + CACHE_HEADER;
+	canvas->colors = header.colors;
+	canvas->width = header.width;
+	canvas->height = header.height;
+	ret = 0;
+done:
+	if (fd >= 0)
+		close(fd);
+	free(path);
+	if (ret == 0)
+		__sync_fetch_and_add(&cache->hits, 1);
+	else
+		__sync_fetch_and_add(&cache->misses, 1);
+	return ret;
+}
+
+/* palette of the K ids of a cached canvas, for a render with colors colors */
+struct palette *cache_palette(struct cache_canvas *canvas, int colors)
+{
+	struct palette *base, *palette;
+	int k, ratio = canvas->colors / colors;
+
+	if ((base = init_palette(colors)) == NULL || ratio == 1)
+		return base;
+	if ((palette = init_palette(canvas->colors)) == NULL) {
+		free_palette(base);
+		return NULL;
+	}
+	for (k = 0; k < canvas->colors; k++)
+		palette->colors[k] = base->colors[k / ratio];
+	free_palette(base);
+	return palette;
+}
+
+void cache_release_canvas(struct cache_canvas *canvas)
+{
+	if (canvas->map != NULL)
+		munmap(canvas->map, canvas->map_len);
+	memset(canvas, 0, sizeof(struct cache_canvas));
+}
+
+static int page_is_zero(const char *page, uint64_t len)
+{
+	const uint64_t *p = (const uint64_t *) page;
+	uint64_t i;
+
+	for (i = 0; i < len / sizeof(uint64_t); i++) {
+		if (p[i] != 0)
+			return 0;
+	}
+	for (i = len & ~(sizeof(uint64_t) - 1); i < len; i++) {
+		if (page[i] != 0)
+			return 0;
+	}
+	return 1;
+}
+
+int cache_put_canvas(struct dragon_cache *cache, uint64_t size, const char *lib, int colors,
+		char *dragon, int width, int height)
+{
+	struct cache_canvas_header header;
+	uint64_t area = (uint64_t) width * height;
+	uint64_t off, len;
+	char *path, *tmp;
+	int fd, ret = 0;
+
+	if ((path = cache_path(cache, "canvas", cache_key(size, lib, 0, 0, 0))) == NULL)
+		return -1;
+	if ((fd = cache_tmp(cache, &tmp)) < 0) {
+		free(path);
+		return -1;
+	}
+	memset(&header, 0, sizeof(header));
+	header.magic = CACHE_MAGIC;
+	header.size = size;
+	header.colors = colors;
+	header.width = width;
+	header.height = height;
+	strncpy(header.lib, lib, sizeof(header.lib) - 1);
+	if (write_all(fd, &header, sizeof(header), 0) < 0)
+		ret = -1;
+	/* only the pages holding segments are written, the others are holes */
+	for (off = 0; ret == 0 && off < area; off += CACHE_HEADER) {
+		len = area - off < CACHE_HEADER ? area - off : CACHE_HEADER;
+		if (!page_is_zero(dragon + off, len) &&
+				write_all(fd, dragon + off, len, CACHE_HEADER + off) < 0)
+			ret = -1;
+	}
+	if (ret == 0 && ftruncate(fd, CACHE_HEADER + area) < 0)
+		ret = -1;
+	ret = cache_commit(fd, tmp, path, ret);
+	free(path);
+	return ret;
+}
+
+int cache_get_image(struct dragon_cache *cache, uint64_t size, const char *lib, int colors,
+		struct rgb *image, int width, int height)
+{
+	char *path;
+	FILE *f;
+	int w, h, max;
+	int ret = -1;
+
+	if ((path = cache_path(cache, "image", cache_key(size, lib, colors, width, height))) == NULL)
+		return -1;
+	if ((f = fopen(path, "rb")) != NULL) {
+		if (fscanf(f, "P6 %d %d %d", &w, &h, &max) == 3 && fgetc(f) == '\n' &&
+				w == width && h == height && max == 255 &&
+				fread(image, sizeof(struct rgb), (size_t) width * height, f) ==
+				(size_t) width * height)
+			ret = 0;
+		fclose(f);
+	}
+	free(path);
+	if (ret == 0)
+		__sync_fetch_and_add(&cache->hits, 1);
+	else
+		__sync_fetch_and_add(&cache->misses, 1);
+	return ret;
+}
+
+int cache_put_image(struct dragon_cache *cache, uint64_t size, const char *lib, int colors,
+		struct rgb *image, int width, int height)
+{
+	char *path, *tmp;
+	int fd, ret;
+
+	if ((path = cache_path(cache, "image", cache_key(size, lib, colors, width, height))) == NULL)
+		return -1;
+	if ((fd = cache_tmp(cache, &tmp)) < 0) {
+		free(path);
+		return -1;
+	}
+	/* write_img opens the file again by name */
+	ret = write_img(image, tmp, width, height);
+	ret = cache_commit(fd, tmp, path, ret);
+	free(path);
+	return ret;
+}
@@ -0,0 +1,52 @@
+/*
+ * cache.h
+ *
+ *  Created on: 2026-10-19
+ *
+ * On-disk cache of limits, id canvases and images, keyed by a hash of the
+ * render parameters
+ */
+
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include <stdint.h>
+#include "dragon.h"
+
+#define CACHE_MAGIC	0x4e4f474152440001ULL
+/* the canvas starts on a page of the file, so that it can be mapped */
+#define CACHE_HEADER	4096
+
+struct dragon_cache {
+	char *dir;
+	uint64_t hits;
+	uint64_t misses;
+};
+
+/* id canvas mapped from the cache */
+struct cache_canvas {
+	char *dragon;
+	void *map;
+	uint64_t map_len;
+	int colors;
+	int width;
+	int height;
+};
+
+int cache_open(struct dragon_cache *cache, const char *dir);
+void cache_close(struct dragon_cache *cache);
+uint64_t cache_hash(const void *data, size_t len, uint64_t hash);
+int cache_get_limits(struct dragon_cache *cache, uint64_t size, limits_t *limits);
+int cache_put_limits(struct dragon_cache *cache, uint64_t size, limits_t *limits);
+int cache_get_canvas(struct dragon_cache *cache, uint64_t size, const char *lib, int colors,
+        struct cache_canvas *canvas);
+int cache_put_canvas(struct dragon_cache *cache, uint64_t size, const char *lib, int colors,
+        char *dragon, int width, int height);
+struct palette *cache_palette(struct cache_canvas *canvas, int colors);
+void cache_release_canvas(struct cache_canvas *canvas);
+int cache_get_image(struct dragon_cache *cache, uint64_t size, const char *lib, int colors,
+        struct rgb *image, int width, int height);
+int cache_put_image(struct dragon_cache *cache, uint64_t size, const char *lib, int colors,
+        struct rgb *image, int width, int height);
+
+#endif /* CACHE_H_ */
@@ -0,0 +1,117 @@
+/*
+ * context.c
+ *
+ *  Created on: 2026-10-19
+ *
+ * The one-shot functions (dragon_draw_pthread and the others) are wrappers
+ * around a context living for one call, on the global arena.
+ */
+
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <string.h>
+
+#include "context.h"
+
+/*
+ * With arena NULL, the context has its own arena, unmapped by
+ * dragon_ctx_release: the canvases must be freed before.
+ */
+int dragon_ctx_init(struct dragon_ctx *ctx, const struct dragon_backend *backend, int nb_thread,
+		struct dragon_arena *arena)
+{
+	return dragon_ctx_init_colors(ctx, backend, nb_thread, nb_thread, arena);
+}
+
+/*
+ * The image depends on nb_color only: the backend spreads the ranges of
+ * the colors on its nb_thread workers.
+ */
+int dragon_ctx_init_colors(struct dragon_ctx *ctx, const struct dragon_backend *backend, int nb_thread,
+		int nb_color, struct dragon_arena *arena)
+{
+	struct dragon_arena init = ARENA_INITIALIZER;
+
+	memset(ctx, 0, sizeof(*ctx));
+	if (backend == NULL || nb_thread <= 0 || nb_color <= 0)
+		return -1;
+	ctx->backend = backend;
+	ctx->nb_thread = nb_thread;
+	ctx->nb_color = nb_color;
+	ctx->own_arena = init;
+	ctx->arena = arena != NULL ? arena : &ctx->own_arena;
+	if ((ctx->palette = init_palette(nb_color)) == NULL)
+		return -1;
+	pthread_mutex_init(&ctx->lock, NULL);
+	pthread_mutex_init(&ctx->mutex_stdout, NULL);
+	return 0;
+}
+
+void dragon_ctx_release(struct dragon_ctx *ctx)
+{
+	if (ctx->backend == NULL)
+		return;
+	if (ctx->backend->release != NULL)
+		ctx->backend->release(ctx);
+	free_palette(ctx->palette);
+	ctx->palette = NULL;
+	if (ctx->arena == &ctx->own_arena)
+		arena_trim(&ctx->own_arena);
+	pthread_mutex_destroy(&ctx->lock);
+	pthread_mutex_destroy(&ctx->mutex_stdout);
+	ctx->backend = NULL;
+}
+
+int dragon_ctx_draw(struct dragon_ctx *ctx, char **canvas, struct rgb *image, int width, int height,
+		uint64_t size)
+{
+	return dragon_ctx_draw_job(ctx, NULL, canvas, image, width, height, size);
+}
+
+/*
+ * The kernels report to job and stop when it is cancelled: the serial
+ * backend sees it from the calling thread, the others from ctx->job.
+ */
+int dragon_ctx_draw_job(struct dragon_ctx *ctx, struct progress_job *job, char **canvas,
+		struct rgb *image, int width, int height, uint64_t size)
+{
+	struct progress_job *saved = progress_job;
+	int ret;
+
+	if (ctx->packed && ctx->nb_color > PACKED_COLORS)
+		return -1;
+	pthread_mutex_lock(&ctx->lock);
+	ctx->job = job;
+	progress_job = job;
+	ret = ctx->backend->draw(ctx, canvas, image, width, height, size);
+	progress_job = saved;
+	ctx->job = NULL;
+	pthread_mutex_unlock(&ctx->lock);
+	return ret;
+}
+
+int dragon_ctx_limits(struct dragon_ctx *ctx, limits_t *limits, uint64_t size)
+{
+	int ret;
+
+	pthread_mutex_lock(&ctx->lock);
+	ret = ctx->backend->limits(ctx, limits, size);
+	pthread_mutex_unlock(&ctx->lock);
+	return ret;
+}
+
+void dragon_ctx_free(struct dragon_ctx *ctx, void *ptr)
+{
+	arena_free(ctx->arena, ptr);
+}
+
+void dragon_ctx_printf(struct dragon_ctx *ctx, const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	pthread_mutex_lock(&ctx->mutex_stdout);
+	vprintf(format, ap);
+	pthread_mutex_unlock(&ctx->mutex_stdout);
+	va_end(ap);
+}
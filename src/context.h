@@ -0,0 +1,76 @@
+/*
+ * context.h
+ *
+ *  Created on: 2026-10-19
+ *
+ * Render context: the backend, the thread budget and the resources kept from
+ * one render to the next
+ */
+
+#ifndef CONTEXT_H_
+#define CONTEXT_H_
+
+#include <pthread.h>
+#include "dragon.h"
+#include "progress.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "perf.h"
+
+struct dragon_ctx;
+
+struct dragon_backend {
+	const char *name;
+	int (*draw)(struct dragon_ctx *ctx, char **canvas, struct rgb *image, int width, int height,
+	        uint64_t size);
+	int (*limits)(struct dragon_ctx *ctx, limits_t *limits, uint64_t size);
+	/* free the pool, NULL when the backend has none */
+	void (*release)(struct dragon_ctx *ctx);
+	/* the ranges of the stages follow ctx->split */
+	int split;
+};
+
+/*
+ * A context renders one image at a time, several contexts may render
+ * concurrently. The canvases come from its arena and go back to it with
+ * dragon_ctx_free.
+ */
+struct dragon_ctx {
+	const struct dragon_backend *backend;
+	int nb_thread;
+	int nb_color;			/* segments cut in nb_color ranges, one color each */
+	struct dragon_arena *arena;
+	struct dragon_arena own_arena;
+	struct palette *palette;	/* nb_color colors */
+	void *pool;			/* workers of the backend, started by its first render */
+	struct progress_job *job;	/* render in progress, seen by the workers */
+	int packed;			/* canvases of two cells per byte, see canvas_cell */
+	/* ranges per thread of each perf stage, 0 leaves the split to the backend */
+	int split[PERF_STAGE_MAX];
+	pthread_mutex_t lock;
+	pthread_mutex_t mutex_stdout;
+};
+
+extern const struct dragon_backend dragon_backend_serial;
+
+int dragon_ctx_init(struct dragon_ctx *ctx, const struct dragon_backend *backend, int nb_thread,
+        struct dragon_arena *arena);
+int dragon_ctx_init_colors(struct dragon_ctx *ctx, const struct dragon_backend *backend, int nb_thread,
+        int nb_color, struct dragon_arena *arena);
+void dragon_ctx_release(struct dragon_ctx *ctx);
+int dragon_ctx_draw(struct dragon_ctx *ctx, char **canvas, struct rgb *image, int width, int height,
+        uint64_t size);
+int dragon_ctx_draw_job(struct dragon_ctx *ctx, struct progress_job *job, char **canvas,
+        struct rgb *image, int width, int height, uint64_t size);
+int dragon_ctx_limits(struct dragon_ctx *ctx, limits_t *limits, uint64_t size);
+void dragon_ctx_free(struct dragon_ctx *ctx, void *ptr);
+void dragon_ctx_printf(struct dragon_ctx *ctx, const char *format, ...);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONTEXT_H_ */
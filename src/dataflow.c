@@ -0,0 +1,129 @@
+/*
+ * dataflow.c
+ *
+ *  Created on: 2026-10-19
+ *
+ * The segments of each color are cut in DATAFLOW_RANGES ranges, whose
+ * bounding boxes come from the block hierarchy in O(log size). A band of
+ * image rows counts the ranges whose canvas rows it reads, plus a token
+ * released by the range of the same index modulo the ranges, so that the
+ * bands read by no range are rendered too. The thread dropping the count
+ * to zero renders the band right away: the atomic decrement orders the
+ * writes of every range of the band before its render. A range starts
+ * from its seed when the backend scanned the limits, see dragon_seeds.
+ */
+
+#include <stdlib.h>
+
+#include "dataflow.h"
+#include "viewport.h"
+#include "perf.h"
+#include "trace.h"
+
+/* band of the image rows reading canvas row i, see scale_dragon */
+static int dataflow_row_band(struct dragon_dataflow *df, struct draw_data *data, int64_t i)
+{
+	int64_t y = (i + data->deltaI) / data->scale;
+	int64_t band = y / df->band_rows;
+
+	if (band < 0)
+		return 0;
+	if (band >= df->nb_band)
+		return df->nb_band - 1;
+	return (int) band;
+}
+
+/* segments ]start, end] of a range, inside the ones of its color */
+void dataflow_range_segments(struct dragon_dataflow *df, struct draw_data *data, int range,
+		uint64_t *start, uint64_t *end)
+{
+	*start = range * data->size / df->nb_range;
+	*end = (range + 1) * data->size / df->nb_range;
+}
+
+/* data holds the canvas, image and scale of the render, with nb_color colors */
+int dataflow_init(struct dragon_dataflow *df, struct draw_data *data)
+{
+	limits_t box;
+	uint64_t start, end;
+	int r, b;
+
+	df->nb_range = data->nb_color * DATAFLOW_RANGES;
+	df->nb_band = data->nb_thread * DATAFLOW_BANDS;
+	if (df->nb_band > data->image_height)
+		df->nb_band = data->image_height;
+	df->band_rows = (data->image_height + df->nb_band - 1) / df->nb_band;
+	df->nb_band = (data->image_height + df->band_rows - 1) / df->band_rows;
+	df->first_band = malloc(sizeof(int) * df->nb_range);
+	df->last_band = malloc(sizeof(int) * df->nb_range);
+	df->pending = malloc(sizeof(int) * df->nb_band);
+	if (df->first_band == NULL || df->last_band == NULL || df->pending == NULL) {
+		dataflow_free(df);
+		return -1;
+	}
+	for (b = 0; b < df->nb_band; b++)
+		df->pending[b] = 1;
+	for (r = 0; r < df->nb_range; r++) {
+		dataflow_range_segments(df, data, r, &start, &end);
+		dragon_range_limits(start, end, &box);
+		df->first_band[r] = dataflow_row_band(df, data, box.minimums.y - data->limits.minimums.y);
+		df->last_band[r] = dataflow_row_band(df, data, box.maximums.y - data->limits.minimums.y);
+		for (b = df->first_band[r]; b <= df->last_band[r]; b++)
+			df->pending[b]++;
+	}
+	return 0;
+}
+
+void dataflow_free(struct dragon_dataflow *df)
+{
+	FREE(df->first_band);
+	FREE(df->last_band);
+	FREE(df->pending);
+}
+
+/* thread is the id of the caller in the perf report */
+void dataflow_band(struct dragon_dataflow *df, struct draw_data *data, int band, int thread)
+{
+	struct perf_sample ps;
+	int start = band * df->band_rows;
+	int end = start + df->band_rows;
+
+	if (end > data->image_height)
+		end = data->image_height;
+	trace_begin_range("render", start, end);
+	perf_stage_begin(&ps);
+	scale_dragon_packed(start, end, data->image, data->image_width, data->image_height,
+			data->dragon, data->dragon_width, data->dragon_height, data->palette, data->packed);
+	perf_stage_end(&ps, PERF_STAGE_RENDER, thread);
+	trace_end("render");
+}
+
+static inline void dataflow_release(struct dragon_dataflow *df, struct draw_data *data, int band,
+		int thread)
+{
+	if (__sync_sub_and_fetch(&df->pending[band], 1) == 0)
+		dataflow_band(df, data, band, thread);
+}
+
+/* draw a range with the color of its segments, then render the bands it completes */
+int dataflow_range(struct dragon_dataflow *df, struct draw_data *data, int range, int thread)
+{
+	struct perf_sample ps;
+	struct dragon_walk walk;
+	uint64_t start, end;
+	int b, ret;
+
+	for (b = range; b < df->nb_band; b += df->nb_range)
+		dataflow_release(df, data, b, thread);
+	dataflow_range_segments(df, data, range, &start, &end);
+	trace_begin_range("draw", start, end);
+	perf_stage_begin(&ps);
+	seeds_walk(data->seeds, start, data->limits, &walk);
+	ret = dragon_draw_from(start, end, &walk, data->dragon, data->dragon_width, data->dragon_height,
+			range / DATAFLOW_RANGES, DRAW_FLAGS | (data->packed ? WALK_PACKED | WALK_SHARED : 0));
+	perf_stage_end(&ps, PERF_STAGE_DRAW, thread);
+	trace_end("draw");
+	for (b = df->first_band[range]; b <= df->last_band[range]; b++)
+		dataflow_release(df, data, b, thread);
+	return ret;
+}
@@ -0,0 +1,43 @@
+/*
+ * dataflow.h
+ *
+ *  Created on: 2026-10-19
+ *
+ * Draw and render without a barrier between them: each band of image rows
+ * is rendered as soon as every range of segments falling in it is drawn
+ */
+
+#ifndef DATAFLOW_H_
+#define DATAFLOW_H_
+
+#include "dragon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ranges of segments per color, and bands of image rows per thread */
+#define DATAFLOW_RANGES	8
+#define DATAFLOW_BANDS	8
+
+struct dragon_dataflow {
+	int nb_range;		/* nb_color * DATAFLOW_RANGES, in the order of the segments */
+	int nb_band;
+	int band_rows;		/* image rows per band, the last one may have fewer */
+	int *first_band;	/* bands read by the canvas rows of each range */
+	int *last_band;
+	int *pending;		/* ranges not yet drawn, per band */
+};
+
+int dataflow_init(struct dragon_dataflow *df, struct draw_data *data);
+void dataflow_free(struct dragon_dataflow *df);
+void dataflow_range_segments(struct dragon_dataflow *df, struct draw_data *data, int range,
+        uint64_t *start, uint64_t *end);
+int dataflow_range(struct dragon_dataflow *df, struct draw_data *data, int range, int thread);
+void dataflow_band(struct dragon_dataflow *df, struct draw_data *data, int band, int thread);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DATAFLOW_H_ */
@@ -0,0 +1,230 @@
+/*
+ * deadline.c
+ *
+ *  Created on: 2026-10-19
+ *
+ * The cost of a render is predicted from the throughput of piece_limit and
+ * dragon_draw_walk per segment, and of scale_dragon per canvas cell and
+ * pixel, measured once on 2^DEADLINE_CALIBRATION_POWER segments. The
+ * canvas of a size comes from the block limits in O(log size), and the
+ * stages are divided among the threads usable by the process.
+ *
+ * The candidates are the requested size halved until one is predicted to
+ * finish in DEADLINE_MARGIN of the deadline. A smaller one, predicted in
+ * DEADLINE_FALLBACK of it, is drawn first in the image. The target is then
+ * rendered in a spare image, copied over the fallback when it ends in time.
+ * Both renders are cancelled at DEADLINE_CANCEL of the deadline, less the
+ * time for the workers to see it at their next progress chunk, or the
+ * latency measured on the last cancelled renders if longer: the image is
+ * ready when they have stopped. When nothing fits, the smallest candidate
+ * is still tried.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "deadline.h"
+#include "async.h"
+#include "tune.h"
+#include "viewport.h"
+
+static double deadline_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* abstime on CLOCK_MONOTONIC, ms from now */
+static void deadline_abstime(struct timespec *abstime, double ms)
+{
+	clock_gettime(CLOCK_MONOTONIC, abstime);
+	abstime->tv_sec += (uint64_t) (ms * 1e6) / 1000000000ULL;
+	abstime->tv_nsec += (uint64_t) (ms * 1e6) % 1000000000ULL;
+	if (abstime->tv_nsec >= 1000000000L) {
+		abstime->tv_sec++;
+		abstime->tv_nsec -= 1000000000L;
+	}
+}
+
+/*
+ * size segments in the background until abstime, cancelled then. The delay
+ * from abstime to the stop of the workers is kept in rates->cancel_ms: it
+ * rises at once and decays by half on the next cancels.
+ */
+static enum dragon_render_state deadline_render(struct dragon_ctx *ctx, struct deadline_rates *rates,
+		struct rgb *image, int width, int height, uint64_t size, const struct timespec *abstime,
+		char **canvas)
+{
+	struct dragon_render *r;
+	enum dragon_render_state state;
+	int cancelled;
+	double late;
+
+	if ((r = dragon_render_async(ctx, image, width, height, size, NULL, NULL)) == NULL)
+		return DRAGON_RENDER_FAILED;
+	if ((cancelled = dragon_render_timedwait(r, abstime) == DRAGON_RENDER_RUNNING))
+		dragon_render_cancel(r);
+	state = dragon_render_wait(r, canvas);
+	if (cancelled) {
+		late = deadline_now_ms() - (abstime->tv_sec * 1e3 + abstime->tv_nsec / 1e6);
+		rates->cancel_ms = late > rates->cancel_ms ? late : (rates->cancel_ms + late) / 2;
+	}
+	dragon_render_free(r);
+	return state;
+}
+
+/* the canvas of the calibration is rendered in a small image, its cells dominate */
+#define CALIBRATION_IMAGE	64
+
+int deadline_calibrate(struct deadline_rates *rates)
+{
+	uint64_t n = 1ULL << DEADLINE_CALIBRATION_POWER;
+	struct palette *palette = NULL;
+	struct rgb *image = NULL;
+	char *canvas = NULL;
+	piece_t piece;
+	int width, height;
+	double t;
+	int ret = 0;
+
+	piece_init(&piece);
+	t = deadline_now_ms();
+	piece_limit(0, n, &piece);
+	rates->limits_ns = (deadline_now_ms() - t) * 1e6 / n;
+
+	width = piece.limits.maximums.x - piece.limits.minimums.x;
+	height = piece.limits.maximums.y - piece.limits.minimums.y;
+	if ((canvas = calloc((uint64_t) width * height, 1)) == NULL)
+		goto err;
+	t = deadline_now_ms();
+	if (dragon_draw_walk(0, n, canvas, width, height, piece.limits, 0, DRAW_FLAGS) < 0)
+		goto err;
+	rates->draw_ns = (deadline_now_ms() - t) * 1e6 / n;
+
+	if ((palette = init_palette(1)) == NULL ||
+			(image = malloc(sizeof(struct rgb) * CALIBRATION_IMAGE * CALIBRATION_IMAGE)) == NULL)
+		goto err;
+	t = deadline_now_ms();
+	scale_dragon(0, CALIBRATION_IMAGE, image, CALIBRATION_IMAGE, CALIBRATION_IMAGE, canvas, width, height,
+			palette);
+	rates->render_ns = (deadline_now_ms() - t) * 1e6 /
+			((uint64_t) width * height + CALIBRATION_IMAGE * CALIBRATION_IMAGE);
+	rates->cancel_ms = 0;
+	rates->nb_cpu = tune_cpus();
+
+done:
+	FREE(canvas);
+	FREE(image);
+	free_palette(palette);
+	return ret;
+err:
+	ret = -1;
+	goto done;
+}
+
+/* milliseconds of a render of size segments on nb_thread threads */
+double deadline_predict(struct deadline_rates *rates, uint64_t size, int width, int height, int nb_thread)
+{
+	int par = nb_thread < rates->nb_cpu ? nb_thread : rates->nb_cpu;
+	limits_t limits;
+	uint64_t cells;
+
+	if (dragon_limits_blocks(&limits, size, nb_thread) < 0)
+		return -1;
+	cells = (uint64_t) (limits.maximums.x - limits.minimums.x) * (limits.maximums.y - limits.minimums.y) +
+			(uint64_t) width * height;
+	if (par < 1)
+		par = 1;
+	return (size * (rates->limits_ns + rates->draw_ns) + cells * rates->render_ns) / 1e6 / par;
+}
+
+/* the largest of size, size / 2, size / 4... predicted within ms, 0 if none */
+uint64_t deadline_pick(struct deadline_rates *rates, uint64_t size, int width, int height, int nb_thread,
+		double ms)
+{
+	double p;
+
+	for (; size > 0; size >>= 1) {
+		p = deadline_predict(rates, size, width, height, nb_thread);
+		if (p >= 0 && p <= ms)
+			return size;
+	}
+	return 0;
+}
+
+/* ms for the workers to stop: a progress chunk on each processor, or the latency measured if longer */
+static double deadline_cancel_ms(struct deadline_rates *rates)
+{
+	double chunk = PROGRESS_CHUNK * (rates->limits_ns + rates->draw_ns) / 1e6;
+
+	return rates->cancel_ms > chunk ? rates->cancel_ms : chunk;
+}
+
+/*
+ * Render the largest size predicted to end within deadline_ms of the call,
+ * at most size. The rates are calibrated before, outside of the deadline.
+ * Returns -1 if no render finished in time, res tells the size delivered.
+ * *canvas is the one of the target, NULL if the fallback was delivered.
+ */
+int dragon_draw_deadline(struct dragon_ctx *ctx, struct deadline_rates *rates, char **canvas,
+		struct rgb *image, int width, int height, uint64_t size, double deadline_ms,
+		struct deadline_result *res)
+{
+	int nb_thread = ctx->backend == &dragon_backend_serial ? 1 : ctx->nb_thread;
+	enum dragon_render_state state;
+	struct rgb *spare = NULL;
+	struct timespec cancel;
+	double start = deadline_now_ms();
+	double cancel_ms;
+	int ret = 0;
+
+	*canvas = NULL;
+	memset(res, 0, sizeof(*res));
+	res->requested = size;
+	if (rates->nb_cpu == 0 || size == 0)
+		goto err;
+	cancel_ms = deadline_ms * DEADLINE_CANCEL - deadline_cancel_ms(rates);
+	/* too short to leave the workers their margin, the smallest candidate runs to the cancel */
+	if (cancel_ms <= 0)
+		cancel_ms = deadline_ms * DEADLINE_CANCEL;
+	deadline_abstime(&cancel, cancel_ms);
+
+	res->target = deadline_pick(rates, size, width, height, nb_thread,
+			cancel_ms < deadline_ms * DEADLINE_MARGIN ? cancel_ms : deadline_ms * DEADLINE_MARGIN);
+	/* none predicted in time, the smallest candidate */
+	if (res->target == 0)
+		res->target = 1;
+	res->predicted_ms = deadline_predict(rates, res->target, width, height, nb_thread);
+	res->fallback = deadline_pick(rates, res->target >> 1, width, height, nb_thread,
+			deadline_ms * DEADLINE_FALLBACK);
+
+	/* a fallback late too leaves nothing to deliver */
+	if (res->fallback > 0 &&
+			deadline_render(ctx, rates, image, width, height, res->fallback, &cancel, NULL) != DRAGON_RENDER_DONE)
+		goto err;
+
+	if ((spare = make_canvas(width, height)) == NULL)
+		goto err;
+	state = deadline_render(ctx, rates, spare, width, height, res->target, &cancel, canvas);
+	if (state == DRAGON_RENDER_DONE) {
+		memcpy(image, spare, sizeof(struct rgb) * width * height);
+		res->size = res->target;
+	} else if (res->fallback > 0) {
+		/* the image still holds the fallback */
+		res->size = res->fallback;
+	} else {
+		goto err;
+	}
+
+done:
+	res->elapsed_ms = deadline_now_ms() - start;
+	ARENA_FREE(spare);
+	return ret;
+err:
+	ret = -1;
+	goto done;
+}
@@ -0,0 +1,50 @@
+/*
+ * deadline.h
+ *
+ *  Created on: 2026-10-19
+ *
+ * Render within a deadline: the largest size predicted to finish in time
+ * from the throughput of the kernels, with a smaller render kept in case
+ * the prediction was wrong
+ */
+
+#ifndef DEADLINE_H_
+#define DEADLINE_H_
+
+#include "context.h"
+
+/* segments of the calibration of the kernels */
+#define DEADLINE_CALIBRATION_POWER	18
+/* share of the deadline that the predicted render may take */
+#define DEADLINE_MARGIN		0.8
+/* share of the deadline for the fallback render */
+#define DEADLINE_FALLBACK	0.125
+/* share of the deadline at which the renders are cancelled, the rest is left to the workers to stop */
+#define DEADLINE_CANCEL		0.9
+
+struct deadline_rates {
+	double limits_ns;	/* per segment of piece_limit */
+	double draw_ns;		/* per segment of dragon_draw_walk */
+	double render_ns;	/* per canvas cell or pixel of scale_dragon */
+	double cancel_ms;	/* from the cancel time to the stop of the workers, 0 until a render is cancelled */
+	int nb_cpu;		/* 0 until calibrated */
+};
+
+struct deadline_result {
+	uint64_t requested;
+	uint64_t size;		/* delivered, 0 if none */
+	uint64_t target;	/* predicted to finish in time */
+	uint64_t fallback;	/* drawn first, 0 if none */
+	double predicted_ms;	/* of the target */
+	double elapsed_ms;
+};
+
+int deadline_calibrate(struct deadline_rates *rates);
+double deadline_predict(struct deadline_rates *rates, uint64_t size, int width, int height, int nb_thread);
+uint64_t deadline_pick(struct deadline_rates *rates, uint64_t size, int width, int height, int nb_thread,
+        double ms);
+int dragon_draw_deadline(struct dragon_ctx *ctx, struct deadline_rates *rates, char **canvas,
+        struct rgb *image, int width, int height, uint64_t size, double deadline_ms,
+        struct deadline_result *res);
+
+#endif /* DEADLINE_H_ */
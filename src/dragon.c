@@ -10,11 +10,19 @@
 
 #define _GNU_SOURCE
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
 #include "dragon.h"
 #include "color.h"
+#include "perf.h"
+#include "trace.h"
+#include "progress.h"
+#include "context.h"
 
 xy_t compute_position(int64_t i)
 {
@@ -56,46 +64,134 @@ xy_t compute_orientation(int64_t i)
 	return orientation;
 }
 
-/* draw dragon in raw matrix */
-int dragon_draw_raw(uint64_t start, uint64_t end, char *dragon, int width, int height, limits_t limits, char id)
+/*
+ * Spatially binned drawing. Each thread first traces its range into
+ * per-tile buffers with dragon_bin_raw, then the owner of each tile
+ * writes the buffered segments with dragon_drain_bins. Tiles are
+ * contiguous runs of whole cache lines of the canvas, so every line of
+ * the canvas has exactly one writer.
+ */
+
+/*
+ * Canvas from the arena, page aligned so that tiles are aligned on cache
+ * lines. The canvas is zero, which is the empty cell: cells hold id + 1.
+ */
+char *make_dragon(uint64_t area)
 {
-	//printf("start=%" PRId64" end=%"PRId64" id=%d\n", start, end, id);
-	if (end < start)
-		printf("error: start=%"PRId64" > end=%"PRId64"\n", start, end);
+	return (char *) arena_alloc_zero(&dragon_arena, area);
+}
 
-	if (end == start)
-		return 0;
+uint64_t dragon_tile_bytes(uint64_t area, int nb_tile)
+{
+	uint64_t bytes = (area + nb_tile - 1) / nb_tile;
+	return (bytes + 63) & ~((uint64_t) 63);
+}
 
-	xy_t position;
-	xy_t orientation;
-	int i, j;
-	uint64_t n;
-	position = compute_position(start);
-	orientation = compute_orientation(start);
-
-	// draw dragon
-	position.x -= limits.minimums.x;
-	position.y -= limits.minimums.y;
-	int area = width * height;
-	for (n = start + 1; n <= end; n++) {
-		j = (position.x + (position.x + orientation.x)) >> 1;
-		i = (position.y + (position.y + orientation.y)) >> 1;
-		int index = i * width + j;
-		if (index < 0 || index > area) {
-			printf("index is out of range\n");
-			return -1;
-		}
-		dragon[index] = id;
-		position.x += orientation.x;
-		position.y += orientation.y;
-		if (((n & -n) << 1) & n)
-			rotate_left(&orientation);
-		else
-			rotate_right(&orientation);
+/* cells of a tile, whole cache lines of the canvas packed or not */
+uint64_t dragon_tile_cells(uint64_t area, int nb_tile, int packed)
+{
+	if (packed)
+		return 2 * dragon_tile_bytes(canvas_bytes(area, 1), nb_tile);
+	return dragon_tile_bytes(area, nb_tile);
+}
+
+int bins_init(struct dragon_bins *bins, int nb_tile)
+{
+	bins->nb_tile = nb_tile;
+	bins->slabs = NULL;
+	bins->index = (uint32_t **) calloc(nb_tile, sizeof(uint32_t *));
+	bins->len = (uint64_t *) calloc(nb_tile, sizeof(uint64_t));
+	bins->cap = (uint64_t *) calloc(nb_tile, sizeof(uint64_t));
+	if (bins->index == NULL || bins->len == NULL || bins->cap == NULL) {
+		bins_free(bins);
+		return -1;
 	}
 	return 0;
 }
 
+void bins_reset(struct dragon_bins *bins)
+{
+	memset(bins->len, 0, sizeof(uint64_t) * bins->nb_tile);
+}
+
+void bins_free(struct dragon_bins *bins)
+{
+	struct bins_slab *slab;
+
+	while ((slab = bins->slabs) != NULL) {
+		bins->slabs = slab->next;
+		arena_free(&dragon_arena, slab);
+	}
+	FREE(bins->index);
+	FREE(bins->len);
+	FREE(bins->cap);
+}
+
+/* first slab of a tracer, the next ones double */
+#define BINS_SLAB	(256 * 1024)
+
+/* bytes of the current slab, a new slab from the arena when it is full */
+static void *bins_carve(struct dragon_bins *bins, uint64_t bytes)
+{
+	struct bins_slab *slab = bins->slabs;
+	uint64_t capacity;
+
+	if (slab == NULL || slab->used + bytes > slab->capacity) {
+		capacity = slab != NULL ? 2 * slab->capacity : BINS_SLAB;
+		while (capacity < sizeof(struct bins_slab) + bytes)
+			capacity *= 2;
+		if ((slab = (struct bins_slab *) arena_alloc(&dragon_arena, capacity)) == NULL)
+			return NULL;
+		slab->next = bins->slabs;
+		slab->used = sizeof(struct bins_slab);
+		slab->capacity = capacity;
+		bins->slabs = slab;
+	}
+	slab->used += bytes;
+	return (char *) slab + slab->used - bytes;
+}
+
+/*
+ * Grow the bin of a tile, called by the walk when the bin is full. The
+ * old bin stays in its slab until bins_free.
+ */
+int bins_grow(struct dragon_bins *bins, int tile)
+{
+	uint64_t cap = bins->cap[tile] ? bins->cap[tile] * 2 : 4096;
+	uint32_t *buf = (uint32_t *) bins_carve(bins, cap * sizeof(uint32_t));
+	if (buf == NULL) {
+		printf("malloc error bins\n");
+		return -1;
+	}
+	if (bins->index[tile] != NULL)
+		memcpy(buf, bins->index[tile], bins->len[tile] * sizeof(uint32_t));
+	bins->index[tile] = buf;
+	bins->cap[tile] = cap;
+	return 0;
+}
+
+/*
+ * Write the segments of one tile, traced by nb_bins threads, thread i has
+ * id i. A packed tile is made of whole bytes: its writer needs no atomic.
+ */
+void dragon_drain_bins(struct dragon_bins *bins, int nb_bins, int tile, char *dragon, int packed)
+{
+	int t;
+	uint64_t k;
+
+	for (t = 0; t < nb_bins; t++) {
+		uint32_t *index = bins[t].index[tile];
+		uint64_t len = bins[t].len[tile];
+		if (packed) {
+			for (k = 0; k < len; k++)
+				dragon[index[k] >> 1] |= (t + 1) << ((index[k] & 1) << 2);
+		} else {
+			for (k = 0; k < len; k++)
+				dragon[index[k]] = t + 1;
+		}
+	}
+}
+
 void init_canvas(int start, int end, char *canvas, char value)
 {
     int i;
@@ -111,7 +207,7 @@ void dump_canvas(char *canvas, int width, int height)
 	printf("width=%d height=%d\n", width, height);
 	for (i = 0; i < width; i++) {
 		for (j = 0; j < height; j++) {
-			printf("%d ", canvas[j * width + i]);
+			printf("%d ", canvas[j * width + i] - 1);
 		}
 		printf("\n");
 	}
@@ -131,8 +227,38 @@ void dump_canvas_rgb(struct rgb *canvas, int width, int height)
 	}
 }
 
-void scale_dragon(int start, int end, struct rgb *image, int image_width, int image_height,
-        char *dragon, int dragon_width, int dragon_height, struct palette *palette)
+/* sum of the colors of the cells of a packed byte, an empty cell is white */
+struct packed_rgb {
+    uint16_t r;
+    uint16_t g;
+    uint16_t b;
+};
+
+static void packed_tables(struct palette *palette, struct packed_rgb *cell, struct packed_rgb *pair)
+{
+    int v;
+
+    for (v = 0; v < 16; v++) {
+        struct rgb c = (v > 0 && v <= palette->len) ? palette->colors[v - 1] : white;
+        cell[v].r = c.r;
+        cell[v].g = c.g;
+        cell[v].b = c.b;
+    }
+    for (v = 0; v < 256; v++) {
+        pair[v].r = cell[v & 0xf].r + cell[v >> 4].r;
+        pair[v].g = cell[v & 0xf].g + cell[v >> 4].g;
+        pair[v].b = cell[v & 0xf].b + cell[v >> 4].b;
+    }
+}
+
+/*
+ * Average the canvas cells falling in each pixel of rows [start, end). A
+ * packed canvas is read a byte, so two cells, at a time. The canvas holds
+ * the cells from row first_row of the dragon, see scale_dragon_band.
+ */
+static inline void scale_rows(int start, int end, struct rgb *image, int image_width, int image_height,
+        char *dragon, int first_row, int dragon_width, int dragon_height, struct palette *palette,
+        int packed)
 {
     int i, j, x, y;
     int scale_x = dragon_width / image_width + 1;
@@ -141,7 +267,10 @@ void scale_dragon(int start, int end, struct rgb *image, int image_width, int im
     int deltaJ = (scale * image_width - dragon_width) / 2;
     int deltaI = (scale * image_height - dragon_height) / 2;
     struct rgb *colors = palette->colors;
+    struct packed_rgb cell[16], pair[256];
 
+    if (packed)
+        packed_tables(palette, cell, pair);
     for (y = start; y < end; y++) {
         int i1 = y * scale - deltaI;
         int i2 = i1 + scale;
@@ -155,9 +284,29 @@ void scale_dragon(int start, int end, struct rgb *image, int image_width, int im
             int cnt = 0;
             if (j1 < 0) j1 = 0;
             if (j2 > dragon_width) j2 = dragon_width;
-            for (i = i1; i < i2; i++) {
+            for (i = i1; packed && i < i2; i++) {
+                const unsigned char *bytes = (const unsigned char *) dragon;
+                uint64_t k = (uint64_t) (i - first_row) * dragon_width + j1;
+                uint64_t e = k + (j2 > j1 ? j2 - j1 : 0);
+                const struct packed_rgb *c;
+                cnt += e - k;
+                if (k < e && (k & 1)) {
+                    c = &cell[bytes[k >> 1] >> 4];
+                    red += c->r; green += c->g; blue += c->b;
+                    k++;
+                }
+                for (; k + 1 < e; k += 2) {
+                    c = &pair[bytes[k >> 1]];
+                    red += c->r; green += c->g; blue += c->b;
+                }
+                if (k < e) {
+                    c = &cell[bytes[k >> 1] & 0xf];
+                    red += c->r; green += c->g; blue += c->b;
+                }
+            }
+            for (i = i1; !packed && i < i2; i++) {
                 for (j = j1; j < j2; j++) {
-                    int id = dragon[i * dragon_width + j];
+                    int id = dragon[(i - first_row) * dragon_width + j] - 1;
                     if (id >= 0) {
                         red     += colors[id].r;
                         green   += colors[id].g;
@@ -179,14 +328,107 @@ void scale_dragon(int start, int end, struct rgb *image, int image_width, int im
                 image[index].b = (unsigned char) (blue  / cnt);
             }
         }
+        if (!progress_chunk(PROGRESS_ROWS_RENDERED, 1))
+            break;
     }
 }
 
-int dragon_draw_serial(char **canvas, struct rgb *image, int width, int height, uint64_t size, int nb_colors)
+void scale_dragon(int start, int end, struct rgb *image, int image_width, int image_height,
+        char *dragon, int dragon_width, int dragon_height, struct palette *palette)
+{
+    scale_rows(start, end, image, image_width, image_height, dragon, 0, dragon_width, dragon_height,
+            palette, 0);
+}
+
+/*
+ * Image rows [start, end) from a band of the canvas, which holds the rows
+ * of the dragon from first_row on: at least the ones read by these rows.
+ */
+void scale_dragon_band(int start, int end, struct rgb *image, int image_width, int image_height,
+        char *band, int first_row, int dragon_width, int dragon_height, struct palette *palette)
+{
+    scale_rows(start, end, image, image_width, image_height, band, first_row, dragon_width,
+            dragon_height, palette, 0);
+}
+
+void scale_dragon_packed(int start, int end, struct rgb *image, int image_width, int image_height,
+        char *dragon, int dragon_width, int dragon_height, struct palette *palette, int packed)
+{
+    if (packed)
+        scale_rows(start, end, image, image_width, image_height, dragon, 0, dragon_width, dragon_height,
+                palette, 1);
+    else
+        scale_rows(start, end, image, image_width, image_height, dragon, 0, dragon_width, dragon_height,
+                palette, 0);
+}
+
+int accum_init(struct dragon_accum *acc, int image_width, int image_height, int dragon_width, int dragon_height)
+{
+	int scale_x = dragon_width / image_width + 1;
+	int scale_y = dragon_height / image_height + 1;
+
+	acc->image_width = image_width;
+	acc->image_height = image_height;
+	acc->dragon_width = dragon_width;
+	acc->dragon_height = dragon_height;
+	acc->scale = (scale_x > scale_y ? scale_x : scale_y);
+	acc->deltaJ = (acc->scale * image_width - dragon_width) / 2;
+	acc->deltaI = (acc->scale * image_height - dragon_height) / 2;
+	acc->sums = (uint64_t *) arena_alloc_zero(&dragon_arena,
+			4 * sizeof(uint64_t) * image_width * image_height);
+	return acc->sums == NULL ? -1 : 0;
+}
+
+void accum_free(struct dragon_accum *acc)
+{
+	ARENA_FREE(acc->sums);
+}
+
+/* number of canvas cells averaged in the pixel (x, y) */
+int64_t accum_cells(struct dragon_accum *acc, int x, int y)
+{
+	int scale = acc->scale;
+	int i1 = y * scale - acc->deltaI, i2 = i1 + scale;
+	int j1 = x * scale - acc->deltaJ, j2 = j1 + scale;
+
+	if (i1 < 0) i1 = 0;
+	if (i2 > acc->dragon_height) i2 = acc->dragon_height;
+	if (j1 < 0) j1 = 0;
+	if (j2 > acc->dragon_width) j2 = acc->dragon_width;
+	return (int64_t) (i2 > i1 ? i2 - i1 : 0) * (j2 > j1 ? j2 - j1 : 0);
+}
+
+/* same pixels as scale_dragon, the cells without segment are white */
+void accum_render(struct dragon_accum *acc, int start, int end, struct rgb *image)
+{
+	int x, y;
+
+	for (y = start; y < end; y++) {
+		for (x = 0; x < acc->image_width; x++) {
+			int index = y * acc->image_width + x;
+			uint64_t *sum = acc->sums + 4 * (uint64_t) index;
+			int64_t cnt = accum_cells(acc, x, y);
+			if (cnt == 0) {
+				image[index] = white;
+			} else {
+				uint64_t empty = 255 * (cnt - sum[3]);
+				image[index].r = (unsigned char) ((sum[0] + empty) / cnt);
+				image[index].g = (unsigned char) ((sum[1] + empty) / cnt);
+				image[index].b = (unsigned char) ((sum[2] + empty) / cnt);
+			}
+		}
+		if (!progress_chunk(PROGRESS_ROWS_RENDERED, 1))
+			break;
+	}
+}
+
+static int draw_serial(struct dragon_ctx *ctx, char **canvas, struct rgb *image, int width, int height,
+		uint64_t size)
 {
 	int ret = 0;
 	char *dragon = NULL;
-	struct palette *palette = NULL;
+	int nb_colors = ctx->nb_color;
+	struct perf_sample ps;
 	limits_t limits;
 
 	if (dragon_limits_serial(&limits, size, 0) < 0)
@@ -194,41 +436,69 @@ int dragon_draw_serial(char **canvas, struct rgb *image, int width, int height,
 
 	int dragon_width = limits.maximums.x - limits.minimums.x;
 	int dragon_height = limits.maximums.y - limits.minimums.y;
-	int area = dragon_width * dragon_height;
+	uint64_t area = (uint64_t) dragon_width * dragon_height;
+	int flags = DRAW_FLAGS | (ctx->packed ? WALK_PACKED : 0);
 	int m;
 
-	dragon = (char*)malloc(sizeof(char) * area);
+	dragon = (char *) arena_alloc_zero(ctx->arena, canvas_bytes(area, ctx->packed));
 	if (dragon == NULL)
 		goto err;
 
-	palette = init_palette(nb_colors);
-	if (palette == NULL)
-		goto err;
-
-	// clear dragon
-	init_canvas(0, area, dragon, -1);
-
 	// Draw dragon
+	trace_begin("draw");
+	perf_stage_begin(&ps);
 	for (m = 0; m < nb_colors; m++) {
 		uint64_t start = m * size / nb_colors;
 		uint64_t end = (m + 1) * size / nb_colors;
-		dragon_draw_raw(start, end, dragon, dragon_width, dragon_height, limits, m);
+		dragon_draw_walk(start, end, dragon, dragon_width, dragon_height, limits, m, flags);
 	}
+	perf_stage_end(&ps, PERF_STAGE_DRAW, 0);
+	trace_end("draw");
 
 	// Scale dragon to fit the final image
-	scale_dragon(0, height, image, width, height, dragon, dragon_width, dragon_height, palette);
+	trace_begin("render");
+	perf_stage_begin(&ps);
+	scale_dragon_packed(0, height, image, width, height, dragon, dragon_width, dragon_height, ctx->palette,
+			ctx->packed);
+	perf_stage_end(&ps, PERF_STAGE_RENDER, 0);
+	trace_end("render");
 
 done:
-	free_palette(palette);
 	*canvas = dragon;
 	return ret;
 
 err:
-	FREE(dragon);
+	dragon_ctx_free(ctx, dragon);
+	dragon = NULL;
 	ret = -1;
 	goto done;
 }
 
+static int limits_serial(struct dragon_ctx *ctx, limits_t *limits, uint64_t size)
+{
+	return dragon_limits_serial(limits, size, ctx->nb_thread);
+}
+
+const struct dragon_backend dragon_backend_serial = {
+	.name = "serial",
+	.draw = draw_serial,
+	.limits = limits_serial,
+	.release = NULL,
+};
+
+int dragon_draw_serial(char **canvas, struct rgb *image, int width, int height, uint64_t size, int nb_colors)
+{
+	struct dragon_ctx ctx;
+	int ret;
+
+	*canvas = NULL;
+	if (dragon_ctx_init(&ctx, &dragon_backend_serial, nb_colors, &dragon_arena) < 0)
+		return -1;
+	ret = dragon_ctx_draw(&ctx, canvas, image, width, height, size);
+	dragon_ctx_release(&ctx);
+	return ret;
+}
+
 int write_img(struct rgb *image, char *file, int width, int height)
 {
 	FILE *f = NULL;
@@ -247,10 +517,51 @@ int write_img(struct rgb *image, char *file, int width, int height)
 		}
 	}
 
-	fprintf(f, "P6\n%d %d\n%d\n", width, height, 255);
-	fwrite(image, sizeof(struct rgb), width * height, f);
+	int header = fprintf(f, "P6\n%d %d\n%d\n", width, height, 255);
+	size_t written = fwrite(image, sizeof(struct rgb), width * height, f);
 	fclose(f);
+	progress_add(PROGRESS_BYTES_WRITTEN, header + written * sizeof(struct rgb));
+	return 0;
+}
+
+/*
+ * Write the image in a new POSIX shared memory object, in the same format
+ * as write_img. The reader is responsible for shm_unlink.
+ */
+int write_img_shm(struct rgb *image, const char *name, int width, int height, uint64_t *bytes)
+{
+	char header[64];
+	int header_len;
+	uint64_t len;
+	char *map;
+	int fd;
+
+	if (image == NULL)
+		return -1;
+
+	header_len = snprintf(header, sizeof(header), "P6\n%d %d\n%d\n", width, height, 255);
+	len = header_len + (uint64_t) sizeof(struct rgb) * width * height;
+	if ((fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600)) < 0) {
+		perror("shm_open");
+		return -1;
+	}
+	if (ftruncate(fd, len) < 0)
+		goto err;
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto err;
+	memcpy(map, header, header_len);
+	memcpy(map + header_len, image, len - header_len);
+	munmap(map, len);
+	close(fd);
+	progress_add(PROGRESS_BYTES_WRITTEN, len);
+	*bytes = len;
 	return 0;
+err:
+	perror("write_img_shm");
+	close(fd);
+	shm_unlink(name);
+	return -1;
 }
 
 void dump_limits(limits_t *limits)
@@ -278,11 +589,18 @@ int cmp_limits(limits_t *l1, limits_t *l2)
  * return the number of pixels that doesn't match
  */
 int cmp_canvas(char *exp, char *act, int width, int height, int verbose)
+{
+	return cmp_canvas_packed(exp, 0, act, 0, width, height, verbose);
+}
+
+/* each canvas may be packed or not, see canvas_cell */
+int cmp_canvas_packed(char *exp, int exp_packed, char *act, int act_packed, int width, int height,
+		int verbose)
 {
 	printf("%s() : \n", __FUNCTION__);
 	int i, j;
 	int sum = 0;
-	int index;
+	uint64_t index;
 	if (exp == NULL || act == NULL){
 		printf("%s() : exp = %p, act = %p\n", __FUNCTION__, exp, act);
 		return -1;
@@ -291,11 +609,13 @@ int cmp_canvas(char *exp, char *act, int width, int height, int verbose)
 	#pragma omp parallel for reduction(+:sum) private(index, j)
 	for (i = 0; i < height; i++) {
 		for (j = 0; j < width; j++) {
-			index = i * width + j;
-			if (exp[index] != act[index]) {
+			index = (uint64_t) i * width + j;
+			int e = canvas_cell(exp, index, exp_packed);
+			int a = canvas_cell(act, index, act_packed);
+			if (e != a) {
 				printf("Error at position (i,j) = (%d, %d)\n",i,j);
 				if (verbose)
-					printf("pix error (%5d, %5d) expected=%2d actual=%2d\n", j, i, exp[index], act[index]);
+					printf("pix error (%5d, %5d) expected=%2d actual=%2d\n", j, i, e - 1, a - 1);
 				sum += 1;
 			}
 		}
@@ -319,13 +639,109 @@ void piece_init(piece_t *piece)
 int dragon_limits_serial(limits_t *lim, uint64_t nbIterations, __attribute__((unused)) int nb_thread)
 {
 	piece_t piece;
+	struct perf_sample ps;
 	piece_init(&piece);
 	uint64_t start = 0;
+	trace_begin("limits");
+	perf_stage_begin(&ps);
 	piece_limit(start, nbIterations, &piece);
+	perf_stage_end(&ps, PERF_STAGE_LIMITS, 0);
+	trace_end("limits");
 	*lim = piece.limits;
 	return 0;
 }
 
+/*
+ * Seeds of the walks. The piece of each chunk is walked once, from
+ * piece_init, by a parallel reduce or the up-sweep of a parallel scan.
+ * Their exclusive prefix, composed with piece_merge, is the state at the
+ * start of each chunk, and the whole sum holds the limits of the dragon.
+ */
+int seeds_init(struct dragon_seeds *seeds, uint64_t size, int nb_chunk)
+{
+	seeds->size = size;
+	seeds->nb_chunk = nb_chunk;
+	seeds->pieces = malloc(sizeof(piece_t) * nb_chunk);
+	seeds->walked = calloc(nb_chunk, sizeof(char));
+	seeds->walks = malloc(sizeof(struct dragon_walk) * nb_chunk);
+	if (seeds->pieces == NULL || seeds->walked == NULL || seeds->walks == NULL) {
+		seeds_free(seeds);
+		return -1;
+	}
+	return 0;
+}
+
+void seeds_free(struct dragon_seeds *seeds)
+{
+	FREE(seeds->pieces);
+	FREE(seeds->walked);
+	FREE(seeds->walks);
+}
+
+/* segments ]start, end] of a chunk */
+void seeds_chunk(struct dragon_seeds *seeds, int chunk, uint64_t *start, uint64_t *end)
+{
+	*start = chunk * seeds->size / seeds->nb_chunk;
+	*end = (chunk + 1) * seeds->size / seeds->nb_chunk;
+}
+
+/* walk the piece of a chunk, once */
+void seeds_piece(struct dragon_seeds *seeds, int chunk)
+{
+	uint64_t start, end;
+
+	if (seeds->walked[chunk])
+		return;
+	seeds_chunk(seeds, chunk, &start, &end);
+	piece_init(&seeds->pieces[chunk]);
+	piece_limit(start, end, &seeds->pieces[chunk]);
+	seeds->walked[chunk] = 1;
+}
+
+/* prefix is the merge of the pieces of the chunks before this one */
+void seeds_set(struct dragon_seeds *seeds, int chunk, piece_t *prefix)
+{
+	seeds->walks[chunk].position = prefix->position;
+	seeds->walks[chunk].orientation = prefix->orientation;
+}
+
+/* exclusive scan of the walked pieces, the limits are the ones of the sum */
+void seeds_scan(struct dragon_seeds *seeds, limits_t *limits)
+{
+	piece_t sum;
+	int c;
+
+	piece_init(&sum);
+	for (c = 0; c < seeds->nb_chunk; c++) {
+		seeds_set(seeds, c, &sum);
+		piece_merge(&sum, seeds->pieces[c]);
+	}
+	*limits = sum.limits;
+}
+
+/*
+ * State of the walk at start, relative to the limits: in O(1) from the seed
+ * when start begins a chunk, with dragon_walk_init otherwise.
+ */
+void seeds_walk(struct dragon_seeds *seeds, uint64_t start, limits_t limits, struct dragon_walk *walk)
+{
+	uint64_t chunk;
+
+	if (seeds == NULL || seeds->size == 0) {
+		dragon_walk_init(walk, start, limits);
+		return;
+	}
+	/* the first chunk starting at or after start */
+	chunk = (start * seeds->nb_chunk + seeds->size - 1) / seeds->size;
+	if (chunk >= (uint64_t) seeds->nb_chunk || chunk * seeds->size / seeds->nb_chunk != start) {
+		dragon_walk_init(walk, start, limits);
+		return;
+	}
+	*walk = seeds->walks[chunk];
+	walk->position.x -= limits.minimums.x;
+	walk->position.y -= limits.minimums.y;
+}
+
 struct rgb *make_canvas(int width, int height)
 {
 	int area;
@@ -333,30 +749,9 @@ struct rgb *make_canvas(int width, int height)
 	if (area <= 0) {
 		return NULL;
 	}
-	return (struct rgb *) malloc(sizeof(struct rgb) * area);
-}
-
-void piece_limit(int64_t start, int64_t end, piece_t *m)
-{
-	int64_t n;
-	xy_t *position = &m->position; // &(m->position)
-	xy_t *orientation = &m->orientation;
-	xy_t *minimums = &m->limits.minimums;
-	xy_t *maximums = &m->limits.maximums;
-	for (n = start + 1; n <= end; n++) {
-		position->x += orientation->x;
-		position->y += orientation->y;
-
-		if (((n & -n) << 1) & n)
-			rotate_left(orientation);
-		else
-			rotate_right(orientation);
-		if (minimums->x > position->x) minimums->x = position->x;
-		if (minimums->y > position->y) minimums->y = position->y;
-		if (maximums->x < position->x) maximums->x = position->x;
-		if (maximums->y < position->y) maximums->y = position->y;
-	}
+	return (struct rgb *) arena_alloc(&dragon_arena, sizeof(struct rgb) * area);
 }
+
 /*
  * merge m2 into m1
  * This operation is associative, but not commutative
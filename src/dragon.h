@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <inttypes.h>
 #include "color.h"
+#include "arena.h"
 
 /**
  * TODO:
@@ -46,10 +47,104 @@ typedef struct morceau_ {
 	limits_t	limits;
 } piece_t;
 
+/*
+ * Segments traced by one tracer, sorted by the canvas tile they fall in.
+ * Only the canvas index is kept, the id is the color of the tracer. The
+ * bins are carved from slabs of the tracer: only a new slab takes the lock
+ * of the arena.
+ */
+struct bins_slab {
+	struct bins_slab *next;
+	uint64_t used;
+	uint64_t capacity;
+};
+
+struct dragon_bins {
+	uint32_t **index;
+	uint64_t *len;
+	uint64_t *cap;
+	int nb_tile;
+	struct bins_slab *slabs;	/* the current one first */
+};
+
+/* state of the walk between two calls of dragon_bin_raw */
+struct dragon_walk {
+	xy_t position;
+	xy_t orientation;
+};
+
+/*
+ * Exclusive scan of the pieces of nb_chunk chunks of ]0, size], chunk c
+ * starting at segment c * size / nb_chunk: the walk of a chunk starts from
+ * its seed in O(1) instead of compute_position and compute_orientation.
+ */
+struct dragon_seeds {
+	uint64_t size;
+	int nb_chunk;
+	piece_t *pieces;		/* piece of each chunk, walked from piece_init */
+	char *walked;			/* the piece of the chunk is walked */
+	struct dragon_walk *walks;	/* absolute state at the start of each chunk */
+};
+
+/* segments traced by each thread before the tiles are drawn */
+#define BIN_PASS (1 << 20)
+
+/*
+ * Bounds policy of the walk kernels. Without flag, the limits must cover
+ * the whole range, which is the case when they were computed for [0, size].
+ */
+#define WALK_CHECK	1	/* stop with an error on a segment out of the canvas */
+#define WALK_CLIP	2	/* skip the segments out of the canvas */
+#define WALK_PACKED	4	/* packed canvas, the cells are or'ed in */
+#define WALK_SHARED	8	/* other threads write the packed canvas, the or is atomic */
+
+#ifdef DEBUG
+#define DRAW_FLAGS WALK_CHECK
+#else
+#define DRAW_FLAGS 0
+#endif
+
+/*
+ * Packed canvas: two cells per byte, the even cell in the low nibble. It
+ * holds at most PACKED_COLORS ids.
+ */
+#define PACKED_COLORS	15
+
+static inline uint64_t canvas_bytes(uint64_t area, int packed)
+{
+	return packed ? (area + 1) / 2 : area;
+}
+
+static inline int canvas_cell(const char *canvas, uint64_t index, int packed)
+{
+	if (!packed)
+		return canvas[index];
+	return ((unsigned char) canvas[index >> 1] >> ((index & 1) << 2)) & 0xf;
+}
+
+/*
+ * Image rendered without a canvas: the sums of the colors of the segments
+ * falling in each pixel, and their count, in the layout of scale_dragon.
+ */
+struct dragon_accum {
+	uint64_t *sums;		/* r, g, b, count per pixel */
+	int image_width;
+	int image_height;
+	int dragon_width;
+	int dragon_height;
+	int scale;
+	int deltaI;
+	int deltaJ;
+};
+
+struct progress_job;
+struct dragon_dataflow;
+
 struct draw_data {
 	int id;
 	int *tid;
 	int nb_thread;
+	int nb_color;			/* ranges of segments, one color each */
 	int dragon_width;
 	int dragon_height;
 	int image_width;
@@ -63,6 +158,15 @@ struct draw_data {
 	uint64_t size;
 	limits_t limits;
 	pthread_barrier_t *barrier;
+	struct dragon_bins *bins;	/* one set per color, of one tile per thread */
+	struct dragon_walk *walks;	/* walk of each color between the passes */
+	uint64_t tile_bytes;		/* cells per tile */
+	uint64_t nb_pass;
+	int packed;
+	struct progress_job *job;	/* render of the tasks, see progress_chunk */
+	struct dragon_dataflow *dataflow;	/* bands rendered as their ranges are drawn */
+	struct dragon_seeds *seeds;	/* start of the walks, NULL to compute them */
+	int ret;
 //};
 } __attribute__((aligned(128)));
 
@@ -74,6 +178,15 @@ struct limit_data {
 //};
 } __attribute__((aligned(128)));
 
+/* chunks [first, last) of the seeds walked by one thread */
+struct scan_data {
+	int id;
+	int first;
+	int last;
+	struct dragon_seeds *seeds;
+//};
+} __attribute__((aligned(128)));
+
 int dragon_limits_serial(limits_t *limits, uint64_t nbIterations, int nb_thread);
 void dump_limits(limits_t *limits);
 int cmp_limits(limits_t *l1, limits_t *l2);
@@ -89,11 +202,47 @@ int dragon_draw_serial(char **dragon, struct rgb *image, int width, int height,
 void dump_canvas(char *canvas, int width, int height);
 void dump_canvas_rgb(struct rgb *canvas, int width, int height);
 int write_img(struct rgb *image, char *file, int width, int height);
+int write_img_shm(struct rgb *image, const char *name, int width, int height, uint64_t *bytes);
 struct rgb *make_canvas(int width, int height);
 int cmp_canvas(char *exp, char *act, int width, int height, int verbose);
+int cmp_canvas_packed(char *exp, int exp_packed, char *act, int act_packed, int width, int height,
+        int verbose);
 void init_canvas(int start, int end, char *canvas, char value);
 void scale_dragon(int start, int end, struct rgb *image, int image_width, int image_height,
         char *dragon, int dragon_width, int dragon_height, struct palette *palette);
+void scale_dragon_packed(int start, int end, struct rgb *image, int image_width, int image_height,
+        char *dragon, int dragon_width, int dragon_height, struct palette *palette, int packed);
+void scale_dragon_band(int start, int end, struct rgb *image, int image_width, int image_height,
+        char *band, int first_row, int dragon_width, int dragon_height, struct palette *palette);
+/* canvas cells hold id + 1, 0 is an empty cell */
 int dragon_draw_raw(uint64_t start, uint64_t end, char *dragon, int width, int height, limits_t limits, char id);
+int dragon_draw_walk(uint64_t start, uint64_t end, char *dragon, int width, int height, limits_t limits,
+        char id, int flags);
+char *make_dragon(uint64_t area);
+uint64_t dragon_tile_bytes(uint64_t area, int nb_tile);
+uint64_t dragon_tile_cells(uint64_t area, int nb_tile, int packed);
+int bins_init(struct dragon_bins *bins, int nb_tile);
+void bins_reset(struct dragon_bins *bins);
+void bins_free(struct dragon_bins *bins);
+int bins_grow(struct dragon_bins *bins, int tile);
+void dragon_walk_init(struct dragon_walk *walk, uint64_t start, limits_t limits);
+int dragon_draw_from(uint64_t start, uint64_t end, struct dragon_walk *walk, char *dragon, int width,
+        int height, char id, int flags);
+int seeds_init(struct dragon_seeds *seeds, uint64_t size, int nb_chunk);
+void seeds_free(struct dragon_seeds *seeds);
+void seeds_chunk(struct dragon_seeds *seeds, int chunk, uint64_t *start, uint64_t *end);
+void seeds_piece(struct dragon_seeds *seeds, int chunk);
+void seeds_set(struct dragon_seeds *seeds, int chunk, piece_t *prefix);
+void seeds_scan(struct dragon_seeds *seeds, limits_t *limits);
+void seeds_walk(struct dragon_seeds *seeds, uint64_t start, limits_t limits, struct dragon_walk *walk);
+int dragon_bin_raw(uint64_t start, uint64_t end, struct dragon_walk *walk, struct dragon_bins *bins,
+        int width, int height, uint64_t tile_bytes);
+void dragon_drain_bins(struct dragon_bins *bins, int nb_bins, int tile, char *dragon, int packed);
+int accum_init(struct dragon_accum *acc, int image_width, int image_height, int dragon_width, int dragon_height);
+void accum_free(struct dragon_accum *acc);
+int dragon_accum_raw(uint64_t start, uint64_t end, struct dragon_accum *acc, limits_t limits,
+        struct rgb color, int flags);
+int64_t accum_cells(struct dragon_accum *acc, int x, int y);
+void accum_render(struct dragon_accum *acc, int start, int end, struct rgb *image);
 
 #endif /* DRAGON_H_ */
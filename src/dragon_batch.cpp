@@ -0,0 +1,84 @@
+/*
+ * dragon_batch.cpp
+ *
+ *  Created on: 2026-10-19
+ *
+ * Batch of jobs on one TBB pool. Every job is one task of an outer
+ * parallel_for, the largest jobs first so that the small ones fill the
+ * gaps at the end. A job of the tbb lib splits itself with nested
+ * parallel_for in the same arena (see draw_tbb): idle threads steal its
+ * ranges, so a batch of large jobs still uses every core and a batch of
+ * small jobs runs one job per core without any splitting overhead.
+ */
+
+#include <algorithm>
+#include <vector>
+
+extern "C" {
+#include "dragon.h"
+#include "job.h"
+}
+#include "dragon_batch.h"
+#include "tbb/tbb.h"
+
+using namespace std;
+using namespace tbb;
+
+class DragonBatch {
+	struct dragon_job *_jobs;
+	struct job_result *_results;
+	int *_status;
+	const int *_order;
+	job_runner _run;
+
+public:
+	DragonBatch(struct dragon_job *jobs, struct job_result *results, int *status,
+			const int *order, job_runner run)
+	:_jobs(jobs), _results(results), _status(status), _order(order), _run(run)
+	{
+	}
+
+	void operator()(const blocked_range<int>& r) const
+	{
+		for (int i = r.begin(); i != r.end(); ++i) {
+			int j = _order[i];
+			tick_count start = tick_count::now();
+			_status[j] = _run(&_jobs[j], &_results[j]);
+			_results[j].ms = (tick_count::now() - start).seconds() * 1e3;
+		}
+	}
+};
+
+/* weight of a job, the draws cost their segments and their pixels */
+static uint64_t job_weight(struct dragon_job *job)
+{
+	if (job->cmd == JOB_CMD_LIMITS)
+		return job->size;
+	return 2 * job->size + (uint64_t) job->width * job->height;
+}
+
+int dragon_batch_tbb(struct dragon_job *jobs, struct job_result *results, int *status,
+		int nb_jobs, int nb_thread, job_runner run)
+{
+	vector<int> order(nb_jobs);
+	int failed = 0;
+
+	for (int i = 0; i < nb_jobs; i++)
+		order[i] = i;
+	stable_sort(order.begin(), order.end(), [jobs](int a, int b) {
+		return job_weight(&jobs[a]) > job_weight(&jobs[b]);
+	});
+
+	task_arena arena(nb_thread);
+	arena.execute([&] {
+		parallel_for(blocked_range<int>(0, nb_jobs, 1),
+				DragonBatch(jobs, results, status, order.data(), run),
+				simple_partitioner());
+	});
+
+	for (int i = 0; i < nb_jobs; i++) {
+		if (status[i] < 0)
+			failed++;
+	}
+	return failed > 0 ? -1 : 0;
+}
@@ -0,0 +1,23 @@
+/*
+ * dragon_batch.h
+ *
+ *  Created on: 2026-10-19
+ *
+ * Many jobs scheduled on one TBB pool
+ */
+
+#ifndef DRAGON_BATCH_H_
+#define DRAGON_BATCH_H_
+
+#include "job.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+int dragon_batch_tbb(struct dragon_job *jobs, struct job_result *results, int *status,
+        int nb_jobs, int nb_thread, job_runner run);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DRAGON_BATCH_H_ */
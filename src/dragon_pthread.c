@@ -8,101 +8,298 @@
 #define _GNU_SOURCE
 #include <stdlib.h>
 #include <pthread.h>
-#include <stdarg.h>
 #include <string.h>
 
 #include "dragon.h"
 #include "color.h"
 #include "dragon_pthread.h"
+#include "context.h"
+#include "dataflow.h"
+#include "perf.h"
+#include "trace.h"
 
-pthread_mutex_t mutex_stdout;
+/*
+ * Workers of a context, started by its first render: a job runs the same
+ * function on every worker, with its own slot of data.
+ */
+struct pthread_pool {
+	struct dragon_ctx *ctx;
+	pthread_t *threads;
+	struct pool_slot *slots;
+	int nb_thread;
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	uint64_t generation;
+	int running;
+	int stop;
+	void *(*worker)(void *);
+	char *data;
+	size_t stride;
+};
+
+struct pool_slot {
+	struct pthread_pool *pool;
+	int id;
+};
+
+static void *pool_main(void *arg)
+{
+	struct pool_slot *slot = (struct pool_slot *) arg;
+	struct pthread_pool *pool = slot->pool;
+	uint64_t seen = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (pool->generation == seen && !pool->stop)
+			pthread_cond_wait(&pool->start, &pool->lock);
+		if (pool->stop)
+			break;
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		progress_job = pool->ctx->job;
+		pool->worker(pool->data + slot->id * pool->stride);
+		progress_job = NULL;
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->running == 0)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	/* the counters of a worker stay open from one job to the next */
+	perf_thread_exit();
+	return NULL;
+}
 
-void printf_threadsafe(char *format, ...)
+static void pool_release(struct dragon_ctx *ctx)
 {
-	va_list ap;
+	struct pthread_pool *pool = (struct pthread_pool *) ctx->pool;
+	int i;
+
+	if (pool == NULL)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+	for (i = 0; i < pool->nb_thread; i++)
+		pthread_join(pool->threads[i], NULL);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->start);
+	pthread_cond_destroy(&pool->done);
+	FREE(pool->threads);
+	FREE(pool->slots);
+	free(pool);
+	ctx->pool = NULL;
+}
 
-	va_start(ap, format);
-	pthread_mutex_lock(&mutex_stdout);
-	vprintf(format, ap);
-	pthread_mutex_unlock(&mutex_stdout);
-	va_end(ap);
+static struct pthread_pool *pool_get(struct dragon_ctx *ctx)
+{
+	struct pthread_pool *pool = (struct pthread_pool *) ctx->pool;
+	int i;
+
+	if (pool != NULL)
+		return pool;
+	if ((pool = calloc(1, sizeof(struct pthread_pool))) == NULL)
+		return NULL;
+	pool->threads = malloc(sizeof(pthread_t) * ctx->nb_thread);
+	pool->slots = malloc(sizeof(struct pool_slot) * ctx->nb_thread);
+	if (pool->threads == NULL || pool->slots == NULL) {
+		FREE(pool->threads);
+		FREE(pool->slots);
+		free(pool);
+		return NULL;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	pool->ctx = ctx;
+	ctx->pool = pool;
+	for (i = 0; i < ctx->nb_thread; i++) {
+		pool->slots[i].pool = pool;
+		pool->slots[i].id = i;
+		if (pthread_create(&pool->threads[i], NULL, pool_main, &pool->slots[i]) != 0) {
+			dragon_ctx_printf(ctx, "%s(): pthread_create error\n", __FUNCTION__);
+			break;
+		}
+		pool->nb_thread++;
+	}
+	if (pool->nb_thread != ctx->nb_thread) {
+		pool_release(ctx);
+		return NULL;
+	}
+	return pool;
+}
+
+/* worker(data + i * stride) on each worker i, returns when all are done */
+static void pool_run(struct pthread_pool *pool, void *(*worker)(void *), void *data, size_t stride)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->worker = worker;
+	pool->data = (char *) data;
+	pool->stride = stride;
+	pool->running = pool->nb_thread;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+	while (pool->running > 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
 }
 
 void *dragon_draw_worker(void *data)
 {
 	struct draw_data *wd = (struct draw_data*) data;
+	int nb_range = wd->dataflow->nb_range;
+	int r;
+
+	trace_begin("dragon_draw_worker");
+
+	/*
+	 * 1-2. Dessiner sa part des intervalles, la surface provient de
+	 * pages à zéro. Chaque bande d'image est rendue par le thread qui
+	 * termine le dernier intervalle la touchant, sans barrière.
+	 */
+	for (r = wd->id * nb_range / wd->nb_thread; r < (wd->id + 1) * nb_range / wd->nb_thread; r++) {
+		if (dataflow_range(wd->dataflow, wd, r, wd->id) < 0)
+			wd->ret = -1;
+	}
 
-	/* 1. Initialiser la surface */
-	uint64_t area = wd->dragon_width * wd->dragon_height;
-	uint64_t start = (area / wd->nb_thread) * wd->id;
-	uint64_t end = (area / wd->nb_thread) * (wd->id + 1);	
-	init_canvas(start, end, wd->dragon, -1);
-	pthread_barrier_wait(wd->barrier);
-
-
-	/* 2. Dessiner le dragon */
-	// dragon_draw_raw(uint64_t start, uint64_t end, char *dragon, int width, int height, limits_t limits, char id)
-
-
-	// Draw dragon
-	start = (wd->size / wd->nb_thread) * wd->id;
-	end = (wd->size / wd->nb_thread) * (wd->id + 1);	
-	dragon_draw_raw(start, end, wd->dragon, wd->dragon_width, wd->dragon_height, wd->limits, wd->id);
-	pthread_barrier_wait(wd->barrier);
+	trace_end("dragon_draw_worker");
+	return NULL;
+}
 
+void *dragon_draw_binned_worker(void *data)
+{
+	struct draw_data *wd = (struct draw_data*) data;
+	int first = wd->id * wd->nb_color / wd->nb_thread;
+	int last = (wd->id + 1) * wd->nb_color / wd->nb_thread;
+	struct perf_sample ps;
+	uint64_t start, end;
+	uint64_t pass;
+	int c;
+
+	trace_begin("dragon_draw_binned_worker");
+
+	/*
+	 * 1. Dessiner le dragon, par passes: tracer BIN_PASS segments de
+	 * chacune de ses couleurs dans les tuiles, puis chaque thread écrit
+	 * les segments de sa tuile
+	 */
+	for (pass = 0; pass < wd->nb_pass; pass++) {
+		perf_stage_begin(&ps);
+		for (c = first; c < last; c++) {
+			start = c * wd->size / wd->nb_color;
+			end = (c + 1) * wd->size / wd->nb_color;
+			uint64_t pass_start = start + pass * BIN_PASS;
+			uint64_t pass_end = pass_start + BIN_PASS;
+			if (pass_start > end)
+				pass_start = end;
+			if (pass_end > end)
+				pass_end = end;
+
+			trace_begin_range("bin", pass_start, pass_end);
+			if (wd->ret == 0 && dragon_bin_raw(pass_start, pass_end, &wd->walks[c], &wd->bins[c],
+					wd->dragon_width, wd->dragon_height, wd->tile_bytes) < 0)
+				wd->ret = -1;
+			trace_end("bin");
+		}
+		perf_stage_end(&ps, PERF_STAGE_DRAW, wd->id);
+		trace_begin("barrier");
+		pthread_barrier_wait(wd->barrier);
+		trace_end("barrier");
+
+		trace_begin("drain");
+		perf_stage_begin(&ps);
+		dragon_drain_bins(wd->bins, wd->nb_color, wd->id, wd->dragon, wd->packed);
+		perf_stage_end(&ps, PERF_STAGE_DRAW, wd->id);
+		trace_end("drain");
+		trace_begin("barrier");
+		pthread_barrier_wait(wd->barrier);
+		trace_end("barrier");
+		for (c = first; c < last; c++)
+			bins_reset(&wd->bins[c]);
+	}
 
-	/* 3. Effectuer le rendu final */
-	// Scale dragon to fit the final image
-	start = (wd->image_height / wd->nb_thread) * wd->id;
-	end = (wd->image_height / wd->nb_thread) * (wd->id + 1);	
-	scale_dragon(start, end, wd->image, wd->image_width, wd->image_height, wd->dragon, wd->dragon_width, wd->dragon_height, wd->palette);
+	/* 2. Effectuer le rendu final */
+	start = (uint64_t) wd->image_height * wd->id / wd->nb_thread;
+	end = (uint64_t) wd->image_height * (wd->id + 1) / wd->nb_thread;
+	trace_begin_range("render", start, end);
+	perf_stage_begin(&ps);
+	scale_dragon_packed(start, end, wd->image, wd->image_width, wd->image_height, wd->dragon, wd->dragon_width, wd->dragon_height, wd->palette, wd->packed);
+	perf_stage_end(&ps, PERF_STAGE_RENDER, wd->id);
+	trace_end("render");
 
+	trace_end("dragon_draw_binned_worker");
 	return NULL;
 }
 
-int dragon_draw_pthread(char **canvas, struct rgb *image, int width, int height, uint64_t size, int nb_thread)
-{
+static int limits_pthread(struct dragon_ctx *ctx, limits_t *limits, uint64_t size);
+static int scan_pthread(struct dragon_ctx *ctx, limits_t *limits, struct dragon_seeds *seeds);
 
-	pthread_t *threads = NULL;
+static int draw_pthread(struct dragon_ctx *ctx, char **canvas, struct rgb *image, int width, int height,
+		uint64_t size, int binned)
+{
+	struct pthread_pool *pool;
 	pthread_barrier_t barrier;
 	limits_t lim;
 	struct draw_data info;
 	char *dragon = NULL;
+	int nb_thread = ctx->nb_thread;
+	int nb_color = ctx->nb_color;
 	int scale_x;
 	int scale_y;
 	struct draw_data *data = NULL;
-	struct palette *palette = NULL;
+	struct dragon_bins *bins = NULL;
+	struct dragon_walk *walks = NULL;
+	struct dragon_dataflow df;
+	struct dragon_seeds seeds;
 	int ret = 0;
 
-	palette = init_palette(nb_thread);
-	if (palette == NULL)
+	memset(&df, 0, sizeof(df));
+	memset(&seeds, 0, sizeof(seeds));
+	if ((pool = pool_get(ctx)) == NULL)
 		goto err;
 
-	/* 1. Initialiser barrier. */
-	pthread_barrier_init(&barrier, NULL, nb_thread);
-
-
-	if (dragon_limits_pthread(&lim, size, nb_thread) < 0)
+	/* les limites et le départ de chaque intervalle en une passe */
+	if (seeds_init(&seeds, size, nb_color * DATAFLOW_RANGES) < 0)
+		goto err;
+	if (scan_pthread(ctx, &lim, &seeds) < 0)
 		goto err;
 
 	info.dragon_width = lim.maximums.x - lim.minimums.x;
 	info.dragon_height = lim.maximums.y - lim.minimums.y;
 
-	if ((dragon = (char *) malloc(info.dragon_width * info.dragon_height)) == NULL) {
-		printf("malloc error dragon\n");
+	if ((dragon = arena_alloc_zero(ctx->arena, canvas_bytes((uint64_t) info.dragon_width * info.dragon_height,
+			ctx->packed))) == NULL) {
+		dragon_ctx_printf(ctx, "malloc error dragon\n");
 		goto err;
 	}
 
-	if ((data = malloc(sizeof(struct draw_data) * nb_thread)) == NULL) {
-		printf("malloc error data\n");
-		goto err;
+	if (binned) {
+		bins = calloc(nb_color, sizeof(struct dragon_bins));
+		walks = malloc(sizeof(struct dragon_walk) * nb_color);
+		if (bins == NULL || walks == NULL) {
+			dragon_ctx_printf(ctx, "malloc error bins\n");
+			goto err;
+		}
+		for (unsigned int i = 0; i < nb_color; ++i) {
+			if (bins_init(&bins[i], nb_thread) < 0) {
+				dragon_ctx_printf(ctx, "malloc error bins\n");
+				goto err;
+			}
+			seeds_walk(&seeds, i * size / nb_color, lim, &walks[i]);
+		}
 	}
 
-	if ((threads = malloc(sizeof(pthread_t) * nb_thread)) == NULL) {
-		printf("malloc error threads\n");
+	if ((data = malloc(sizeof(struct draw_data) * nb_thread)) == NULL) {
+		dragon_ctx_printf(ctx, "malloc error data\n");
 		goto err;
 	}
 
+	/* 1. Initialiser barrier. */
+	pthread_barrier_init(&barrier, NULL, nb_thread);
+
 	info.image_height = height;
 	info.image_width = width;
 	scale_x = info.dragon_width / width + 1;
@@ -111,102 +308,222 @@ int dragon_draw_pthread(char **canvas, struct rgb *image, int width, int height,
 	info.deltaJ = (info.scale * width - info.dragon_width) / 2;
 	info.deltaI = (info.scale * height - info.dragon_height) / 2;
 	info.nb_thread = nb_thread;
+	info.nb_color = nb_color;
 	info.dragon = dragon;
 	info.image = image;
 	info.size = size;
 	info.limits = lim;
 	info.barrier = &barrier;
-	info.palette = palette;
-	info.dragon = dragon;
-	info.image = image;
+	info.palette = ctx->palette;
+	info.bins = bins;
+	info.walks = walks;
+	info.tile_bytes = dragon_tile_cells((uint64_t) info.dragon_width * info.dragon_height, nb_thread,
+			ctx->packed);
+	info.packed = ctx->packed;
+	info.nb_pass = ((size + nb_color - 1) / nb_color + BIN_PASS - 1) / BIN_PASS;
+	info.job = ctx->job;
+	info.dataflow = binned ? NULL : &df;
+	info.seeds = &seeds;
+	info.ret = 0;
+
+	if (!binned && dataflow_init(&df, &info) < 0) {
+		dragon_ctx_printf(ctx, "malloc error dataflow\n");
+		pthread_barrier_destroy(&barrier);
+		goto err;
+	}
 
-	/* 2. Lancement du calcul parallèle principal avec draw_dragon_worker */
+	/* 2. Lancement du calcul parallèle principal sur les workers du contexte */
 	for (unsigned int i = 0; i < nb_thread; ++i)
 	{
 		 data[i] = info;
 		 data[i].id = i;
-		 pthread_create(&threads[i],NULL, dragon_draw_worker, &data[i]);
 	}
 	/* 3. Attendre la fin du traitement. */
+	pool_run(pool, binned ? dragon_draw_binned_worker : dragon_draw_worker, data, sizeof(struct draw_data));
 	for (unsigned int i = 0; i < nb_thread; ++i)
 	{
-		pthread_join(threads[i], NULL);
+		if (data[i].ret < 0)
+			ret = -1;
 	}
 
-	/* 4. Destruction des variables (à compléter). */ 
+	/* 4. Destruction des variables. */
 	pthread_barrier_destroy(&barrier);
+	if (ret < 0)
+		goto err;
 done:
+	if (bins != NULL) {
+		for (unsigned int i = 0; i < nb_color; ++i)
+			bins_free(&bins[i]);
+	}
+	FREE(bins);
+	FREE(walks);
 	FREE(data);
-	FREE(threads);
+	dataflow_free(&df);
+	seeds_free(&seeds);
 
-	free_palette(palette);
 	*canvas = dragon;
 	return ret;
 
 err:
-	FREE(dragon);
+	dragon_ctx_free(ctx, dragon);
+	dragon = NULL;
 	ret = -1;
 	goto done;
 }
 
+static int draw_pthread_plain(struct dragon_ctx *ctx, char **canvas, struct rgb *image, int width, int height,
+		uint64_t size)
+{
+	return draw_pthread(ctx, canvas, image, width, height, size, 0);
+}
+
+static int draw_pthread_binned(struct dragon_ctx *ctx, char **canvas, struct rgb *image, int width, int height,
+		uint64_t size)
+{
+	return draw_pthread(ctx, canvas, image, width, height, size, 1);
+}
+
+const struct dragon_backend dragon_backend_pthread = {
+	.name = "pthread",
+	.draw = draw_pthread_plain,
+	.limits = limits_pthread,
+	.release = pool_release,
+};
+
+const struct dragon_backend dragon_backend_pthread_binned = {
+	.name = "pthread-binned",
+	.draw = draw_pthread_binned,
+	.limits = limits_pthread,
+	.release = pool_release,
+};
+
+static int draw_once(const struct dragon_backend *backend, char **canvas, struct rgb *image,
+		int width, int height, uint64_t size, int nb_thread)
+{
+	struct dragon_ctx ctx;
+	int ret;
+
+	*canvas = NULL;
+	if (dragon_ctx_init(&ctx, backend, nb_thread, &dragon_arena) < 0)
+		return -1;
+	ret = dragon_ctx_draw(&ctx, canvas, image, width, height, size);
+	dragon_ctx_release(&ctx);
+	return ret;
+}
+
+int dragon_draw_pthread(char **canvas, struct rgb *image, int width, int height, uint64_t size, int nb_thread)
+{
+	return draw_once(&dragon_backend_pthread, canvas, image, width, height, size, nb_thread);
+}
+
+int dragon_draw_pthread_binned(char **canvas, struct rgb *image, int width, int height, uint64_t size, int nb_thread)
+{
+	return draw_once(&dragon_backend_pthread_binned, canvas, image, width, height, size, nb_thread);
+}
+
 void *dragon_limit_worker(void *data)
 {
 	struct limit_data *args = (struct limit_data *) data;
+	struct perf_sample ps;
+	trace_begin_range("limits", args->start, args->end);
+	perf_stage_begin(&ps);
 	piece_limit(args->start, args->end, &args->piece);
+	perf_stage_end(&ps, PERF_STAGE_LIMITS, args->id);
+	trace_end("limits");
+	return NULL;
+}
+
+void *dragon_scan_worker(void *data)
+{
+	struct scan_data *args = (struct scan_data *) data;
+	struct perf_sample ps;
+	int c;
+
+	trace_begin_range("scan", args->first, args->last);
+	perf_stage_begin(&ps);
+	for (c = args->first; c < args->last; c++)
+		seeds_piece(args->seeds, c);
+	perf_stage_end(&ps, PERF_STAGE_LIMITS, args->id);
+	trace_end("scan");
 	return NULL;
 }
 
+/*
+ * Limites et départ de chaque morceau en une passe : chaque thread marche
+ * les morceaux de ses intervalles, puis le préfixe exclusif des morceaux
+ * est composé avec piece_merge, une fusion par morceau.
+ */
+static int scan_pthread(struct dragon_ctx *ctx, limits_t *limits, struct dragon_seeds *seeds)
+{
+	struct pthread_pool *pool;
+	struct scan_data *thread_data = NULL;
+	int nb_thread = ctx->nb_thread;
+	int ret = 0;
+
+	if ((pool = pool_get(ctx)) == NULL)
+		goto err;
+	if ((thread_data = malloc(sizeof(struct scan_data) * nb_thread)) == NULL)
+		goto err;
+	for (int i = 0; i < nb_thread; ++i) {
+		thread_data[i].id = i;
+		thread_data[i].first = i * seeds->nb_chunk / nb_thread;
+		thread_data[i].last = (i + 1) * seeds->nb_chunk / nb_thread;
+		thread_data[i].seeds = seeds;
+	}
+	pool_run(pool, dragon_scan_worker, thread_data, sizeof(struct scan_data));
+	seeds_scan(seeds, limits);
+
+done:
+	FREE(thread_data);
+	return ret;
+err:
+	ret = -1;
+	goto done;
+}
+
 /*
  * Calcule les limites en terme de largeur et de hauteur de
  * la forme du dragon. Requis pour allouer la matrice de dessin.
  */
-int dragon_limits_pthread(limits_t *limits, uint64_t size, int nb_thread)
+static int limits_pthread(struct dragon_ctx *ctx, limits_t *limits, uint64_t size)
 {
-
-	int ret = 0;
-	pthread_t *threads = NULL;
+	struct pthread_pool *pool;
 	struct limit_data *thread_data = NULL;
+	int nb_thread = ctx->nb_thread;
+	int ret = 0;
 	piece_t master;
 
 	piece_init(&master);
 
-	/* 1. ALlouer de l'espace pour threads et threads_data. */
-	threads = malloc(sizeof(pthread_t)*nb_thread);
-	thread_data = malloc(sizeof(struct limit_data)*nb_thread);
+	/* 1. Allouer de l'espace pour threads_data. */
+	if ((pool = pool_get(ctx)) == NULL)
+		goto err;
+	if ((thread_data = malloc(sizeof(struct limit_data) * nb_thread)) == NULL)
+		goto err;
 	/* 2. Lancement du calcul en parallèle avec dragon_limit_worker. */
-	unsigned int piece_size = size/nb_thread;
+	uint64_t piece_size = size / nb_thread;
 	for (unsigned int i = 0; i < nb_thread; ++i)
 	{
 		 thread_data[i].piece = master;
 		 thread_data[i].id = i;
-		 thread_data[i].start = i*piece_size;
-		 if (i != nb_thread-1)
+		 thread_data[i].start = i * piece_size;
+		 if (i != nb_thread - 1)
 		 {
-		 	thread_data[i].end = (i+1)*piece_size;
+		 	thread_data[i].end = (i + 1) * piece_size;
 		 }
 		 else
 		 {
 		 	thread_data[i].end = size;
-		 }	
-		 if(pthread_create(&threads[i],NULL, dragon_limit_worker, &thread_data[i]) != 0)
-		 {
-		 	printf_threadsafe("%s(): pthread_create error\n", __FUNCTION__);
-		 	goto err;
 		 }
 	}
 	/* 3. Attendre la fin du traitement. */
-	for (unsigned int i = 0; i < nb_thread; ++i)
-	{
-		pthread_join(threads[i], NULL);
-	}
+	pool_run(pool, dragon_limit_worker, thread_data, sizeof(struct limit_data));
 	for (unsigned int i = 0; i < nb_thread; ++i)
 	{
 		piece_merge(&master, thread_data[i].piece);
 	}
 
-
 done:
-	FREE(threads);
 	FREE(thread_data);
 	*limits = master.limits;
 	return ret;
@@ -214,3 +531,15 @@ err:
 	ret = -1;
 	goto done;
 }
+
+int dragon_limits_pthread(limits_t *limits, uint64_t size, int nb_thread)
+{
+	struct dragon_ctx ctx;
+	int ret;
+
+	if (dragon_ctx_init(&ctx, &dragon_backend_pthread, nb_thread, &dragon_arena) < 0)
+		return -1;
+	ret = dragon_ctx_limits(&ctx, limits, size);
+	dragon_ctx_release(&ctx);
+	return ret;
+}
@@ -9,8 +9,13 @@
 #define DRAGON_PTHREAD_H_
 
 #include "dragon.h"
+#include "context.h"
+
+extern const struct dragon_backend dragon_backend_pthread;
+extern const struct dragon_backend dragon_backend_pthread_binned;
 
 int dragon_draw_pthread(char **canvas, struct rgb *image, int width, int height, uint64_t size, int nb_thread);
+int dragon_draw_pthread_binned(char **canvas, struct rgb *image, int width, int height, uint64_t size, int nb_thread);
 int dragon_limits_pthread(limits_t *lim, uint64_t size, int nb_thread);
 
 #endif /* DRAGON_PTHREAD_H_ */
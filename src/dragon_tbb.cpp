@@ -11,6 +11,10 @@ extern "C" {
 #include "dragon.h"
 #include "color.h"
 #include "utils.h"
+#include "perf.h"
+#include "trace.h"
+#include "context.h"
+#include "dataflow.h"
 }
 #include "dragon_tbb.h"
 #include "tbb/tbb.h"
@@ -19,12 +23,38 @@ extern "C" {
 using namespace std;
 using namespace tbb;
 
+/* dense id of the calling thread, only looked up when counters are enabled */
+static inline int perf_thread_id(TidMap *tidMap)
+{
+	if (!perf_enabled)
+		return -1;
+	return tidMap->getId();
+}
+
+/* a task runs on any thread of the arena: it brings the job of its render */
+class JobScope {
+	struct progress_job *_saved;
+public:
+	JobScope(struct progress_job *job)
+	:_saved(progress_job)
+	{
+		progress_job = job;
+	}
+	~JobScope()
+	{
+		progress_job = _saved;
+	}
+};
+
 class DragonLimits {
 
 public:
 	piece_t _piece;
+	TidMap *_tidMap;
+	struct progress_job *_job;
 
-	DragonLimits(unsigned int nb_thread)
+	DragonLimits(unsigned int nb_thread, TidMap *tidMap, struct progress_job *job)
+	:_tidMap(tidMap), _job(job)
 	{
 		piece_init(&_piece);
 	}
@@ -33,6 +63,7 @@ public:
 	// DragonLimits which is a piece on which piece_init has been called.
 	// Same as thread_data[i].piece = master.
 	DragonLimits(const DragonLimits& dl, split)
+	:_tidMap(dl._tidMap), _job(dl._job)
 	{
 		piece_init(&_piece);
 	}
@@ -41,7 +72,13 @@ public:
 	// automatically
 	void operator()(const tbb::blocked_range<uint64_t>& r) const
 	{
+		struct perf_sample ps;
+		JobScope scope(_job);
+		trace_begin_range("DragonLimits", r.begin(), r.end());
+		perf_stage_begin(&ps);
 		piece_limit(r.begin(), r.end(),(piece_t *)&_piece);
+		perf_stage_end(&ps, PERF_STAGE_LIMITS, perf_thread_id(_tidMap));
+		trace_end("DragonLimits");
 	}
 
 	// Join rhs with myself
@@ -51,6 +88,60 @@ public:
 	}
 };
 
+// Exclusive scan of the pieces of the chunks of the seeds: the final pass
+// stores the state at the start of each chunk, and the final sum holds the
+// limits. A chunk is walked once, by whichever pass reaches it first.
+class DragonScan {
+
+public:
+	piece_t _sum;
+	struct dragon_seeds *_seeds;
+	TidMap *_tidMap;
+	struct progress_job *_job;
+
+	DragonScan(struct dragon_seeds *seeds, TidMap *tidMap, struct progress_job *job)
+	:_seeds(seeds), _tidMap(tidMap), _job(job)
+	{
+		piece_init(&_sum);
+	}
+
+	DragonScan(DragonScan& ds, split)
+	:_seeds(ds._seeds), _tidMap(ds._tidMap), _job(ds._job)
+	{
+		piece_init(&_sum);
+	}
+
+	template <typename Tag>
+	void operator()(const tbb::blocked_range<int>& r, Tag tag)
+	{
+		struct perf_sample ps;
+		JobScope scope(_job);
+		trace_begin_range("DragonScan", r.begin(), r.end());
+		perf_stage_begin(&ps);
+		for (int c = r.begin(); c != r.end(); ++c) {
+			seeds_piece(_seeds, c);
+			if (tag.is_final_scan())
+				seeds_set(_seeds, c, &_sum);
+			piece_merge(&_sum, _seeds->pieces[c]);
+		}
+		perf_stage_end(&ps, PERF_STAGE_LIMITS, perf_thread_id(_tidMap));
+		trace_end("DragonScan");
+	}
+
+	// left holds the pieces before mine
+	void reverse_join(DragonScan& left)
+	{
+		piece_t sum = left._sum;
+		piece_merge(&sum, _sum);
+		_sum = sum;
+	}
+
+	void assign(DragonScan& b)
+	{
+		_sum = b._sum;
+	}
+};
+
 uint64_t max(uint64_t a, uint64_t b)
 {
 	return ( a < b ? b : a);
@@ -60,58 +151,27 @@ uint64_t min(uint64_t a, uint64_t b)
 	return (a < b ? a : b);
 }
 
-class DragonDraw {
+// r is a range of segment ranges of the dataflow: each one is drawn, then
+// the bands of image rows it completes are rendered
+class DragonFlow {
 	public:
 	struct draw_data _data;
+	int *_ret;
 	TidMap *_tidMap;
-	DragonDraw(struct draw_data data, TidMap *tidMap)
-	:_tidMap(tidMap)
+	DragonFlow(struct draw_data data, int *ret, TidMap *tidMap)
+	:_ret(ret), _tidMap(tidMap)
 	{
 		_data = data;
 	}
-	// Threads : 5
-	//               |<-inte_size->|
-	//               |  r.begin()  |                 r.end()
-	//               |     |       |                   |
-	// #-------------|-------------|-------------|-------------|-------------#
-	//start          1     |       2             3     |       4           end
-	//               |     |       |             |     |       |
-	//               |     |       |             |     |       |
-	//               |     |       |             |     |       |
-	//color=1: color_start |       |             |     |       |
-	//                draw_start   |             |     |       |
-	//                          color_end        |     |       |
-	//                          draw_end         |     |       |
-	//                                           |     |       |
-	//                                           |     |       |
-	//                                           |     |       |
-	//color=3:                            start_color  |       |
-	//                                    draw_start   |       |
-	//                                              draw_end   |
-	//                                                    color_end
-	//  start_color = r.begin()/interval_size = 1
-	//  end_color   = r.end()/interval_size   = 3
-	void operator()(const tbb::blocked_range<uint64_t>& r) const
-	{
-		uint64_t interval_size = _data.size / _data.nb_thread;
-
-		unsigned int  start_color = r.begin() / interval_size;
-		unsigned int  end_color = r.end() / interval_size;
-
-		for(unsigned int color = start_color; color <= end_color; ++color)
-		{
-			uint64_t color_start = interval_size * color;
-			uint64_t color_end = (color + 1) * interval_size;
 
-			if( color_end < r.begin() || r.end() < color_start)
-				continue;
-
-			uint64_t draw_start = max(color_start, r.begin());
-			uint64_t draw_end = min(color_end, r.end());
+	void operator()(const tbb::blocked_range<int>& r) const
+	{
+		JobScope scope(_data.job);
+		int thread = perf_thread_id(_tidMap);
 
-			dragon_draw_raw(draw_start, draw_end, _data.dragon,
-						_data.dragon_width, _data.dragon_height,
-						_data.limits, color);
+		for (int range = r.begin(); range != r.end(); ++range) {
+			if (dataflow_range(_data.dataflow, (struct draw_data *) &_data, range, thread) < 0)
+				*_ret = -1;
 		}
 	}
 };
@@ -119,73 +179,205 @@ class DragonDraw {
 class DragonRender {
 	public:
 	struct draw_data _data;
-	DragonRender(struct draw_data data)
+	TidMap *_tidMap;
+	DragonRender(struct draw_data data, TidMap *tidMap)
+	:_tidMap(tidMap)
 	{
 		_data = data;
 	}
 
 	void operator()(const tbb::blocked_range<uint64_t>& r) const
 	{
-		scale_dragon(r.begin(), r.end(), _data.image, _data.image_width, _data.image_height,
+		struct perf_sample ps;
+		JobScope scope(_data.job);
+		trace_begin_range("DragonRender", r.begin(), r.end());
+		perf_stage_begin(&ps);
+		scale_dragon_packed(r.begin(), r.end(), _data.image, _data.image_width, _data.image_height,
 										_data.dragon, _data.dragon_width, _data.dragon_height,
-										_data.palette);
+										_data.palette, _data.packed);
+		perf_stage_end(&ps, PERF_STAGE_RENDER, perf_thread_id(_tidMap));
+		trace_end("DragonRender");
 	}
 
 };
 
-class DragonClear {
+class DragonBin {
 	public:
 	struct draw_data _data;
-	DragonClear(struct draw_data data)
+	struct dragon_walk *_walks;
+	uint64_t _pass;
+	int *_ret;
+	TidMap *_tidMap;
+	DragonBin(struct draw_data data, struct dragon_walk *walks, uint64_t pass, int *ret, TidMap *tidMap)
+	:_walks(walks), _pass(pass), _ret(ret), _tidMap(tidMap)
 	{
 		_data = data;
 	}
 
-	void operator()(const tbb::blocked_range<uint64_t>& r) const
+	// r is a range of tracers, tracer t draws the segments of color t
+	void operator()(const tbb::blocked_range<int>& r) const
 	{
-		init_canvas(r.begin(), r.end(), _data.dragon, -1);
+		struct perf_sample ps;
+		JobScope scope(_data.job);
+		perf_stage_begin(&ps);
+		for (int t = r.begin(); t != r.end(); ++t) {
+			uint64_t start = t * _data.size / _data.nb_color;
+			uint64_t end = (t + 1) * _data.size / _data.nb_color;
+			uint64_t pass_start = min(start + _pass * BIN_PASS, end);
+			uint64_t pass_end = min(pass_start + BIN_PASS, end);
+
+			trace_begin_range("DragonBin", pass_start, pass_end);
+			if (dragon_bin_raw(pass_start, pass_end, &_walks[t], &_data.bins[t],
+					_data.dragon_width, _data.dragon_height, _data.tile_bytes) < 0)
+				*_ret = -1;
+			trace_end("DragonBin");
+		}
+		perf_stage_end(&ps, PERF_STAGE_DRAW, perf_thread_id(_tidMap));
 	}
 };
 
-int dragon_draw_tbb(char **canvas, struct rgb *image, int width, int height, uint64_t size, int nb_thread)
+class DragonDrain {
+	public:
+	struct draw_data _data;
+	uint64_t _pass;
+	TidMap *_tidMap;
+	DragonDrain(struct draw_data data, uint64_t pass, TidMap *tidMap)
+	:_pass(pass), _tidMap(tidMap)
+	{
+		_data = data;
+	}
+
+	// r is a range of tiles
+	void operator()(const tbb::blocked_range<int>& r) const
+	{
+		struct perf_sample ps;
+		JobScope scope(_data.job);
+		perf_stage_begin(&ps);
+		for (int tile = r.begin(); tile != r.end(); ++tile) {
+			trace_begin_range("DragonDrain", tile, tile + 1);
+			dragon_drain_bins(_data.bins, _data.nb_color, tile, _data.dragon, _data.packed);
+			trace_end("DragonDrain");
+		}
+		perf_stage_end(&ps, PERF_STAGE_DRAW, perf_thread_id(_tidMap));
+	}
+};
+
+/* grain of a stage of n steps, ranges of at least 1 step without split */
+static uint64_t tbb_grain(struct dragon_ctx *ctx, int stage, uint64_t n)
+{
+	uint64_t ranges = (uint64_t) ctx->nb_thread * ctx->split[stage];
+
+	if (ranges == 0 || n <= ranges)
+		return 1;
+	return n / ranges;
+}
+
+static int tbb_limits(struct dragon_ctx *ctx, limits_t *limits, uint64_t size, TidMap *tidMap)
+{
+	DragonLimits lim = DragonLimits(0, tidMap, ctx->job);
+
+	tbb::parallel_reduce(tbb::blocked_range<uint64_t>(0, size,
+			tbb_grain(ctx, PERF_STAGE_LIMITS, size)), lim);
+
+	*limits = lim._piece.limits;
+	return 0;
+}
+
+/* limits and seeds in one pass */
+static int tbb_scan(struct dragon_ctx *ctx, limits_t *limits, struct dragon_seeds *seeds, TidMap *tidMap)
+{
+	DragonScan scan = DragonScan(seeds, tidMap, ctx->job);
+
+	tbb::parallel_scan(tbb::blocked_range<int>(0, seeds->nb_chunk,
+			tbb_grain(ctx, PERF_STAGE_LIMITS, seeds->nb_chunk)), scan);
+
+	*limits = scan._sum.limits;
+	return 0;
+}
+
+/* one tracer per color, the canvas is cut in one tile per thread */
+static int tbb_draw_binned(struct draw_data *data, TidMap *tidMap)
+{
+	int nb_thread = data->nb_thread;
+	int nb_color = data->nb_color;
+	struct dragon_bins *bins = new struct dragon_bins[nb_color]();
+	struct dragon_walk *walks = new struct dragon_walk[nb_color];
+	affinity_partitioner ap;
+	int ret = 0;
+
+	for (int t = 0; t < nb_color; t++) {
+		if (bins_init(&bins[t], nb_thread) < 0)
+			ret = -1;
+		seeds_walk(data->seeds, t * data->size / nb_color, data->limits, &walks[t]);
+	}
+	data->bins = bins;
+	data->tile_bytes = dragon_tile_cells((uint64_t) data->dragon_width * data->dragon_height, nb_thread,
+			data->packed);
+	data->nb_pass = ((data->size + nb_color - 1) / nb_color + BIN_PASS - 1) / BIN_PASS;
+
+	for (uint64_t pass = 0; ret == 0 && pass < data->nb_pass; pass++) {
+		parallel_for(blocked_range<int>(0, nb_color, 1),
+				DragonBin(*data, walks, pass, &ret, tidMap));
+		// the same worker keeps the same tiles from one pass to the next
+		parallel_for(blocked_range<int>(0, nb_thread, 1),
+				DragonDrain(*data, pass, tidMap), ap);
+		for (int t = 0; t < nb_color; t++)
+			bins_reset(&bins[t]);
+	}
+
+	for (int t = 0; t < nb_color; t++)
+		bins_free(&bins[t]);
+	delete[] bins;
+	delete[] walks;
+	data->bins = NULL;
+	return ret;
+}
+
+static int draw_tbb_arena(struct dragon_ctx *ctx, char **canvas, struct rgb *image, int width, int height,
+		uint64_t size, int binned)
 {
 	struct draw_data data;
 	limits_t limits;
 	char *dragon = NULL;
+	int nb_thread = ctx->nb_thread;
 	int dragon_width;
 	int dragon_height;
-	int dragon_surface;
+	uint64_t dragon_surface;
 	int scale_x;
 	int scale_y;
 	int scale;
 	int deltaJ;
 	int deltaI;
 
-	struct palette *palette = init_palette(nb_thread);
-	if (palette == NULL)
-		return -1;
-
-	/* 1. Calculer les limites du dragon */
-	dragon_limits_tbb(&limits, size, nb_thread);
+	/* one map for every stage, so that a thread keeps its id in the report */
+	TidMap *tidMap = new TidMap(PERF_MAX_THREAD);
 
-	task_scheduler_init init(nb_thread);
+	/* 1. Calculer les limites du dragon et le départ de chaque intervalle */
+	struct dragon_seeds seeds;
+	if (seeds_init(&seeds, size, ctx->nb_color * DATAFLOW_RANGES) < 0) {
+		delete tidMap;
+		return -1;
+	}
+	tbb_scan(ctx, &limits, &seeds, tidMap);
 
 	dragon_width = limits.maximums.x - limits.minimums.x;
 	dragon_height = limits.maximums.y - limits.minimums.y;
-	dragon_surface = dragon_width * dragon_height;
+	dragon_surface = (uint64_t) dragon_width * dragon_height;
 	scale_x = dragon_width / width + 1;
 	scale_y = dragon_height / height + 1;
 	scale = (scale_x > scale_y ? scale_x : scale_y);
 	deltaJ = (scale * width - dragon_width) / 2;
 	deltaI = (scale * height - dragon_height) / 2;
 
-	dragon = (char *) malloc(dragon_surface);
+	dragon = (char *) arena_alloc_zero(ctx->arena, canvas_bytes(dragon_surface, ctx->packed));
 	if (dragon == NULL) {
-		free_palette(palette);
+		seeds_free(&seeds);
+		delete tidMap;
 		return -1;
 	}
 
 	data.nb_thread = nb_thread;
+	data.nb_color = ctx->nb_color;
 	data.dragon = dragon;
 	data.image = image;
 	data.size = size;
@@ -197,42 +389,169 @@ int dragon_draw_tbb(char **canvas, struct rgb *image, int width, int height, uin
 	data.scale = scale;
 	data.deltaI = deltaI;
 	data.deltaJ = deltaJ;
-	data.palette = palette;
+	data.palette = ctx->palette;
 	data.tid = (int *) calloc(nb_thread, sizeof(int));
+	data.job = ctx->job;
+	data.packed = ctx->packed;
+	data.seeds = &seeds;
+
+	if (binned) {
+		/* 2-3. Tracer dans les tuiles puis dessiner chaque tuile : DragonBin, DragonDrain */
+		if (tbb_draw_binned(&data, tidMap) < 0) {
+			seeds_free(&seeds);
+			delete tidMap;
+			FREE(data.tid);
+			dragon_ctx_free(ctx, dragon);
+			return -1;
+		}
+		/* 4. Effectuer le rendu final */
+		DragonRender dr = DragonRender(data, tidMap);
+		parallel_for(blocked_range<uint64_t>(0, height, tbb_grain(ctx, PERF_STAGE_RENDER, height)), dr);
+	} else {
+		/*
+		 * 2-4. Dessiner le dragon, la surface est déjà à zéro, et rendre
+		 * chaque bande dès que ses intervalles sont tracés : DragonFlow
+		 */
+		struct dragon_dataflow df;
+		int ret = 0;
+
+		if (dataflow_init(&df, &data) < 0) {
+			seeds_free(&seeds);
+			delete tidMap;
+			FREE(data.tid);
+			dragon_ctx_free(ctx, dragon);
+			return -1;
+		}
+		data.dataflow = &df;
+		parallel_for(blocked_range<int>(0, df.nb_range, tbb_grain(ctx, PERF_STAGE_DRAW, df.nb_range)),
+				DragonFlow(data, &ret, tidMap));
+		dataflow_free(&df);
+		if (ret < 0) {
+			seeds_free(&seeds);
+			delete tidMap;
+			FREE(data.tid);
+			dragon_ctx_free(ctx, dragon);
+			return -1;
+		}
+	}
 
-	/* 2. Initialiser la surface : DragonClear */
-	uint64_t area = data.dragon_width * data.dragon_height;
-	DragonClear dc = DragonClear(data);
-	parallel_for(blocked_range<uint64_t>(0,area), dc);
+	seeds_free(&seeds);
+	delete tidMap;
+	FREE(data.tid);
+	*canvas = dragon;
+	return 0;
+}
 
-	/* 3. Dessiner le dragon : DragonDraw */
-	TidMap *tidMap = new TidMap(nb_thread);
-	DragonDraw dd = DragonDraw(data, tidMap);
-	parallel_for(blocked_range<uint64_t>(0,size), dd);
+/* called from a task, a batch job for instance */
+static inline bool in_tbb_arena(void)
+{
+	return this_task_arena::current_thread_index() != task_arena::not_initialized;
+}
 
-	/* 4. Effectuer le rendu final */
-	DragonRender dr = DragonRender(data);
-	parallel_for(blocked_range<uint64_t>(0,height), dr);
+/* arena of nb_thread slots of the context, created by its first render */
+static task_arena *tbb_pool(struct dragon_ctx *ctx)
+{
+	if (ctx->pool == NULL)
+		ctx->pool = new task_arena(ctx->nb_thread);
+	return static_cast<task_arena *>(ctx->pool);
+}
 
-	init.terminate();
+static void tbb_release(struct dragon_ctx *ctx)
+{
+	delete static_cast<task_arena *>(ctx->pool);
+	ctx->pool = NULL;
+}
 
-	free_palette(palette);
-	FREE(data.tid);
-	*canvas = dragon;
-	// *canvas = NULL;
-	return 0;
+/*
+ * Each context runs in its own arena of nb_thread slots: concurrent renders
+ * of the server are isolated, and one never steals the threads of another.
+ * A call from a task nests in the arena of the caller instead, so that the
+ * jobs of a batch share one pool.
+ */
+static int draw_tbb(struct dragon_ctx *ctx, char **canvas, struct rgb *image, int width, int height,
+		uint64_t size, int binned)
+{
+	int ret = -1;
+
+	if (in_tbb_arena())
+		return draw_tbb_arena(ctx, canvas, image, width, height, size, binned);
+
+	tbb_pool(ctx)->execute([&] {
+		ret = draw_tbb_arena(ctx, canvas, image, width, height, size, binned);
+	});
+	return ret;
+}
+
+static int draw_tbb_plain(struct dragon_ctx *ctx, char **canvas, struct rgb *image, int width, int height,
+		uint64_t size)
+{
+	return draw_tbb(ctx, canvas, image, width, height, size, 0);
+}
+
+static int draw_tbb_binned(struct dragon_ctx *ctx, char **canvas, struct rgb *image, int width, int height,
+		uint64_t size)
+{
+	return draw_tbb(ctx, canvas, image, width, height, size, 1);
 }
 
 /*
  * Calcule les limites en terme de largeur et de hauteur de
  * la forme du dragon. Requis pour allouer la matrice de dessin.
  */
-int dragon_limits_tbb(limits_t *limits, uint64_t size, int nb_thread)
+static int limits_tbb(struct dragon_ctx *ctx, limits_t *limits, uint64_t size)
 {
-	DragonLimits lim = DragonLimits(nb_thread);
+	TidMap tidMap(PERF_MAX_THREAD);
+	int ret = -1;
 
-	tbb::parallel_reduce(tbb::blocked_range<uint64_t>(0, size), lim);
+	if (in_tbb_arena())
+		return tbb_limits(ctx, limits, size, &tidMap);
 
-	*limits = lim._piece.limits;
-	return 0;
+	tbb_pool(ctx)->execute([&] {
+		ret = tbb_limits(ctx, limits, size, &tidMap);
+	});
+	return ret;
+}
+
+const struct dragon_backend dragon_backend_tbb = {
+	"tbb", draw_tbb_plain, limits_tbb, tbb_release, 1,
+};
+
+const struct dragon_backend dragon_backend_tbb_binned = {
+	"tbb-binned", draw_tbb_binned, limits_tbb, tbb_release, 1,
+};
+
+static int draw_once(const struct dragon_backend *backend, char **canvas, struct rgb *image,
+		int width, int height, uint64_t size, int nb_thread)
+{
+	struct dragon_ctx ctx;
+	int ret;
+
+	*canvas = NULL;
+	if (dragon_ctx_init(&ctx, backend, nb_thread, &dragon_arena) < 0)
+		return -1;
+	ret = dragon_ctx_draw(&ctx, canvas, image, width, height, size);
+	dragon_ctx_release(&ctx);
+	return ret;
+}
+
+int dragon_draw_tbb(char **canvas, struct rgb *image, int width, int height, uint64_t size, int nb_thread)
+{
+	return draw_once(&dragon_backend_tbb, canvas, image, width, height, size, nb_thread);
+}
+
+int dragon_draw_tbb_binned(char **canvas, struct rgb *image, int width, int height, uint64_t size, int nb_thread)
+{
+	return draw_once(&dragon_backend_tbb_binned, canvas, image, width, height, size, nb_thread);
+}
+
+int dragon_limits_tbb(limits_t *limits, uint64_t size, int nb_thread)
+{
+	struct dragon_ctx ctx;
+	int ret;
+
+	if (dragon_ctx_init(&ctx, &dragon_backend_tbb, nb_thread, &dragon_arena) < 0)
+		return -1;
+	ret = dragon_ctx_limits(&ctx, limits, size);
+	dragon_ctx_release(&ctx);
+	return ret;
 }
@@ -9,11 +9,16 @@
 #define DRAGON_TBB_H_
 
 #include "dragon.h"
+#include "context.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
+extern const struct dragon_backend dragon_backend_tbb;
+extern const struct dragon_backend dragon_backend_tbb_binned;
+
 int dragon_draw_tbb(char **canvas, struct rgb *image, int width, int height, uint64_t size, int nb_thread);
+int dragon_draw_tbb_binned(char **canvas, struct rgb *image, int width, int height, uint64_t size, int nb_thread);
 int dragon_limits_tbb(limits_t *limits, uint64_t size, int nb_thread);
 #ifdef __cplusplus
 }
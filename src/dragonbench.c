@@ -0,0 +1,433 @@
+/*
+ * dragonbench.c
+ *
+ *  Created on: 2026-10-19
+ *
+ * Microbenchmarks of the dragon kernels. Each kernel is run on its own,
+ * for a range of sizes, scales and thread counts, and is reported in
+ * ns per segment (or per element) and in GB/s against the memory
+ * bandwidth measured at the beginning of the run. The share of that
+ * bandwidth is only printed for working sets larger than the last level
+ * cache: the smaller ones are served from the cache, not from memory.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <inttypes.h>
+
+#include "config.h"
+#include "dragon.h"
+#include "color.h"
+#include "tidmap_bench.h"
+
+#define PROGNAME "dragonbench"
+#define DEFAULT_POWER_MIN	16
+#define DEFAULT_POWER_MAX	24
+#define DEFAULT_NB_THREAD	4
+#define DEFAULT_REPEAT		3
+/* smallest buffer of the roofline, twice the last level cache if larger */
+#define ROOFLINE_BYTES		(256 * 1024 * 1024)
+#define TIDMAP_LOOKUPS		(1 << 22)
+/* last level cache assumed when sysconf does not tell it */
+#define LLC_DEFAULT_BYTES	(32 * 1024 * 1024)
+
+struct bench_opts {
+	int power_min;
+	int power_max;
+	int nb_thread;
+	int repeat;
+};
+
+struct bench_job;
+typedef void (*bench_fn)(struct bench_job *job, int id, int nb_thread);
+
+struct bench_job {
+	bench_fn fn;
+	pthread_barrier_t barrier;
+	int nb_thread;
+	uint64_t size;
+	char *canvas;
+	int width;
+	int height;
+	limits_t limits;
+	struct rgb *image;
+	int image_width;
+	int image_height;
+	struct palette *palette;
+	piece_t *pieces;
+	piece_t parts[256];
+	void *tidmap;
+	uint64_t sink;
+};
+
+struct bench_thread {
+	struct bench_job *job;
+	int id;
+	uint64_t start;
+	uint64_t end;
+};
+
+static double roofline_gbs[256];
+static uint64_t llc_bytes;
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *bench_worker(void *data)
+{
+	struct bench_thread *th = (struct bench_thread *) data;
+	pthread_barrier_wait(&th->job->barrier);
+	th->start = bench_now();
+	th->job->fn(th->job, th->id, th->job->nb_thread);
+	th->end = bench_now();
+	return NULL;
+}
+
+/* run fn on nb_thread threads, return the best wall time in ns */
+static uint64_t bench_run(struct bench_job *job, bench_fn fn, int nb_thread, int repeat)
+{
+	pthread_t threads[nb_thread];
+	struct bench_thread args[nb_thread];
+	uint64_t best = UINT64_MAX;
+	int r, i;
+
+	job->fn = fn;
+	job->nb_thread = nb_thread;
+	for (r = 0; r < repeat; r++) {
+		uint64_t first = UINT64_MAX, last = 0, t;
+
+		/* time from the first thread to start to the last one to finish */
+		pthread_barrier_init(&job->barrier, NULL, nb_thread);
+		for (i = 0; i < nb_thread; i++) {
+			args[i].job = job;
+			args[i].id = i;
+			pthread_create(&threads[i], NULL, bench_worker, &args[i]);
+		}
+		for (i = 0; i < nb_thread; i++) {
+			pthread_join(threads[i], NULL);
+			if (args[i].start < first)
+				first = args[i].start;
+			if (args[i].end > last)
+				last = args[i].end;
+		}
+		pthread_barrier_destroy(&job->barrier);
+		t = last - first;
+		if (t < best)
+			best = t;
+	}
+	return best;
+}
+
+/* the L3, else the L2 */
+static uint64_t llc_size(void)
+{
+	long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+
+	if (l3 > 0)
+		return l3;
+	if (l2 > 0)
+		return l2;
+	return LLC_DEFAULT_BYTES;
+}
+
+/* bytes moved by the kernel, out of a working set of footprint bytes */
+static void bench_report(const char *kernel, const char *param, int nb_thread,
+		uint64_t ns, uint64_t count, uint64_t bytes, uint64_t footprint)
+{
+	double gbs = bytes / (double) ns;
+	double roof = roofline_gbs[nb_thread];
+	printf("%-20s %-16s %6d %10.3f %10.3f %8.2f", kernel, param, nb_thread,
+			ns / 1e6, ns / (double) count, gbs);
+	if (bytes > 0 && roof > 0 && footprint > llc_bytes)
+		printf(" %7.1f%%\n", 100 * gbs / roof);
+	else
+		printf(" %8s\n", "-");
+}
+
+#define SPLIT_START(n, id, nb) ((n) * (id) / (nb))
+#define SPLIT_END(n, id, nb) ((n) * ((id) + 1) / (nb))
+
+static void roofline_kernel(struct bench_job *job, int id, int nb_thread)
+{
+	uint64_t start = SPLIT_START(job->size, id, nb_thread);
+	uint64_t end = SPLIT_END(job->size, id, nb_thread);
+	uint64_t *buf = (uint64_t *) job->canvas;
+	uint64_t sum = 0;
+	uint64_t i;
+
+	/* read then write every word: one load and one store stream */
+	for (i = start / 8; i < end / 8; i++) {
+		sum += buf[i];
+		buf[i] = i;
+	}
+	__sync_fetch_and_add(&job->sink, sum);
+}
+
+static void position_kernel(struct bench_job *job, int id, int nb_thread)
+{
+	uint64_t start = SPLIT_START(job->size, id, nb_thread);
+	uint64_t end = SPLIT_END(job->size, id, nb_thread);
+	uint64_t sum = 0;
+	uint64_t i;
+
+	for (i = start; i < end; i++) {
+		xy_t p = compute_position(i * 2654435761ULL % job->size);
+		sum += p.x + p.y;
+	}
+	__sync_fetch_and_add(&job->sink, sum);
+}
+
+static void orientation_kernel(struct bench_job *job, int id, int nb_thread)
+{
+	uint64_t start = SPLIT_START(job->size, id, nb_thread);
+	uint64_t end = SPLIT_END(job->size, id, nb_thread);
+	uint64_t sum = 0;
+	uint64_t i;
+
+	for (i = start; i < end; i++) {
+		xy_t o = compute_orientation(i * 2654435761ULL % job->size);
+		sum += o.x + o.y;
+	}
+	__sync_fetch_and_add(&job->sink, sum);
+}
+
+static void limit_kernel(struct bench_job *job, int id, int nb_thread)
+{
+	piece_init(&job->parts[id]);
+	piece_limit(SPLIT_START(job->size, id, nb_thread),
+			SPLIT_END(job->size, id, nb_thread), &job->parts[id]);
+}
+
+static void merge_kernel(struct bench_job *job, int id, int nb_thread)
+{
+	uint64_t start = SPLIT_START(job->size, id, nb_thread);
+	uint64_t end = SPLIT_END(job->size, id, nb_thread);
+	piece_t master;
+	uint64_t i;
+
+	piece_init(&master);
+	for (i = start; i < end; i++)
+		piece_merge(&master, job->pieces[i & 1023]);
+	__sync_fetch_and_add(&job->sink, master.position.x);
+}
+
+static void draw_kernel(struct bench_job *job, int id, int nb_thread)
+{
+	dragon_draw_walk(SPLIT_START(job->size, id, nb_thread),
+			SPLIT_END(job->size, id, nb_thread), job->canvas,
+			job->width, job->height, job->limits, id, DRAW_FLAGS);
+}
+
+static void clear_kernel(struct bench_job *job, int id, int nb_thread)
+{
+	uint64_t area = (uint64_t) job->width * job->height;
+	init_canvas(SPLIT_START(area, id, nb_thread), SPLIT_END(area, id, nb_thread),
+			job->canvas, 0);
+}
+
+static void scale_kernel(struct bench_job *job, int id, int nb_thread)
+{
+	scale_dragon(SPLIT_START(job->image_height, id, nb_thread),
+			SPLIT_END(job->image_height, id, nb_thread), job->image,
+			job->image_width, job->image_height, job->canvas,
+			job->width, job->height, job->palette);
+}
+
+static void tidmap_tid_kernel(struct bench_job *job, int id, int nb_thread)
+{
+	__sync_fetch_and_add(&job->sink, tidmap_bench_lookup_tid(job->tidmap, job->size));
+}
+
+static void tidmap_kernel(struct bench_job *job, int id, int nb_thread)
+{
+	__sync_fetch_and_add(&job->sink, tidmap_bench_lookup(job->tidmap, job->size));
+}
+
+/* every thread hammers the same map, as the TBB bodies do */
+static void bench_tidmap(struct bench_opts *opts, struct bench_job *job)
+{
+	uint64_t ns;
+	int t;
+
+	/* threads are recreated on every repetition, leave room for all of them */
+	job->size = TIDMAP_LOOKUPS;
+	for (t = 1; t <= opts->nb_thread; t++) {
+		job->tidmap = tidmap_bench_new(4 * t * opts->repeat);
+		ns = bench_run(job, tidmap_tid_kernel, t, opts->repeat);
+		bench_report("TidMap::getIdFromTid", "lookups", t, ns, TIDMAP_LOOKUPS, 0, 0);
+		ns = bench_run(job, tidmap_kernel, t, opts->repeat);
+		bench_report("TidMap::getId", "lookups", t, ns, TIDMAP_LOOKUPS, 0, 0);
+		tidmap_bench_free(job->tidmap);
+	}
+}
+
+static void bench_roofline(struct bench_opts *opts, struct bench_job *job)
+{
+	uint64_t bytes = ROOFLINE_BYTES > 2 * llc_bytes ? ROOFLINE_BYTES : 2 * llc_bytes;
+	char param[32];
+	int t;
+
+	job->size = bytes;
+	job->canvas = (char *) malloc(bytes);
+	if (job->canvas == NULL)
+		return;
+	memset(job->canvas, 0, bytes);
+	snprintf(param, sizeof(param), "%"PRIu64"MiB r+w", bytes >> 20);
+	for (t = 1; t <= opts->nb_thread; t++) {
+		uint64_t ns = bench_run(job, roofline_kernel, t, opts->repeat);
+		roofline_gbs[t] = 2.0 * bytes / ns;
+		bench_report("roofline", param, t, ns, bytes / 8, 2 * bytes, bytes);
+	}
+	FREE(job->canvas);
+}
+
+static int bench_power(struct bench_opts *opts, struct bench_job *job, int power)
+{
+	char param[32];
+	uint64_t size = 1ULL << power;
+	uint64_t area, image;
+	int t, i;
+
+	if (dragon_limits_serial(&job->limits, size, 1) < 0)
+		return -1;
+	job->width = job->limits.maximums.x - job->limits.minimums.x;
+	job->height = job->limits.maximums.y - job->limits.minimums.y;
+	area = (uint64_t) job->width * job->height;
+	job->canvas = (char *) malloc(area);
+	if (job->canvas == NULL)
+		return -1;
+	init_canvas(0, area, job->canvas, 0);
+
+	for (t = 1; t <= opts->nb_thread; t++) {
+		uint64_t ns;
+
+		snprintf(param, sizeof(param), "2^%d", power);
+		job->size = size;
+
+		ns = bench_run(job, position_kernel, t, opts->repeat);
+		bench_report("compute_position", param, t, ns, size, 0, 0);
+		ns = bench_run(job, orientation_kernel, t, opts->repeat);
+		bench_report("compute_orientation", param, t, ns, size, 0, 0);
+		ns = bench_run(job, limit_kernel, t, opts->repeat);
+		bench_report("piece_limit", param, t, ns, size, 0, 0);
+		ns = bench_run(job, merge_kernel, t, opts->repeat);
+		bench_report("piece_merge", param, t, ns, size, 0, 0);
+		ns = bench_run(job, draw_kernel, t, opts->repeat);
+		bench_report("dragon_draw_walk", param, t, ns, size, size, area);
+
+		snprintf(param, sizeof(param), "%dx%d", job->width, job->height);
+		ns = bench_run(job, clear_kernel, t, opts->repeat);
+		bench_report("init_canvas", param, t, ns, area, area, area);
+
+		/* scale from 1:1 down to a thumbnail */
+		for (i = 1; i <= 64; i *= 8) {
+			job->image_width = job->width / i;
+			job->image_height = job->height / i;
+			if (job->image_width == 0 || job->image_height == 0)
+				continue;
+			job->image = make_canvas(job->image_width, job->image_height);
+			if (job->image == NULL)
+				continue;
+			snprintf(param, sizeof(param), "2^%d 1/%d", power, i);
+			ns = bench_run(job, scale_kernel, t, opts->repeat);
+			image = sizeof(struct rgb) * job->image_width * job->image_height;
+			bench_report("scale_dragon", param, t, ns, area, area + image, area + image);
+			ARENA_FREE(job->image);
+		}
+	}
+	FREE(job->canvas);
+	return 0;
+}
+
+__attribute__((noreturn))
+static void usage(void)
+{
+	fprintf(stderr, "Usage: " PROGNAME " [OPTIONS]\n");
+	fprintf(stderr, "\nOptions:\n");
+	fprintf(stderr, "  --help	this help\n");
+	fprintf(stderr, "  --power	smallest dragon power [%d]\n", DEFAULT_POWER_MIN);
+	fprintf(stderr, "  --max	largest dragon power [%d]\n", DEFAULT_POWER_MAX);
+	fprintf(stderr, "  --thread	largest number of threads [%d]\n", DEFAULT_NB_THREAD);
+	fprintf(stderr, "  --repeat	repetitions, the best one is kept [%d]\n", DEFAULT_REPEAT);
+	fprintf(stderr, "\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_opts opts;
+	struct bench_job job;
+	int opt, idx, p;
+	struct option options[] = {
+			{ "help",	 0, 0, 'h' },
+			{ "power",	 1, 0, 'p' },
+			{ "max",	 1, 0, 'm' },
+			{ "thread",	 1, 0, 't' },
+			{ "repeat",	 1, 0, 'r' },
+			{ 0, 0, 0, 0}
+	};
+
+	opts.power_min = DEFAULT_POWER_MIN;
+	opts.power_max = DEFAULT_POWER_MAX;
+	opts.nb_thread = DEFAULT_NB_THREAD;
+	opts.repeat = DEFAULT_REPEAT;
+
+	while ((opt = getopt_long(argc, argv, "hp:m:t:r:", options, &idx)) != -1) {
+		switch (opt) {
+		case 'p':
+			opts.power_min = atoi(optarg);
+			break;
+		case 'm':
+			opts.power_max = atoi(optarg);
+			break;
+		case 't':
+			opts.nb_thread = atoi(optarg);
+			break;
+		case 'r':
+			opts.repeat = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (opts.power_min < 1 || opts.power_max >= 30 || opts.power_min > opts.power_max ||
+			opts.nb_thread < 1 || opts.nb_thread > 255 || opts.repeat < 1)
+		usage();
+
+	memset(&job, 0, sizeof(job));
+	llc_bytes = llc_size();
+	job.palette = init_palette(opts.nb_thread);
+	job.pieces = (piece_t *) malloc(sizeof(piece_t) * 1024);
+	if (job.palette == NULL || job.pieces == NULL)
+		return EXIT_FAILURE;
+	for (p = 0; p < 1024; p++) {
+		piece_init(&job.pieces[p]);
+		piece_limit(p * 64, (p + 1) * 64, &job.pieces[p]);
+	}
+
+	printf("%-20s %-16s %6s %10s %10s %8s %8s\n", "kernel", "param", "thread",
+			"time(ms)", "ns/elem", "GB/s", "roof");
+	bench_roofline(&opts, &job);
+	bench_tidmap(&opts, &job);
+	for (p = opts.power_min; p <= opts.power_max; p++) {
+		if (bench_power(&opts, &job, p) < 0) {
+			printf("Error: benchmark failed at power %d\n", p);
+			return EXIT_FAILURE;
+		}
+	}
+
+	free_palette(job.palette);
+	FREE(job.pieces);
+	return EXIT_SUCCESS;
+}
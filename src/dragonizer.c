@@ -19,25 +19,40 @@
 #include <error.h>
 #include <getopt.h>
 #include <inttypes.h>
+#include <time.h>
 
 #include "config.h"
 #include "dragon.h"
 #include "dragon_pthread.h"
 #include "dragon_tbb.h"
+#include "perf.h"
+#include "trace.h"
+#include "progress.h"
+#include "job.h"
+#include "serve.h"
+#include "cache.h"
+#include "dragon_batch.h"
+#include "viewport.h"
+#include "animate.h"
+#include "writer.h"
+#include "async.h"
+#include "tune.h"
+#include "scaling.h"
+#include "plan.h"
+#include "deadline.h"
 
 /* Globals and defaults */
 #define PROGNAME "dragonizer"
-#define DEFAULT_HEIGHT	512
-#define DEFAULT_WIDTH 	512
-#define DEFAULT_SIZE	1048576
-#define DEFAULT_NB_THREAD 2
-#define DEFAULT_LIB_NAME "serial"
-#define DEFAULT_IMG_PATH "dragon.ppm"
-#define POWER_MAX 		30
 #define CHECK_POWER 	20
 #define CHECK_NB_THREAD	8
 static const struct command_def * const commands[];
 int verbose = 0;
+/* renders cache, enabled when cache.dir is set by --cache */
+static struct dragon_cache cache;
+/* tuning profile, used when --auto is set */
+static struct tune_profile tune_profile;
+/* throughput of the kernels, calibrated before the draws with --deadline */
+static struct deadline_rates deadline_rates;
 
 /*
  * Over POWER_MAX = 30, the types used in array indexes overflows
@@ -62,6 +77,20 @@ struct command_opts {
 	int power_max;
 	int verbose;
 	uint64_t size;
+	char *metrics_path;
+	int metrics_interval;
+	char *serve_path;
+	char *submit_path;
+	char *cache_path;
+	char *batch_path;
+	struct dragon_viewport viewport;
+	int has_viewport;
+	int preview;
+	int frames;
+	char *auto_path;
+	int packed;
+	uint64_t mem_budget;
+	int deadline;
 };
 
 typedef int (*draw_handler)(char **, struct rgb *, int, int, uint64_t, int);
@@ -72,25 +101,40 @@ struct lib_def {
 	enum thread_lib lib;
 	draw_handler draw_handler;
 	limits_handler limits_handler;
+	const struct dragon_backend *backend;
 };
 
 static const struct lib_def libs[] = {
 		{ .name = "serial",
 				.lib = THREAD_LIB_SERIAL,
 				.draw_handler = dragon_draw_serial,
-				.limits_handler = dragon_limits_serial },
+				.limits_handler = dragon_limits_serial,
+				.backend = &dragon_backend_serial },
 		{ .name = "pthread",
 				.lib = THREAD_LIB_PTHREAD,
 				.draw_handler = dragon_draw_pthread,
-				.limits_handler = dragon_limits_pthread },
+				.limits_handler = dragon_limits_pthread,
+				.backend = &dragon_backend_pthread },
 		{ .name = "tbb",
 				.lib = THREAD_LIB_TBB,
 				.draw_handler = dragon_draw_tbb,
-				.limits_handler = dragon_limits_tbb },
+				.limits_handler = dragon_limits_tbb,
+				.backend = &dragon_backend_tbb },
+		{ .name = "pthread-binned",
+				.lib = THREAD_LIB_PTHREAD,
+				.draw_handler = dragon_draw_pthread_binned,
+				.limits_handler = dragon_limits_pthread,
+				.backend = &dragon_backend_pthread_binned },
+		{ .name = "tbb-binned",
+				.lib = THREAD_LIB_TBB,
+				.draw_handler = dragon_draw_tbb_binned,
+				.limits_handler = dragon_limits_tbb,
+				.backend = &dragon_backend_tbb_binned },
 		{ .name = NULL,
 				.lib = THREAD_LIB_NONE,
 				.draw_handler = NULL,
-				.limits_handler = NULL },
+				.limits_handler = NULL,
+				.backend = NULL },
 };
 
 typedef int (*cmd_handler)(struct command_opts*);
@@ -107,26 +151,262 @@ static void usage(void)
 	fprintf(stderr, "Usage: " PROGNAME " [OPTIONS] [COMMAND]\n");
 	fprintf(stderr, "\nOptions:\n");
 	fprintf(stderr, "  --help	this help\n");
-	fprintf(stderr, "  --cmd		command [ draw | limits | check ]\n");
+	fprintf(stderr, "  --cmd		command [ draw | limits | check | animate | scaling ]\n");
 	fprintf(stderr, "  --thread	set number of threads\n");
 	fprintf(stderr, "  --lib		set the threading library to use "\
-			"[ serial | pthread | tbb ]\n");
-	fprintf(stderr, "  --output set image path output\n");
+			"[ serial | pthread | tbb | pthread-binned | tbb-binned ]\n");
+	fprintf(stderr, "  --output set image path output, a %%d is replaced by the power of a sweep\n");
 	fprintf(stderr, "  --height	set dragon height\n");
 	fprintf(stderr, "  --width	set dragon width\n");
 	fprintf(stderr, "  --size	set dragon size\n");
 	fprintf(stderr, "  --power  set dragon size by power\n");
 	fprintf(stderr, "  --max    compute all dragon to max power\n");
+	fprintf(stderr, "  --perf   report hardware counters per stage and thread\n");
+	fprintf(stderr, "  --trace  write a Chrome trace-event timeline to file\n");
+	fprintf(stderr, "  --metrics  periodically write progress metrics (Prometheus format) to file\n");
+	fprintf(stderr, "  --metrics-interval  metrics refresh period in ms\n");
+	fprintf(stderr, "  --hugetlb  back large buffers with explicit huge pages\n");
+	fprintf(stderr, "  --serve  run jobs sent on this Unix socket, --thread is the thread budget\n");
+	fprintf(stderr, "  --batch  run the jobs of this file (one job per line) on --thread threads\n");
+	fprintf(stderr, "  --viewport  draw only the window x0,y0,x1,y1, in fractions of the dragon\n");
+	fprintf(stderr, "  --preview  fast preview from the fill counts of a NxN grid over the blocks (N <= %d),\n",
+			PREVIEW_LOD_MAX);
+	fprintf(stderr, "            its time grows with N: at power 26, N=16 costs about 6x N=4,\n");
+	fprintf(stderr, "            the mean, p99 and max of the color error bound are printed\n");
+	fprintf(stderr, "  --frames  number of frames of animate, written as YUV4MPEG2 to --output (- for stdout)\n");
+	fprintf(stderr, "  --packed draw on a canvas of two cells per byte, at most %d threads\n", PACKED_COLORS);
+	fprintf(stderr, "  --mem-budget  bytes (K, M or G suffix) of the draw: full, packed, banded or accum canvas\n");
+	fprintf(stderr, "  --deadline  ms of the draw, the size is reduced to end in time\n");
+	fprintf(stderr, "  --auto   pick lib, threads and split per size from this profile, calibrated if missing\n");
+	fprintf(stderr, "  --cache  keep limits, canvases and images in this directory\n");
+	fprintf(stderr, "  --submit send the jobs read on stdin to the server on this socket\n");
 	fprintf(stderr, "\n");
 	exit(EXIT_FAILURE);
 }
 
+static void expect_draw(struct command_opts *opts, uint64_t size)
+{
+	progress_expect(PROGRESS_SEGMENTS_LIMITED, size);
+	progress_expect(PROGRESS_SEGMENTS_DRAWN, size);
+	progress_expect(PROGRESS_ROWS_RENDERED, opts->height);
+	progress_expect(PROGRESS_RENDERS, 1);
+}
+
+static int limits_cached(struct dragon_ctx *ctx, uint64_t size, limits_t *limits)
+{
+	if (cache.dir != NULL && cache_get_limits(&cache, size, limits) == 0)
+		return 0;
+	if (dragon_ctx_limits(ctx, limits, size) < 0)
+		return -1;
+	if (cache.dir != NULL)
+		cache_put_limits(&cache, size, limits);
+	return 0;
+}
+
+/* only scale_dragon is left to do with a cached canvas */
+static int render_cached(struct cache_canvas *canvas, int nb_thread, struct rgb *img, int width, int height)
+{
+	struct palette *palette;
+	struct perf_sample ps;
+
+	if ((palette = cache_palette(canvas, nb_thread)) == NULL)
+		return -1;
+	trace_begin("render");
+	perf_stage_begin(&ps);
+	scale_dragon(0, height, img, width, height, canvas->dragon, canvas->width, canvas->height, palette);
+	perf_stage_end(&ps, PERF_STAGE_RENDER, 0);
+	trace_end("render");
+	free_palette(palette);
+	return 0;
+}
+
+/*
+ * Draw through the cache: a cached image is read back, a cached canvas
+ * is only rendered again, and the limits, canvas and image of a full
+ * render are stored. *dragon is NULL unless the canvas was drawn.
+ */
+static int draw_cached(struct dragon_ctx *ctx, uint64_t size, struct rgb *img, int width, int height,
+		char **dragon)
+{
+	const char *lib = ctx->backend->name;
+	int nb_color = ctx->nb_color;
+	struct cache_canvas canvas;
+	limits_t limits;
+	int ret;
+
+	*dragon = NULL;
+	/* the cached canvases are not packed */
+	if (cache.dir == NULL || ctx->packed)
+		return dragon_ctx_draw(ctx, dragon, img, width, height, size);
+
+	if (cache_get_image(&cache, size, lib, nb_color, img, width, height) == 0)
+		return 0;
+
+	if (cache_get_canvas(&cache, size, lib, nb_color, &canvas) == 0) {
+		ret = render_cached(&canvas, nb_color, img, width, height);
+		cache_release_canvas(&canvas);
+	} else {
+		ret = dragon_ctx_draw(ctx, dragon, img, width, height, size);
+		if (ret == 0 && limits_cached(ctx, size, &limits) == 0)
+			cache_put_canvas(&cache, size, lib, nb_color, *dragon,
+					limits.maximums.x - limits.minimums.x,
+					limits.maximums.y - limits.minimums.y);
+	}
+	if (ret == 0)
+		cache_put_image(&cache, size, lib, nb_color, img, width, height);
+	return ret;
+}
+
+/*
+ * With --auto, ctx becomes the one of the profile for size: the profile
+ * picks the backend and the workers, the colors stay the ones of --thread.
+ */
+static int auto_ctx(struct command_opts *opts, struct dragon_ctx *ctx, uint64_t size)
+{
+	const struct tune_entry *e;
+
+	if (opts->auto_path == NULL)
+		return 0;
+	e = tune_pick(&tune_profile, size);
+	if (ctx->backend != e->backend || ctx->nb_thread != e->nb_thread) {
+		dragon_ctx_release(ctx);
+		if (dragon_ctx_init_colors(ctx, e->backend, e->nb_thread, opts->nb_thread, &dragon_arena) < 0)
+			return -1;
+		ctx->packed = opts->packed;
+	}
+	memcpy(ctx->split, e->split, sizeof(ctx->split));
+	if (opts->verbose)
+		printf("auto size=%"PRIu64" lib=%s thread=%d split=%d,%d,%d\n", size, e->backend->name,
+				e->nb_thread, e->split[PERF_STAGE_LIMITS], e->split[PERF_STAGE_DRAW],
+				e->split[PERF_STAGE_RENDER]);
+	return 0;
+}
+
+/* the profile of --auto, calibrated when it is missing or does not match this machine */
+static int auto_profile(struct command_opts *opts)
+{
+	const struct dragon_backend *backends[sizeof(libs) / sizeof(libs[0])];
+	int i;
+
+	for (i = 0; libs[i].backend != NULL; i++)
+		backends[i] = libs[i].backend;
+	backends[i] = NULL;
+	if (tune_load(&tune_profile, opts->auto_path, backends) == 0 &&
+			tune_profile.nb_cpu == tune_cpus() &&
+			tune_profile.width == opts->width && tune_profile.height == opts->height)
+		return 0;
+	printf("calibrating %d processors to %s\n", tune_cpus(), opts->auto_path);
+	if (tune_calibrate(&tune_profile, backends, opts->width, opts->height, opts->verbose) < 0)
+		return -1;
+	return tune_save(&tune_profile, opts->auto_path);
+}
+
+/*
+ * The fastest strategy whose footprint fits the budget, the plan is
+ * reported. *dragon is NULL unless a whole canvas was drawn.
+ */
+static int draw_planned(struct command_opts *opts, struct dragon_ctx *ctx, uint64_t size, uint64_t budget,
+		struct rgb *img, char **dragon)
+{
+	struct dragon_plan plan;
+
+	*dragon = NULL;
+	if (plan_choose(&plan, budget, size, opts->width, opts->height, ctx->nb_color, opts->packed) < 0) {
+		plan_report(&plan, stdout);
+		printf("Error: no strategy fits in %" PRIu64 " bytes\n", budget);
+		return -1;
+	}
+	plan_report(&plan, stdout);
+	switch (plan.strategy) {
+	case PLAN_FULL:
+	case PLAN_PACKED:
+		ctx->packed = plan.strategy == PLAN_PACKED;
+		return draw_cached(ctx, size, img, opts->width, opts->height, dragon);
+	case PLAN_ACCUM:
+		return dragon_draw_accum(img, opts->width, opts->height, size, ctx->nb_color);
+	default:
+		return dragon_draw_banded(img, opts->width, opts->height, size, ctx->nb_color, plan.band_rows);
+	}
+}
+
+/* with --deadline, the largest size predicted in time, the size delivered is reported */
+static int draw_deadline(struct command_opts *opts, struct dragon_ctx *ctx, uint64_t size, struct rgb *img,
+		char **dragon)
+{
+	struct deadline_result res;
+	int ret;
+
+	ret = dragon_draw_deadline(ctx, &deadline_rates, dragon, img, opts->width, opts->height, size,
+			opts->deadline, &res);
+	if (ret < 0) {
+		printf("Error: no size of the dragon fits in %d ms\n", opts->deadline);
+		return -1;
+	}
+	printf("deadline %d ms: delivered size=%" PRIu64 " requested=%" PRIu64 " target=%" PRIu64
+			" fallback=%" PRIu64 " predicted=%.1f ms elapsed=%.1f ms\n", opts->deadline, res.size,
+			res.requested, res.target, res.fallback, res.predicted_ms, res.elapsed_ms);
+	return 0;
+}
+
+static int draw_one(struct command_opts *opts, struct dragon_ctx *ctx, uint64_t size, struct rgb *img,
+		char **dragon)
+{
+	struct viewport_cells cells;
+	struct preview_error error;
+	int ret;
+
+	if (auto_ctx(opts, ctx, size) < 0)
+		return -1;
+	if (opts->preview > 0) {
+		ret = dragon_draw_preview(img, opts->width, opts->height, size, opts->nb_thread,
+				opts->preview, &error);
+		if (ret == 0)
+			printf("preview color error mean=%.2f p99=%d max=%d\n", error.mean, error.p99,
+					error.max);
+		return ret;
+	}
+	if (opts->has_viewport) {
+		ret = dragon_draw_viewport(dragon, img, opts->width, opts->height, size,
+				opts->nb_thread, &opts->viewport, &cells);
+		if (ret == 0 && opts->verbose)
+			printf("viewport cells [%" PRId64 ", %" PRId64 ") x [%" PRId64 ", %" PRId64 ")\n",
+					cells.j0, cells.j1, cells.i0, cells.i1);
+		return ret;
+	}
+	if (opts->deadline > 0)
+		return draw_deadline(opts, ctx, size, img, dragon);
+	if (opts->mem_budget > 0)
+		return draw_planned(opts, ctx, size, opts->mem_budget, img, dragon);
+	return draw_cached(ctx, size, img, opts->width, opts->height, dragon);
+}
+
+/* output of the power i of a sweep: the first %d of the path is replaced by i */
+static int sweep_path(const char *path, int i, char **out)
+{
+	const char *mark = strstr(path, "%d");
+
+	if (mark == NULL)
+		return asprintf(out, "%s", path);
+	return asprintf(out, "%.*s%d%s", (int) (mark - path), path, i, mark + 2);
+}
+
 static int cmd_draw(struct command_opts *opts)
 {
+	struct img_writer writer;
+	struct dragon_ctx ctx;
 	char *dragon = NULL;
+	char *path = NULL;
 	struct rgb *img;
 	int ret = 0;
 
+	/* one context for the sweep, its workers and palette are kept from one power to the next */
+	if (dragon_ctx_init(&ctx, opts->lib->backend, opts->nb_thread, &dragon_arena) < 0)
+		return -1;
+	ctx.packed = opts->packed;
+	if (writer_start(&writer) < 0) {
+		dragon_ctx_release(&ctx);
+		return -1;
+	}
 	img = make_canvas(opts->width, opts->height);
 	if (img == NULL)
 		goto err;
@@ -137,22 +417,40 @@ static int cmd_draw(struct command_opts *opts)
 	case THREAD_LIB_TBB:
 		if (opts->power > 0 && opts->power_max > 0) {
 			int i;
+			for (i = opts->power; i <= opts->power_max; i++)
+				expect_draw(opts, 1LL << i);
 			for (i = opts->power; i <= opts->power_max; i++) {
 				uint64_t size = 1LL << i;
 				if (opts->verbose)
 					printf("draw size=%"PRId64"\n", size);
-				ret = opts->lib->draw_handler(&dragon, img, opts->width, opts->height,
-						size, opts->nb_thread);
+				ret = draw_one(opts, &ctx, size, img, &dragon);
 				if (i != opts->power_max)
-					FREE(dragon);
+					ARENA_FREE(dragon);
 				if (ret < 0)
 					break;
+				progress_add(PROGRESS_RENDERS, 1);
+				/* each power of the sweep has its own image with a %d in the path */
+				if (i != opts->power_max && strstr(opts->pgm_path, "%d") != NULL) {
+					if (sweep_path(opts->pgm_path, i, &path) < 0)
+						goto err;
+					progress_expect(PROGRESS_BYTES_WRITTEN,
+							sizeof(struct rgb) * opts->width * opts->height);
+					ret = writer_submit(&writer, img, path, opts->width, opts->height);
+					img = NULL;
+					FREE(path);
+					if (ret < 0)
+						goto err;
+					if ((img = writer_buffer(&writer, opts->width, opts->height)) == NULL)
+						goto err;
+				}
 			}
 		} else {
+			expect_draw(opts, opts->size);
 			if (opts->verbose)
 				printf("draw size=%"PRId64"\n", opts->size);
-			ret = opts->lib->draw_handler(&dragon, img, opts->width, opts->height, opts->size,
-				opts->nb_thread);
+			ret = draw_one(opts, &ctx, opts->size, img, &dragon);
+			if (ret == 0)
+				progress_add(PROGRESS_RENDERS, 1);
 		}
 		break;
 	case THREAD_LIB_NONE:
@@ -163,10 +461,18 @@ static int cmd_draw(struct command_opts *opts)
 	if (ret < 0)
 		goto err;
 
-	write_img(img, opts->pgm_path, opts->width, opts->height);
+	if (sweep_path(opts->pgm_path, opts->power_max > 0 ? opts->power_max : opts->power, &path) < 0)
+		goto err;
+	progress_expect(PROGRESS_BYTES_WRITTEN, sizeof(struct rgb) * opts->width * opts->height);
+	ret = writer_submit(&writer, img, path, opts->width, opts->height);
+	img = NULL;
 done:
-	FREE(dragon);
-	FREE(img);
+	if (writer_finish(&writer) < 0)
+		ret = -1;
+	FREE(path);
+	ARENA_FREE(dragon);
+	ARENA_FREE(img);
+	dragon_ctx_release(&ctx);
 	return ret;
 err:
 	ret = -1;
@@ -178,28 +484,39 @@ static const struct command_def cmd_draw_def =
 
 static int cmd_limits(struct command_opts *opts)
 {
+	struct dragon_ctx ctx;
 	int ret = 0;
 	limits_t limits;
 	memset(&limits, 0, sizeof(limits_t));
 
+	if (dragon_ctx_init(&ctx, opts->lib->backend, opts->nb_thread, &dragon_arena) < 0)
+		return -1;
+
 	switch (opts->lib->lib) {
 	case THREAD_LIB_SERIAL:
 	case THREAD_LIB_PTHREAD:
 	case THREAD_LIB_TBB:
 		if (opts->power > 0 && opts->power_max > 0) {
 			int i;
+			for (i = opts->power; i <= opts->power_max; i++)
+				progress_expect(PROGRESS_SEGMENTS_LIMITED, 1LL << i);
 			for (i = opts->power; i <= opts->power_max; i++) {
 				uint64_t size = 1LL << i;
 				if (opts->verbose)
 					printf("limits size=%"PRId64"\n", size);
-				ret = opts->lib->limits_handler(&limits, size, opts->nb_thread);
+				if ((ret = auto_ctx(opts, &ctx, size)) < 0)
+					break;
+				ret = limits_cached(&ctx, size, &limits);
 				if (ret < 0)
 					break;
 			}
 		} else {
+			progress_expect(PROGRESS_SEGMENTS_LIMITED, opts->size);
 			if (opts->verbose)
 				printf("limits size=%"PRId64"\n", opts->size);
-			ret = opts->lib->limits_handler(&limits, opts->size, opts->nb_thread);
+			ret = auto_ctx(opts, &ctx, opts->size);
+			if (ret == 0)
+				ret = limits_cached(&ctx, opts->size, &limits);
 		}
 		break;
 	case THREAD_LIB_NONE:
@@ -212,6 +529,7 @@ static int cmd_limits(struct command_opts *opts)
 
 	dump_limits(&limits);
 done:
+	dragon_ctx_release(&ctx);
 	return ret;
 err:
 	ret = -1;
@@ -221,6 +539,54 @@ err:
 static const struct command_def cmd_limit_def =
 { .name = "limits", .handler = cmd_limits };
 
+static int cmd_animate(struct command_opts *opts)
+{
+	struct rgb *img = NULL;
+	FILE *out = stdout;
+	int ret = 0;
+
+	if (strcmp(opts->pgm_path, ANIMATE_STDOUT) != 0 &&
+			(out = fopen(opts->pgm_path, "w")) == NULL) {
+		printf("Error: cannot open %s\n", opts->pgm_path);
+		goto err;
+	}
+	if ((img = make_canvas(opts->width, opts->height)) == NULL)
+		goto err;
+	progress_expect(PROGRESS_SEGMENTS_DRAWN, opts->size);
+	progress_expect(PROGRESS_RENDERS, opts->frames);
+	progress_expect(PROGRESS_BYTES_WRITTEN, 3ULL * opts->width * opts->height * opts->frames);
+	ret = dragon_animate(out, img, opts->width, opts->height, opts->size, opts->nb_thread,
+			opts->frames);
+done:
+	if (out != NULL && out != stdout)
+		fclose(out);
+	ARENA_FREE(img);
+	return ret;
+err:
+	ret = -1;
+	goto done;
+}
+
+static const struct command_def cmd_animate_def =
+{ .name = "animate", .handler = cmd_animate };
+
+/* the parallel libraries of --lib (all for serial), up to --thread threads, at --size and growing to it */
+static int cmd_scaling(struct command_opts *opts)
+{
+	const struct dragon_backend *backends[sizeof(libs) / sizeof(libs[0])];
+	int i, n = 0;
+
+	for (i = 1; libs[i].backend != NULL; i++) {
+		if (opts->lib->lib == THREAD_LIB_SERIAL || libs[i].lib == opts->lib->lib)
+			backends[n++] = libs[i].backend;
+	}
+	backends[n] = NULL;
+	return scaling_run(stdout, backends, opts->width, opts->height, opts->size, opts->nb_thread);
+}
+
+static const struct command_def cmd_scaling_def =
+{ .name = "scaling", .handler = cmd_scaling };
+
 static int check_limits(struct command_opts *opts)
 {
 	int ret = 0;
@@ -266,6 +632,8 @@ static int check_draw(struct command_opts *opts)
 	char *drg_exp = NULL, *drg_act = NULL;
 	struct rgb *img_exp = NULL, *img_act = NULL;
 	char *f1 = NULL, *f2 = NULL;
+	struct img_writer writer;
+	int dumping = 0;
 
 	uint64_t min_size = 1LL << CHECK_POWER;
 	if (opts->size < min_size && opts->nb_thread < CHECK_NB_THREAD)
@@ -292,9 +660,11 @@ static int check_draw(struct command_opts *opts)
 		goto err;
 	}
 
-	char *fmt = "%s %10s %10s threshold=%d gap=%d (%.8f%%)\n";
+	/* the image too, so that a lib leaving rows unwritten fails */
+	char *fmt = "%s %10s %10s threshold=%d gap=%d (%.8f%%) image=%s\n";
 	for (i = 1; libs[i].lib != THREAD_LIB_NONE; i++) {
 		const char *name = libs[i].name;
+		memset(img_act, 0, sizeof(struct rgb) * opts->width * opts->height);
 		ret = libs[i].draw_handler(&drg_act, img_act, opts->width, opts->height, opts->size, opts->nb_thread);
 		if (ret < 0) {
 			printf("Error executing draw with %s\n", name);
@@ -302,32 +672,51 @@ static int check_draw(struct command_opts *opts)
 		}
 		int gap = cmp_canvas(drg_exp, drg_act, dragon_width, dragon_height, opts->verbose);
 		float gap_f = gap * 100 / ((float) area);
-		if (gap < threshold && gap >= 0) {
-			printf(fmt, "PASS", "draw", name, threshold, gap, gap_f);
+		int same = memcmp(img_exp, img_act, sizeof(struct rgb) * opts->width * opts->height) == 0;
+		if (gap < threshold && gap >= 0 && same) {
+			printf(fmt, "PASS", "draw", name, threshold, gap, gap_f, "same");
 		} else {
 			errors++;
-			printf(fmt, "FAIL", "draw", name, threshold, gap, gap_f);
-			if (asprintf(&f1, "dragon_check_failed_serial.ppm") < 0)
-				goto err;
+			printf(fmt, "FAIL", "draw", name, threshold, gap, gap_f, same ? "same" : "differs");
+			/* the images are written in the background, the checks go on */
+			if (!dumping) {
+				struct rgb *copy;
+				if (writer_start(&writer) < 0)
+					goto err;
+				dumping = 1;
+				if (asprintf(&f1, "dragon_check_failed_serial.ppm") < 0)
+					goto err;
+				/* a copy, the next libs are compared with img_exp */
+				if ((copy = writer_buffer(&writer, opts->width, opts->height)) == NULL)
+					goto err;
+				memcpy(copy, img_exp, sizeof(struct rgb) * opts->width * opts->height);
+				ret = writer_submit(&writer, copy, f1, opts->width, opts->height);
+				if (ret < 0)
+					goto err;
+				printf("expected: %s\n", f1);
+				FREE(f1);
+			}
 			if (asprintf(&f2, "dragon_check_failed_%s.ppm", name) < 0)
 				goto err;
-			if (write_img(img_exp, f1, opts->width, opts->height) < 0)
+			ret = writer_submit(&writer, img_act, f2, opts->width, opts->height);
+			img_act = NULL;
+			if (ret < 0)
 				goto err;
-			if (write_img(img_act, f2, opts->width, opts->height) < 0)
+			if ((img_act = writer_buffer(&writer, opts->width, opts->height)) == NULL)
 				goto err;
-			printf("expected: %s\n", f1);
 			printf("actual  : %s\n", f2);
-			FREE(f1);
 			FREE(f2);
 		}
-		FREE(drg_act);
+		ARENA_FREE(drg_act);
 	}
 
 done:
-	FREE(img_exp);
-	FREE(img_act);
-	FREE(drg_exp);
-	FREE(drg_act);
+	if (dumping && writer_finish(&writer) < 0)
+		errors++;
+	ARENA_FREE(img_exp);
+	ARENA_FREE(img_act);
+	ARENA_FREE(drg_exp);
+	ARENA_FREE(drg_act);
 	FREE(f1);
 	FREE(f2);
 	if (errors != 0)
@@ -338,6 +727,520 @@ err:
 	goto done;
 }
 
+/* the limits from the block hierarchy, and a window compared to the crop of the serial canvas */
+static int check_viewport(struct command_opts *opts)
+{
+	struct dragon_viewport vp = { .x0 = 0.2, .y0 = 0.3, .x1 = 0.7, .y1 = 0.6 };
+	struct viewport_cells cells;
+	limits_t lim_expected, lim_actual;
+	char *drg_exp = NULL, *drg_act = NULL;
+	struct rgb *img = NULL;
+	int dragon_width, width, height;
+	int i, j, gap = 0;
+	int ret = 0;
+
+	if (dragon_limits_serial(&lim_expected, opts->size, opts->nb_thread) < 0 ||
+			dragon_limits_blocks(&lim_actual, opts->size, opts->nb_thread) < 0)
+		goto err;
+	if (cmp_limits(&lim_expected, &lim_actual) == 0) {
+		printf("PASS %10s %10s\n", "limits", "blocks");
+	} else {
+		ret = -1;
+		printf("FAIL %10s %10s\n", "limits", "blocks");
+	}
+
+	if ((img = make_canvas(opts->width, opts->height)) == NULL)
+		goto err;
+	if (dragon_draw_serial(&drg_exp, img, opts->width, opts->height, opts->size, opts->nb_thread) < 0)
+		goto err;
+	if (dragon_draw_viewport(&drg_act, img, opts->width, opts->height, opts->size,
+			opts->nb_thread, &vp, &cells) < 0)
+		goto err;
+	dragon_width = lim_expected.maximums.x - lim_expected.minimums.x;
+	width = cells.j1 - cells.j0;
+	height = cells.i1 - cells.i0;
+	for (i = 0; i < height; i++) {
+		for (j = 0; j < width; j++) {
+			if (drg_act[i * width + j] !=
+					drg_exp[(i + cells.i0) * dragon_width + j + cells.j0])
+				gap++;
+		}
+	}
+	if (gap == 0) {
+		printf("PASS %10s %10s gap=%d\n", "draw", "viewport", gap);
+	} else {
+		ret = -1;
+		printf("FAIL %10s %10s gap=%d\n", "draw", "viewport", gap);
+	}
+done:
+	ARENA_FREE(drg_exp);
+	ARENA_FREE(drg_act);
+	ARENA_FREE(img);
+	return ret;
+err:
+	printf("Error executing viewport check\n");
+	ret = -1;
+	goto done;
+}
+
+/*
+ * The preview against the image of dragon_draw_serial: the error of the
+ * pixels is within the max of their bounds, and so is their mean.
+ */
+static int check_preview(struct command_opts *opts)
+{
+	struct rgb *img_exp = NULL, *img_act = NULL;
+	struct preview_error bound;
+	char *dragon = NULL;
+	int i, diff, err = 0;
+	uint64_t total = 0;
+	double mean;
+	int ret = 0;
+
+	if ((img_exp = make_canvas(opts->width, opts->height)) == NULL ||
+			(img_act = make_canvas(opts->width, opts->height)) == NULL)
+		goto err;
+	if (dragon_draw_serial(&dragon, img_exp, opts->width, opts->height, opts->size, opts->nb_thread) < 0)
+		goto err;
+	if (dragon_draw_preview(img_act, opts->width, opts->height, opts->size, opts->nb_thread,
+			PREVIEW_LOD, &bound) < 0)
+		goto err;
+	for (i = 0; i < opts->width * opts->height; i++) {
+		diff = abs(img_exp[i].r - img_act[i].r);
+		if (abs(img_exp[i].g - img_act[i].g) > diff)
+			diff = abs(img_exp[i].g - img_act[i].g);
+		if (abs(img_exp[i].b - img_act[i].b) > diff)
+			diff = abs(img_exp[i].b - img_act[i].b);
+		if (diff > err)
+			err = diff;
+		total += diff;
+	}
+	mean = (double) total / (opts->width * opts->height);
+	if (err <= bound.max && mean <= bound.mean) {
+		printf("PASS %10s %10s err=%d mean=%.2f bound=%d mean=%.2f\n", "draw", "preview", err, mean,
+				bound.max, bound.mean);
+	} else {
+		ret = -1;
+		printf("FAIL %10s %10s err=%d mean=%.2f bound=%d mean=%.2f\n", "draw", "preview", err, mean,
+				bound.max, bound.mean);
+	}
+done:
+	ARENA_FREE(dragon);
+	ARENA_FREE(img_exp);
+	ARENA_FREE(img_act);
+	return ret;
+err:
+	printf("Error executing preview check\n");
+	ret = -1;
+	goto done;
+}
+
+/* the last frame of the animation against the image of dragon_draw_serial */
+static int check_animate(struct command_opts *opts)
+{
+	struct rgb *img_exp = NULL, *img_act = NULL;
+	char *dragon = NULL;
+	FILE *out = NULL;
+	int ret = 0;
+
+	if ((img_exp = make_canvas(opts->width, opts->height)) == NULL ||
+			(img_act = make_canvas(opts->width, opts->height)) == NULL)
+		goto err;
+	if ((out = fopen("/dev/null", "w")) == NULL)
+		goto err;
+	if (dragon_draw_serial(&dragon, img_exp, opts->width, opts->height, opts->size, opts->nb_thread) < 0)
+		goto err;
+	if (dragon_animate(out, img_act, opts->width, opts->height, opts->size, opts->nb_thread,
+			ANIMATE_FRAMES) < 0)
+		goto err;
+	if (memcmp(img_exp, img_act, sizeof(struct rgb) * opts->width * opts->height) == 0) {
+		printf("PASS %10s %10s\n", "draw", "animate");
+	} else {
+		ret = -1;
+		printf("FAIL %10s %10s\n", "draw", "animate");
+	}
+done:
+	if (out != NULL)
+		fclose(out);
+	ARENA_FREE(dragon);
+	ARENA_FREE(img_exp);
+	ARENA_FREE(img_act);
+	return ret;
+err:
+	printf("Error executing animate check\n");
+	ret = -1;
+	goto done;
+}
+
+/* each library on a packed canvas, against the serial canvas and image */
+static int check_packed(struct command_opts *opts)
+{
+	struct dragon_ctx ctx;
+	struct rgb *img_exp = NULL, *img_act = NULL;
+	char *drg_exp = NULL, *drg_act = NULL;
+	int nb_thread = opts->nb_thread < PACKED_COLORS ? opts->nb_thread : PACKED_COLORS;
+	limits_t limits;
+	int ret = 0;
+	int i;
+
+	if (dragon_limits_serial(&limits, opts->size, nb_thread) < 0)
+		goto err;
+	if ((img_exp = make_canvas(opts->width, opts->height)) == NULL ||
+			(img_act = make_canvas(opts->width, opts->height)) == NULL)
+		goto err;
+	if (dragon_draw_serial(&drg_exp, img_exp, opts->width, opts->height, opts->size, nb_thread) < 0)
+		goto err;
+
+	for (i = 0; libs[i].lib != THREAD_LIB_NONE; i++) {
+		const char *name = libs[i].name;
+		int gap = -1;
+
+		if (dragon_ctx_init(&ctx, libs[i].backend, nb_thread, &dragon_arena) < 0)
+			goto err;
+		ctx.packed = 1;
+		/* no pixel left from the lib before */
+		memset(img_act, 0, sizeof(struct rgb) * opts->width * opts->height);
+		if (dragon_ctx_draw(&ctx, &drg_act, img_act, opts->width, opts->height, opts->size) == 0)
+			gap = cmp_canvas_packed(drg_exp, 0, drg_act, 1, limits.maximums.x - limits.minimums.x,
+					limits.maximums.y - limits.minimums.y, opts->verbose);
+		dragon_ctx_release(&ctx);
+		if (gap == 0 && memcmp(img_exp, img_act, sizeof(struct rgb) * opts->width * opts->height) == 0) {
+			printf("PASS %10s %10s\n", "packed", name);
+		} else {
+			ret = -1;
+			printf("FAIL %10s %10s gap=%d\n", "packed", name, gap);
+		}
+		ARENA_FREE(drg_act);
+	}
+done:
+	ARENA_FREE(drg_exp);
+	ARENA_FREE(drg_act);
+	ARENA_FREE(img_exp);
+	ARENA_FREE(img_act);
+	return ret;
+err:
+	printf("Error executing packed check\n");
+	ret = -1;
+	goto done;
+}
+
+/*
+ * The colors do not depend on the workers: fewer and more workers than
+ * colors draw the canvas of the serial backend, up to the cells drawn
+ * twice that check_draw lets through.
+ */
+static int check_colors(struct command_opts *opts)
+{
+	struct dragon_ctx ctx;
+	struct rgb *img = NULL;
+	char *drg_exp = NULL, *drg_act = NULL;
+	int workers[2] = { (opts->nb_thread + 1) / 2, opts->nb_thread * 2 };
+	int threshold = opts->nb_thread * 2;
+	limits_t limits;
+	int ret = 0;
+	int i, w;
+
+	if (dragon_limits_serial(&limits, opts->size, opts->nb_thread) < 0)
+		goto err;
+	if ((img = make_canvas(opts->width, opts->height)) == NULL)
+		goto err;
+	if (dragon_draw_serial(&drg_exp, img, opts->width, opts->height, opts->size, opts->nb_thread) < 0)
+		goto err;
+
+	for (i = 1; libs[i].lib != THREAD_LIB_NONE; i++) {
+		for (w = 0; w < 2; w++) {
+			const char *name = libs[i].name;
+			int gap = -1;
+
+			if (dragon_ctx_init_colors(&ctx, libs[i].backend, workers[w], opts->nb_thread,
+					&dragon_arena) < 0)
+				goto err;
+			if (dragon_ctx_draw(&ctx, &drg_act, img, opts->width, opts->height, opts->size) == 0)
+				gap = cmp_canvas(drg_exp, drg_act, limits.maximums.x - limits.minimums.x,
+						limits.maximums.y - limits.minimums.y, opts->verbose);
+			dragon_ctx_release(&ctx);
+			if (gap >= 0 && gap < threshold) {
+				printf("PASS %10s %10s workers=%d\n", "colors", name, workers[w]);
+			} else {
+				ret = -1;
+				printf("FAIL %10s %10s workers=%d gap=%d\n", "colors", name, workers[w], gap);
+			}
+			ARENA_FREE(drg_act);
+		}
+	}
+done:
+	ARENA_FREE(drg_exp);
+	ARENA_FREE(drg_act);
+	ARENA_FREE(img);
+	return ret;
+err:
+	printf("Error executing colors check\n");
+	ret = -1;
+	goto done;
+}
+
+/*
+ * A target predicted by rates DEADLINE_CHECK_SPEEDUP times too fast runs
+ * over a deadline of half its time: it is cancelled and the fallback, in
+ * time even at the real rates, is delivered within the deadline with the
+ * image of its size.
+ */
+#define DEADLINE_CHECK_SPEEDUP	4
+#define DEADLINE_CHECK_POWER	22
+
+static int check_deadline(struct command_opts *opts)
+{
+	struct deadline_rates rates;
+	struct deadline_result res;
+	struct dragon_ctx ctx;
+	struct rgb *img_exp = NULL, *img_act = NULL;
+	char *drg_exp = NULL, *drg_act = NULL;
+	uint64_t size = opts->size > (1ULL << DEADLINE_CHECK_POWER) ? opts->size : 1ULL << DEADLINE_CHECK_POWER;
+	/* more workers than processors wake the caller late by their time slices */
+	int nb_thread = opts->nb_thread < tune_cpus() ? opts->nb_thread : tune_cpus();
+	double deadline_ms;
+	int ret = 0;
+
+	if (deadline_calibrate(&rates) < 0)
+		goto err;
+	if (dragon_ctx_init(&ctx, &dragon_backend_pthread, nb_thread, &dragon_arena) < 0)
+		goto err;
+	deadline_ms = deadline_predict(&rates, size, opts->width, opts->height, nb_thread) / 2;
+	rates.limits_ns /= DEADLINE_CHECK_SPEEDUP;
+	rates.draw_ns /= DEADLINE_CHECK_SPEEDUP;
+	rates.render_ns /= DEADLINE_CHECK_SPEEDUP;
+	if ((img_exp = make_canvas(opts->width, opts->height)) == NULL ||
+			(img_act = make_canvas(opts->width, opts->height)) == NULL)
+		goto err_ctx;
+	/* a first render measures the latency of the cancel */
+	if (dragon_draw_deadline(&ctx, &rates, &drg_act, img_act, opts->width, opts->height, size,
+			deadline_ms, &res) < 0)
+		goto err_ctx;
+	ARENA_FREE(drg_act);
+	memset(img_act, 0, sizeof(struct rgb) * opts->width * opts->height);
+	if (dragon_draw_deadline(&ctx, &rates, &drg_act, img_act, opts->width, opts->height, size,
+			deadline_ms, &res) < 0)
+		goto err_ctx;
+	if (res.size == 0 || dragon_ctx_draw(&ctx, &drg_exp, img_exp, opts->width, opts->height, res.size) < 0)
+		goto err_ctx;
+	dragon_ctx_release(&ctx);
+	if (res.size == res.fallback && res.size < res.target && res.elapsed_ms <= deadline_ms &&
+			memcmp(img_exp, img_act, sizeof(struct rgb) * opts->width * opts->height) == 0) {
+		printf("PASS %10s %10s size=%"PRIu64" target=%"PRIu64" deadline=%.1f elapsed=%.1f\n",
+				"deadline", "fallback", res.size, res.target, deadline_ms, res.elapsed_ms);
+	} else {
+		ret = -1;
+		printf("FAIL %10s %10s size=%"PRIu64" target=%"PRIu64" deadline=%.1f elapsed=%.1f\n",
+				"deadline", "fallback", res.size, res.target, deadline_ms, res.elapsed_ms);
+	}
+done:
+	ARENA_FREE(drg_exp);
+	ARENA_FREE(drg_act);
+	ARENA_FREE(img_exp);
+	ARENA_FREE(img_act);
+	return ret;
+err_ctx:
+	dragon_ctx_release(&ctx);
+err:
+	printf("Error executing deadline check\n");
+	ret = -1;
+	goto done;
+}
+
+/*
+ * Budgets picking each strategy of the planner, down to one that fits
+ * none: every plan draws the image of the serial canvas. A strategy whose
+ * smallest footprint is not below the ones of the strategies before it is
+ * never picked for this size, it is skipped.
+ */
+static int check_plan(struct command_opts *opts)
+{
+	struct command_opts plan_opts = *opts;
+	struct dragon_plan plan;
+	struct dragon_ctx ctx;
+	struct rgb *img_exp = NULL, *img_act = NULL;
+	char *drg_exp = NULL, *drg_act = NULL;
+	uint64_t image;
+	uint64_t bytes[PLAN_MAX];
+	uint64_t budgets[PLAN_MAX + 1];
+	uint64_t floor = UINT64_MAX;
+	int nb_thread = opts->nb_thread < PACKED_COLORS ? opts->nb_thread : PACKED_COLORS;
+	int ret = 0;
+	int i;
+
+	plan_opts.packed = 0;
+	plan_opts.width = plan_opts.height = 128;
+	image = sizeof(struct rgb) * (uint64_t) plan_opts.width * plan_opts.height;
+	/* the footprints, with the narrowest bands */
+	plan_choose(&plan, image + 1, opts->size, plan_opts.width, plan_opts.height, nb_thread, 0);
+	memcpy(bytes, plan.bytes, sizeof(bytes));
+	for (i = 0; i < PLAN_MAX; i++) {
+		budgets[i] = 0;
+		if (bytes[i] == 0 || bytes[i] >= floor)
+			continue;
+		/* the widest bands below the strategies before them */
+		budgets[i] = i == PLAN_BANDED ? floor - 1 : bytes[i];
+		floor = bytes[i];
+	}
+	/* less than the smallest footprint */
+	budgets[PLAN_MAX] = floor - 1;
+
+	if ((img_exp = make_canvas(plan_opts.width, plan_opts.height)) == NULL ||
+			(img_act = make_canvas(plan_opts.width, plan_opts.height)) == NULL)
+		goto err;
+	if (dragon_draw_serial(&drg_exp, img_exp, plan_opts.width, plan_opts.height, opts->size, nb_thread) < 0)
+		goto err;
+
+	for (i = 0; i <= PLAN_MAX; i++) {
+		int picked, drawn;
+
+		if (i < PLAN_MAX && budgets[i] == 0) {
+			printf("SKIP %10s %10s never picked\n", "plan", plan_name(i));
+			continue;
+		}
+		if (dragon_ctx_init(&ctx, &dragon_backend_pthread, nb_thread, &dragon_arena) < 0)
+			goto err;
+		picked = plan_choose(&plan, budgets[i], opts->size, plan_opts.width, plan_opts.height,
+				nb_thread, 0) == 0 ? plan.strategy : PLAN_MAX;
+		memset(img_act, 0, image);
+		drawn = draw_planned(&plan_opts, &ctx, opts->size, budgets[i], img_act, &drg_act);
+		dragon_ctx_release(&ctx);
+		ARENA_FREE(drg_act);
+		if (picked == i && (i == PLAN_MAX ? drawn < 0 :
+				drawn == 0 && memcmp(img_exp, img_act, image) == 0)) {
+			printf("PASS %10s %10s budget=%" PRIu64 "\n", "plan", plan_name(i), budgets[i]);
+		} else {
+			ret = -1;
+			printf("FAIL %10s %10s budget=%" PRIu64 " picked=%s\n", "plan", plan_name(i), budgets[i],
+					plan_name(picked));
+		}
+	}
+done:
+	ARENA_FREE(drg_exp);
+	ARENA_FREE(drg_act);
+	ARENA_FREE(img_exp);
+	ARENA_FREE(img_act);
+	return ret;
+err:
+	printf("Error executing plan check\n");
+	ret = -1;
+	goto done;
+}
+
+/* holds the workers at the first chunk of limits until the check has cancelled */
+struct check_cancel {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int reached;
+	int cancelled;
+};
+
+static void check_cancel_progress(void *arg, int counter, __attribute__((unused)) uint64_t done,
+		__attribute__((unused)) uint64_t total)
+{
+	struct check_cancel *cc = (struct check_cancel *) arg;
+
+	if (counter != PROGRESS_SEGMENTS_LIMITED)
+		return;
+	pthread_mutex_lock(&cc->lock);
+	cc->reached = 1;
+	pthread_cond_broadcast(&cc->cond);
+	while (!cc->cancelled)
+		pthread_cond_wait(&cc->cond, &cc->lock);
+	pthread_mutex_unlock(&cc->lock);
+}
+
+/*
+ * Each library renders in the background, compared to the serial canvas,
+ * then a render is cancelled during the limits: nothing is drawn after.
+ */
+static int check_async(struct command_opts *opts)
+{
+	struct check_cancel cc = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0 };
+	struct dragon_render *r = NULL;
+	struct dragon_ctx ctx;
+	enum dragon_render_state state;
+	struct rgb *img_exp = NULL, *img_act = NULL;
+	char *drg_exp = NULL, *drg_act = NULL;
+	limits_t limits;
+	int has_ctx = 0;
+	int ret = 0;
+	int i;
+
+	if (dragon_limits_serial(&limits, opts->size, opts->nb_thread) < 0)
+		goto err;
+	if ((img_exp = make_canvas(opts->width, opts->height)) == NULL ||
+			(img_act = make_canvas(opts->width, opts->height)) == NULL)
+		goto err;
+	if (dragon_draw_serial(&drg_exp, img_exp, opts->width, opts->height, opts->size, opts->nb_thread) < 0)
+		goto err;
+
+	for (i = 0; libs[i].lib != THREAD_LIB_NONE; i++) {
+		const char *name = libs[i].name;
+		int gap;
+
+		if (dragon_ctx_init(&ctx, libs[i].backend, opts->nb_thread, &dragon_arena) < 0)
+			goto err;
+		has_ctx = 1;
+		if ((r = dragon_render_async(&ctx, img_act, opts->width, opts->height, opts->size,
+				NULL, NULL)) == NULL)
+			goto err;
+		state = dragon_render_wait(r, &drg_act);
+		dragon_render_free(r);
+		r = NULL;
+		gap = -1;
+		if (state == DRAGON_RENDER_DONE)
+			gap = cmp_canvas(drg_exp, drg_act, limits.maximums.x - limits.minimums.x,
+					limits.maximums.y - limits.minimums.y, opts->verbose);
+		if (gap >= 0 && gap < opts->nb_thread * 2) {
+			printf("PASS %10s %10s gap=%d\n", "async", name, gap);
+		} else {
+			ret = -1;
+			printf("FAIL %10s %10s gap=%d\n", "async", name, gap);
+		}
+		ARENA_FREE(drg_act);
+
+		cc.reached = 0;
+		cc.cancelled = 0;
+		if ((r = dragon_render_async(&ctx, img_act, opts->width, opts->height, opts->size,
+				check_cancel_progress, &cc)) == NULL)
+			goto err;
+		pthread_mutex_lock(&cc.lock);
+		while (!cc.reached)
+			pthread_cond_wait(&cc.cond, &cc.lock);
+		dragon_render_cancel(r);
+		cc.cancelled = 1;
+		pthread_cond_broadcast(&cc.cond);
+		pthread_mutex_unlock(&cc.lock);
+		state = dragon_render_wait(r, NULL);
+		if (state == DRAGON_RENDER_CANCELLED && r->done[PROGRESS_SEGMENTS_DRAWN] == 0 &&
+				r->done[PROGRESS_ROWS_RENDERED] == 0) {
+			printf("PASS %10s %10s\n", "cancel", name);
+		} else {
+			ret = -1;
+			printf("FAIL %10s %10s state=%d drawn=%"PRIu64"\n", "cancel", name, state,
+					r->done[PROGRESS_SEGMENTS_DRAWN]);
+		}
+		dragon_render_free(r);
+		r = NULL;
+		dragon_ctx_release(&ctx);
+		has_ctx = 0;
+	}
+done:
+	dragon_render_free(r);
+	if (has_ctx)
+		dragon_ctx_release(&ctx);
+	ARENA_FREE(drg_exp);
+	ARENA_FREE(drg_act);
+	ARENA_FREE(img_exp);
+	ARENA_FREE(img_act);
+	return ret;
+err:
+	printf("Error executing async check\n");
+	ret = -1;
+	goto done;
+}
+
 static int cmd_check(struct command_opts *opts)
 {
 	int ret = 0;
@@ -345,12 +1248,151 @@ static int cmd_check(struct command_opts *opts)
 		ret = -1;
 	if (check_draw(opts) < 0)
 		ret = -1;
+	if (check_viewport(opts) < 0)
+		ret = -1;
+	if (check_preview(opts) < 0)
+		ret = -1;
+	if (check_animate(opts) < 0)
+		ret = -1;
+	if (check_async(opts) < 0)
+		ret = -1;
+	if (check_packed(opts) < 0)
+		ret = -1;
+	if (check_colors(opts) < 0)
+		ret = -1;
+	if (check_plan(opts) < 0)
+		ret = -1;
+	if (check_deadline(opts) < 0)
+		ret = -1;
 	return ret;
 }
 
 static const struct command_def cmd_check_def =
 { .name = "check", .handler = cmd_check };
 
+static const struct lib_def *lookup_lib(const char *name);
+
+/* run one job of the server or of a batch */
+static int run_job(struct dragon_job *job, struct job_result *res)
+{
+	const struct lib_def *lib;
+	struct dragon_ctx ctx;
+	struct rgb *img = NULL;
+	char *dragon = NULL;
+	int ret = 0;
+
+	if (strcmp(job->lib, JOB_LIB_AUTO) == 0)
+		lib = lookup_lib(job->size < JOB_SERIAL_SIZE ? "serial" : "tbb");
+	else
+		lib = lookup_lib(job->lib);
+	if (lib == NULL) {
+		job->error = "unknown threading lib";
+		return -1;
+	}
+	if (dragon_ctx_init(&ctx, lib->backend, job->nb_thread, &dragon_arena) < 0) {
+		job->error = "cannot create render context";
+		return -1;
+	}
+
+	switch (job->cmd) {
+	case JOB_CMD_LIMITS:
+		if (limits_cached(&ctx, job->size, &res->limits) < 0)
+			goto err;
+		break;
+	case JOB_CMD_DRAW:
+		img = make_canvas(job->width, job->height);
+		if (img == NULL)
+			goto err;
+		if (draw_cached(&ctx, job->size, img, job->width, job->height, &dragon) < 0)
+			goto err;
+		progress_add(PROGRESS_RENDERS, 1);
+		if (strcmp(job->output, JOB_OUTPUT_SHM) == 0) {
+			snprintf(res->shm, sizeof(res->shm), "/" PROGNAME ".%d.%"PRIu64,
+					(int) getpid(), job->id);
+			ret = write_img_shm(img, res->shm, job->width, job->height, &res->bytes);
+		} else {
+			ret = write_img(img, job->output, job->width, job->height);
+		}
+		if (ret < 0) {
+			job->error = "cannot write image";
+			goto err;
+		}
+		break;
+	}
+done:
+	ARENA_FREE(dragon);
+	ARENA_FREE(img);
+	dragon_ctx_release(&ctx);
+	return ret;
+err:
+	ret = -1;
+	goto done;
+}
+
+/*
+ * Run every job of the batch file on one pool of --thread threads, and
+ * print one line per job, in the order of the file.
+ */
+static int run_batch(struct command_opts *opts)
+{
+	struct dragon_job defaults, *jobs = NULL;
+	struct job_result *results = NULL;
+	int *status = NULL;
+	int nb_jobs = 0;
+	uint64_t segments = 0;
+	struct timespec t0, t1;
+	double sec;
+	int i, ret = 0;
+
+	/* without lib=, small jobs run serial and large jobs split with tbb */
+	job_init(&defaults);
+	strcpy(defaults.lib, JOB_LIB_AUTO);
+	defaults.width = opts->width;
+	defaults.height = opts->height;
+	defaults.size = opts->size;
+	defaults.output[0] = '\0';
+	if (job_read_file(opts->batch_path, &defaults, &jobs, &nb_jobs) < 0)
+		goto err;
+
+	results = calloc(nb_jobs ? nb_jobs : 1, sizeof(struct job_result));
+	status = calloc(nb_jobs ? nb_jobs : 1, sizeof(int));
+	if (results == NULL || status == NULL)
+		goto err;
+	for (i = 0; i < nb_jobs; i++) {
+		if (jobs[i].output[0] == '\0')
+			snprintf(jobs[i].output, JOB_PATH_MAX, "dragon-%"PRIu64".ppm", jobs[i].id);
+		segments += jobs[i].size;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	ret = dragon_batch_tbb(jobs, results, status, nb_jobs, opts->nb_thread, run_job);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	for (i = 0; i < nb_jobs; i++) {
+		struct dragon_job *job = &jobs[i];
+		limits_t *l = &results[i].limits;
+		if (status[i] < 0)
+			printf("err id=%"PRIu64" %s\n", job->id, job->error != NULL ? job->error : "job failed");
+		else if (job->cmd == JOB_CMD_LIMITS)
+			printf("ok id=%"PRIu64" cmd=limits ms=%.3f limits=%"PRId64",%"PRId64",%"PRId64",%"PRId64"\n",
+					job->id, results[i].ms, l->minimums.x, l->minimums.y,
+					l->maximums.x, l->maximums.y);
+		else
+			printf("ok id=%"PRIu64" cmd=draw ms=%.3f output=%s\n", job->id, results[i].ms, job->output);
+	}
+	printf("batch: %d jobs in %.3f s, %.1f jobs/s, %.1f Msegments/s\n", nb_jobs, sec,
+			sec > 0 ? nb_jobs / sec : 0, sec > 0 ? segments / sec / 1e6 : 0);
+done:
+	FREE(jobs);
+	FREE(results);
+	FREE(status);
+	return ret;
+err:
+	ret = -1;
+	goto done;
+}
+
 static const struct command_def cmd_def_last =
 { .name = NULL, .handler = NULL };
 
@@ -358,6 +1400,8 @@ static const struct command_def * const commands[] = {
 		&cmd_draw_def,
 		&cmd_limit_def,
 		&cmd_check_def,
+		&cmd_animate_def,
+		&cmd_scaling_def,
 		&cmd_def_last
 };
 
@@ -419,12 +1463,28 @@ static int parse_opts(int argc, char **argv, struct command_opts *opts)
 			{ "power",	 1, 0, 'p' },
 			{ "max",	 1, 0, 'm' },
 			{ "verbose", 0, 0, 'v' },
+			{ "perf",	 0, 0, 'P' },
+			{ "trace",	 1, 0, 'T' },
+			{ "metrics", 1, 0, 'M' },
+			{ "metrics-interval", 1, 0, 'I' },
+			{ "hugetlb", 0, 0, 'H' },
+			{ "serve",	 1, 0, 'S' },
+			{ "submit",	 1, 0, 'U' },
+			{ "cache",	 1, 0, 'K' },
+			{ "batch",	 1, 0, 'B' },
+			{ "viewport", 1, 0, 'V' },
+			{ "preview", 1, 0, 'L' },
+			{ "frames", 1, 0, 'F' },
+			{ "auto", 1, 0, 'A' },
+			{ "packed", 0, 0, 'Q' },
+			{ "mem-budget", 1, 0, 'G' },
+			{ "deadline", 1, 0, 'D' },
 			{ 0, 0, 0, 0}
 	};
 
 	memset(opts, 0, sizeof(struct command_opts));
 
-	while ((opt = getopt_long(argc, argv, "hvx:y:s:c:t:l:p:o:m:", options, &idx)) != -1) {
+	while ((opt = getopt_long(argc, argv, "hvPHQT:M:I:S:U:K:B:V:L:F:A:G:D:x:y:s:c:t:l:p:o:m:", options, &idx)) != -1) {
 		switch(opt) {
 		case 'c':
 			opts->cmd = lookup_cmd(optarg);
@@ -464,6 +1524,80 @@ static int parse_opts(int argc, char **argv, struct command_opts *opts)
 		case 'v':
 			opts->verbose = 1;
 			break;
+		case 'P':
+			perf_enabled = 1;
+			break;
+		case 'T':
+			if (trace_open(optarg) < 0)
+				goto err;
+			break;
+		case 'M':
+			if (asprintf(&opts->metrics_path, "%s", optarg) < 0)
+				goto err;
+			break;
+		case 'I':
+			opts->metrics_interval = atoi(optarg);
+			break;
+		case 'H':
+			dragon_arena.hugetlb = 1;
+			break;
+		case 'S':
+			if (asprintf(&opts->serve_path, "%s", optarg) < 0)
+				goto err;
+			break;
+		case 'U':
+			if (asprintf(&opts->submit_path, "%s", optarg) < 0)
+				goto err;
+			break;
+		case 'K':
+			if (asprintf(&opts->cache_path, "%s", optarg) < 0)
+				goto err;
+			break;
+		case 'B':
+			if (asprintf(&opts->batch_path, "%s", optarg) < 0)
+				goto err;
+			break;
+		case 'V':
+			if (viewport_parse(optarg, &opts->viewport) < 0) {
+				printf("Error: viewport must be x0,y0,x1,y1 with 0 <= x0 < x1 <= 1 and 0 <= y0 < y1 <= 1\n");
+				ret = -1;
+			}
+			opts->has_viewport = 1;
+			break;
+		case 'F':
+			opts->frames = atoi(optarg);
+			if (opts->frames <= 0) {
+				printf("Error: frames must be positive\n");
+				ret = -1;
+			}
+			break;
+		case 'Q':
+			opts->packed = 1;
+			break;
+		case 'G':
+			if (plan_parse_bytes(optarg, &opts->mem_budget) < 0) {
+				printf("Error: mem-budget must be a positive number of bytes, with an optional K, M or G\n");
+				ret = -1;
+			}
+			break;
+		case 'D':
+			opts->deadline = atoi(optarg);
+			if (opts->deadline <= 0) {
+				printf("Error: deadline must be a positive number of ms\n");
+				ret = -1;
+			}
+			break;
+		case 'A':
+			if (asprintf(&opts->auto_path, "%s", optarg) < 0)
+				goto err;
+			break;
+		case 'L':
+			opts->preview = atoi(optarg);
+			if (opts->preview <= 0) {
+				printf("Error: preview must be positive\n");
+				ret = -1;
+			}
+			break;
 		default:
 			printf("unknown option %c\n", opt);
 			ret = -1;
@@ -476,7 +1610,7 @@ static int parse_opts(int argc, char **argv, struct command_opts *opts)
 		opts->lib = lookup_lib(DEFAULT_LIB_NAME);
 
 	if (opts->pgm_path == NULL)
-		opts->pgm_path = DEFAULT_IMG_PATH;
+		opts->pgm_path = opts->cmd == &cmd_animate_def ? ANIMATE_STDOUT : DEFAULT_IMG_PATH;
 
 	if (opts->size > (1LL << POWER_MAX)) {
 		printf("Error: size must be lower or equals to %"PRId64"\n", opts->size);
@@ -505,9 +1639,19 @@ static int parse_opts(int argc, char **argv, struct command_opts *opts)
 	if (opts->size ==  0)
 		opts->size = DEFAULT_SIZE;
 
+	/* the server and batches use every processor unless told otherwise */
+	if (opts->serve_path != NULL || opts->batch_path != NULL)
+		default_int_value(&opts->nb_thread, (int) sysconf(_SC_NPROCESSORS_ONLN));
+
 	default_int_value(&opts->height, DEFAULT_HEIGHT);
 	default_int_value(&opts->width, DEFAULT_WIDTH);
 	default_int_value(&opts->nb_thread, DEFAULT_NB_THREAD);
+	default_int_value(&opts->frames, ANIMATE_FRAMES);
+
+	if (opts->packed && opts->nb_thread > PACKED_COLORS) {
+		printf("Error: a packed canvas holds at most %d threads\n", PACKED_COLORS);
+		ret = -1;
+	}
 
 	if (opts->width == 0 || opts->height == 0) {
 		fprintf(stderr, "argument error: height and width must be greater than 0\n");
@@ -527,21 +1671,76 @@ err:
 int main(int argc, char **argv)
 {
 	struct command_opts opts;
+	/* the reports do not go in the frames of animate on stdout */
+	FILE *report = stdout;
+
 	if (parse_opts(argc, argv, &opts) < 0) {
 		printf("Error while parsing arguments\n");
 		usage();
 	}
+	if (opts.cmd == &cmd_animate_def && strcmp(opts.pgm_path, ANIMATE_STDOUT) == 0)
+		report = stderr;
+
+	if (opts.submit_path != NULL) {
+		if (submit_run(opts.submit_path, stdin, stdout) < 0)
+			goto err;
+		return EXIT_SUCCESS;
+	}
 
-	if (opts.cmd == NULL) {
+	if (opts.cmd == NULL && opts.serve_path == NULL && opts.batch_path == NULL) {
 		printf("Select a command to run\n");
 		usage();
 	}
 
-	if ((opts.cmd->handler(&opts)) < 0) {
-		printf("Error while executing command %s\n", opts.cmd->name);
+	if (opts.cache_path != NULL && cache_open(&cache, opts.cache_path) < 0) {
+		printf("Error: cannot use cache directory %s\n", opts.cache_path);
+		goto err;
+	}
+
+	if (opts.auto_path != NULL && auto_profile(&opts) < 0) {
+		printf("Error: cannot use tuning profile %s\n", opts.auto_path);
+		goto err;
+	}
+
+	/* outside of the deadline of every draw */
+	if (opts.deadline > 0 && deadline_calibrate(&deadline_rates) < 0) {
+		printf("Error: cannot calibrate the kernels for --deadline\n");
 		goto err;
 	}
 
+	if (opts.metrics_path != NULL &&
+			progress_start(opts.metrics_path, opts.metrics_interval) < 0) {
+		printf("Error: cannot export metrics to %s\n", opts.metrics_path);
+		goto err;
+	}
+
+	if (opts.batch_path != NULL) {
+		if (run_batch(&opts) < 0) {
+			printf("Error while running batch %s\n", opts.batch_path);
+			progress_stop();
+			goto err;
+		}
+	} else if (opts.serve_path != NULL) {
+		if (serve_run(opts.serve_path, opts.nb_thread, run_job) < 0) {
+			printf("Error while serving on %s\n", opts.serve_path);
+			progress_stop();
+			goto err;
+		}
+	} else if ((opts.cmd->handler(&opts)) < 0) {
+		fprintf(report, "Error while executing command %s\n", opts.cmd->name);
+		progress_stop();
+		goto err;
+	}
+
+	progress_stop();
+
+	perf_report(report);
+	if (opts.verbose)
+		arena_report(&dragon_arena, report);
+	if (opts.verbose && cache.dir != NULL)
+		fprintf(report, "cache: %"PRIu64" hits, %"PRIu64" misses\n", cache.hits, cache.misses);
+	cache_close(&cache);
+
 	return EXIT_SUCCESS;
 
 	err:
@@ -0,0 +1,195 @@
+/*
+ * job.c
+ *
+ *  Created on: 2026-10-19
+ *
+ * Parser of job lines. A line is a list of key=value pairs separated by
+ * blanks, for instance:
+ *
+ *   cmd=draw lib=tbb power=24 thread=4 width=1024 height=1024 output=a.ppm
+ *
+ * Keys: id, cmd (draw | limits), lib (a lib of dragonizer, or auto),
+ * size, power, width, height, thread, priority (higher first) and output
+ * (a path, or shm). Missing keys take the defaults of dragonizer.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "job.h"
+
+static const char *job_cmd_names[] = { "draw", "limits" };
+
+void job_init(struct dragon_job *job)
+{
+	memset(job, 0, sizeof(struct dragon_job));
+	job->cmd = JOB_CMD_DRAW;
+	strcpy(job->lib, DEFAULT_LIB_NAME);
+	job->size = DEFAULT_SIZE;
+	job->width = DEFAULT_WIDTH;
+	job->height = DEFAULT_HEIGHT;
+	job->nb_thread = DEFAULT_NB_THREAD;
+	strcpy(job->output, DEFAULT_IMG_PATH);
+}
+
+const char *job_cmd_name(enum job_cmd cmd)
+{
+	return job_cmd_names[cmd];
+}
+
+static int job_int(const char *value, int64_t min, int64_t max, int64_t *res)
+{
+	char *end;
+	long long v;
+
+	v = strtoll(value, &end, 10);
+	if (end == value || *end != '\0' || v < min || v > max)
+		return -1;
+	*res = v;
+	return 0;
+}
+
+static int job_set(struct dragon_job *job, const char *key, const char *value)
+{
+	int64_t v;
+
+	if (strcmp(key, "cmd") == 0) {
+		if (strcmp(value, "draw") == 0)
+			job->cmd = JOB_CMD_DRAW;
+		else if (strcmp(value, "limits") == 0)
+			job->cmd = JOB_CMD_LIMITS;
+		else
+			goto err;
+	} else if (strcmp(key, "lib") == 0) {
+		if (strlen(value) >= JOB_NAME_MAX)
+			goto err;
+		strcpy(job->lib, value);
+	} else if (strcmp(key, "output") == 0) {
+		if (strlen(value) >= JOB_PATH_MAX)
+			goto err;
+		strcpy(job->output, value);
+	} else if (strcmp(key, "id") == 0) {
+		if (job_int(value, 0, INT64_MAX, &v) < 0)
+			goto err;
+		job->id = v;
+	} else if (strcmp(key, "size") == 0) {
+		if (job_int(value, 1, 1LL << POWER_MAX, &v) < 0)
+			goto err;
+		job->size = v;
+	} else if (strcmp(key, "power") == 0) {
+		if (job_int(value, 1, POWER_MAX - 1, &v) < 0)
+			goto err;
+		job->size = 1ULL << v;
+	} else if (strcmp(key, "width") == 0) {
+		if (job_int(value, 1, 1 << 16, &v) < 0)
+			goto err;
+		job->width = v;
+	} else if (strcmp(key, "height") == 0) {
+		if (job_int(value, 1, 1 << 16, &v) < 0)
+			goto err;
+		job->height = v;
+	} else if (strcmp(key, "thread") == 0) {
+		if (job_int(value, 1, 1024, &v) < 0)
+			goto err;
+		job->nb_thread = v;
+	} else if (strcmp(key, "priority") == 0) {
+		if (job_int(value, -1000, 1000, &v) < 0)
+			goto err;
+		job->priority = v;
+	} else {
+		job->error = "unknown key";
+		return -1;
+	}
+	return 0;
+err:
+	job->error = "invalid value";
+	return -1;
+}
+
+/* parse a job line over the defaults, returns -1 and sets job->error on error */
+int job_parse(const char *line, struct dragon_job *job)
+{
+	job_init(job);
+	return job_parse_over(line, job);
+}
+
+/* parse a job line over the values already in job */
+int job_parse_over(const char *line, struct dragon_job *job)
+{
+	char *copy, *token, *save = NULL, *eq;
+	int ret = 0;
+
+	job->error = NULL;
+	if ((copy = strdup(line)) == NULL) {
+		job->error = "out of memory";
+		return -1;
+	}
+	for (token = strtok_r(copy, " \t\r\n", &save); token != NULL;
+			token = strtok_r(NULL, " \t\r\n", &save)) {
+		if ((eq = strchr(token, '=')) == NULL) {
+			job->error = "expected key=value";
+			goto err;
+		}
+		*eq = '\0';
+		if (job_set(job, token, eq + 1) < 0)
+			goto err;
+	}
+done:
+	free(copy);
+	return ret;
+err:
+	ret = -1;
+	goto done;
+}
+
+/*
+ * Read a file of job lines, blank lines and lines starting with # are
+ * skipped. Jobs without id are numbered after their line.
+ */
+int job_read_file(const char *path, const struct dragon_job *defaults,
+		struct dragon_job **jobs, int *nb_jobs)
+{
+	struct dragon_job *list = NULL, *tmp;
+	char *line = NULL;
+	size_t cap = 0;
+	int len = 0, max = 0, lineno = 0;
+	FILE *f;
+	int ret = 0;
+
+	if ((f = fopen(path, "r")) == NULL) {
+		perror(path);
+		return -1;
+	}
+	while (getline(&line, &cap, f) > 0) {
+		char *p = line + strspn(line, " \t");
+		lineno++;
+		if (*p == '\n' || *p == '\0' || *p == '#')
+			continue;
+		if (len == max) {
+			max = max ? max * 2 : 64;
+			if ((tmp = realloc(list, max * sizeof(struct dragon_job))) == NULL)
+				goto err;
+			list = tmp;
+		}
+		list[len] = *defaults;
+		if (job_parse_over(p, &list[len]) < 0) {
+			printf("%s:%d: %s\n", path, lineno, list[len].error);
+			goto err;
+		}
+		if (list[len].id == 0)
+			list[len].id = lineno;
+		len++;
+	}
+	*jobs = list;
+	*nb_jobs = len;
+done:
+	free(line);
+	fclose(f);
+	return ret;
+err:
+	FREE(list);
+	ret = -1;
+	goto done;
+}
@@ -0,0 +1,66 @@
+/*
+ * job.h
+ *
+ *  Created on: 2026-10-19
+ *
+ * Render and limits jobs described by a line of key=value pairs, shared by
+ * the server and the client of dragonizer
+ */
+
+#ifndef JOB_H_
+#define JOB_H_
+
+#include <stdint.h>
+#include "dragon.h"
+
+#define DEFAULT_HEIGHT	512
+#define DEFAULT_WIDTH 	512
+#define DEFAULT_SIZE	1048576
+#define DEFAULT_NB_THREAD 2
+#define DEFAULT_LIB_NAME "serial"
+#define DEFAULT_IMG_PATH "dragon.ppm"
+#define POWER_MAX 		30
+
+#define JOB_NAME_MAX	32
+#define JOB_PATH_MAX	256
+/* output=shm: the image is returned in a POSIX shared memory object */
+#define JOB_OUTPUT_SHM	"shm"
+/* lib=auto: serial under JOB_SERIAL_SIZE segments, tbb over */
+#define JOB_LIB_AUTO	"auto"
+#define JOB_SERIAL_SIZE	(1 << 18)
+
+enum job_cmd {
+	JOB_CMD_DRAW,
+	JOB_CMD_LIMITS,
+};
+
+struct dragon_job {
+	uint64_t id;
+	enum job_cmd cmd;
+	char lib[JOB_NAME_MAX];
+	uint64_t size;
+	int width;
+	int height;
+	int nb_thread;
+	int priority;
+	char output[JOB_PATH_MAX];
+	const char *error;	/* why the line was rejected */
+};
+
+struct job_result {
+	limits_t limits;
+	double ms;
+	char shm[JOB_PATH_MAX];
+	uint64_t bytes;
+};
+
+typedef int (*job_runner)(struct dragon_job *job, struct job_result *res);
+
+void job_init(struct dragon_job *job);
+int job_parse(const char *line, struct dragon_job *job);
+int job_parse_over(const char *line, struct dragon_job *job);
+int job_read_file(const char *path, const struct dragon_job *defaults,
+        struct dragon_job **jobs, int *nb_jobs);
+const char *job_cmd_name(enum job_cmd cmd);
+
+#endif /* JOB_H_ */
@@ -0,0 +1,236 @@
+/*
+ * perf.c
+ *
+ *  Created on: 2026-10-19
+ *
+ * Hardware counters per pipeline stage. Each thread lazily opens its own
+ * set of perf_event_open counters (pid = 0, cpu = -1, so only the calling
+ * thread is counted) and reads them at the beginning and at the end of a
+ * stage. The delta is accumulated in the slot of the (thread, stage) pair.
+ *
+ * Everything is disabled unless perf_enabled is set, in which case the
+ * cost is a few read() per stage and per thread.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <inttypes.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+
+#include "config.h"
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#endif
+
+#include "perf.h"
+
+int perf_enabled = 0;
+
+static struct perf_slot perf_slots[PERF_MAX_THREAD][PERF_STAGE_MAX];
+/* first begin and last end of each stage, over every thread */
+static uint64_t perf_span_begin[PERF_STAGE_MAX];
+static uint64_t perf_span_end[PERF_STAGE_MAX];
+
+static const char *perf_stage_names[PERF_STAGE_MAX] = {
+	"limits", "draw", "render"
+};
+
+static const char *perf_event_names[PERF_EVENT_MAX] = {
+	"cycles", "instr", "llc-miss", "dtlb-miss", "br-miss", "faults"
+};
+
+/* 0 = not opened yet, 1 = opened, -1 = closed by perf_thread_exit */
+static __thread int perf_state = 0;
+static __thread int perf_fds[PERF_EVENT_MAX];
+
+static uint64_t perf_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+static int perf_open(uint32_t type, uint64_t config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_hv = 1;
+	/* allow counting with perf_event_paranoid = 2 */
+	if (type == PERF_TYPE_HARDWARE || type == PERF_TYPE_HW_CACHE)
+		attr.exclude_kernel = 1;
+	return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void perf_thread_open(void)
+{
+	perf_fds[PERF_EVENT_CYCLES] = perf_open(PERF_TYPE_HARDWARE,
+			PERF_COUNT_HW_CPU_CYCLES);
+	perf_fds[PERF_EVENT_INSTRUCTIONS] = perf_open(PERF_TYPE_HARDWARE,
+			PERF_COUNT_HW_INSTRUCTIONS);
+	perf_fds[PERF_EVENT_LLC_MISSES] = perf_open(PERF_TYPE_HARDWARE,
+			PERF_COUNT_HW_CACHE_MISSES);
+	perf_fds[PERF_EVENT_DTLB_MISSES] = perf_open(PERF_TYPE_HW_CACHE,
+			PERF_COUNT_HW_CACHE_DTLB |
+			(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			(PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	perf_fds[PERF_EVENT_BRANCH_MISSES] = perf_open(PERF_TYPE_HARDWARE,
+			PERF_COUNT_HW_BRANCH_MISSES);
+	perf_fds[PERF_EVENT_PAGE_FAULTS] = perf_open(PERF_TYPE_SOFTWARE,
+			PERF_COUNT_SW_PAGE_FAULTS);
+	perf_state = 1;
+}
+#else
+static void perf_thread_open(void)
+{
+	int i;
+	for (i = 0; i < PERF_EVENT_MAX; i++)
+		perf_fds[i] = -1;
+	perf_state = 1;
+}
+#endif
+
+static void perf_read(uint64_t *counters)
+{
+	int i;
+
+	if (perf_state != 1)
+		perf_thread_open();
+
+	for (i = 0; i < PERF_EVENT_MAX; i++) {
+		counters[i] = 0;
+		if (perf_fds[i] < 0)
+			continue;
+		if (read(perf_fds[i], &counters[i], sizeof(uint64_t)) != sizeof(uint64_t))
+			counters[i] = 0;
+	}
+}
+
+void perf_stage_begin(struct perf_sample *sample)
+{
+	if (!perf_enabled)
+		return;
+	perf_read(sample->counters);
+	sample->ns = perf_now();
+}
+
+static void perf_span_update(int stage, uint64_t begin, uint64_t end)
+{
+	uint64_t old;
+
+	while ((old = perf_span_begin[stage]) == 0 || begin < old) {
+		if (__sync_bool_compare_and_swap(&perf_span_begin[stage], old, begin))
+			break;
+	}
+	while ((old = perf_span_end[stage]) < end) {
+		if (__sync_bool_compare_and_swap(&perf_span_end[stage], old, end))
+			break;
+	}
+}
+
+void perf_stage_end(struct perf_sample *sample, int stage, int thread)
+{
+	uint64_t counters[PERF_EVENT_MAX];
+	uint64_t ns;
+	struct perf_slot *slot;
+	int i;
+
+	if (!perf_enabled)
+		return;
+
+	ns = perf_now();
+	perf_read(counters);
+
+	if (thread < 0 || thread >= PERF_MAX_THREAD || stage < 0 || stage >= PERF_STAGE_MAX)
+		return;
+
+	/*
+	 * Ids are unique per thread, but TBB workers may outnumber the ids
+	 * handed out, atomic adds keep the slots consistent anyway.
+	 */
+	perf_span_update(stage, sample->ns, ns);
+
+	slot = &perf_slots[thread][stage];
+	__sync_fetch_and_add(&slot->ns, ns - sample->ns);
+	__sync_fetch_and_add(&slot->calls, 1);
+	for (i = 0; i < PERF_EVENT_MAX; i++)
+		__sync_fetch_and_add(&slot->counters[i], counters[i] - sample->counters[i]);
+}
+
+/* close the counters of the calling thread, must be called before pthread_exit */
+void perf_thread_exit(void)
+{
+	int i;
+
+	if (perf_state != 1)
+		return;
+	for (i = 0; i < PERF_EVENT_MAX; i++) {
+		if (perf_fds[i] >= 0)
+			close(perf_fds[i]);
+		perf_fds[i] = -1;
+	}
+	perf_state = 0;
+}
+
+void perf_reset(void)
+{
+	memset(perf_slots, 0, sizeof(perf_slots));
+	memset(perf_span_begin, 0, sizeof(perf_span_begin));
+	memset(perf_span_end, 0, sizeof(perf_span_end));
+}
+
+/* wall time of a stage since perf_reset, from its first begin to its last end */
+uint64_t perf_stage_ns(int stage)
+{
+	if (perf_span_begin[stage] == 0)
+		return 0;
+	return perf_span_end[stage] - perf_span_begin[stage];
+}
+
+void perf_report(FILE *out)
+{
+	int stage, thread, i;
+	int avail[PERF_EVENT_MAX];
+
+	if (!perf_enabled)
+		return;
+
+	if (perf_state != 1)
+		perf_thread_open();
+	for (i = 0; i < PERF_EVENT_MAX; i++)
+		avail[i] = (perf_fds[i] >= 0);
+
+	fprintf(out, "%-7s %6s %6s %10s", "stage", "thread", "calls", "time(ms)");
+	for (i = 0; i < PERF_EVENT_MAX; i++)
+		fprintf(out, " %14s", perf_event_names[i]);
+	fprintf(out, " %6s\n", "ipc");
+
+	for (stage = 0; stage < PERF_STAGE_MAX; stage++) {
+		for (thread = 0; thread < PERF_MAX_THREAD; thread++) {
+			struct perf_slot *slot = &perf_slots[thread][stage];
+			if (slot->calls == 0)
+				continue;
+			fprintf(out, "%-7s %6d %6"PRIu64" %10.3f", perf_stage_names[stage],
+					thread, slot->calls, slot->ns / 1e6);
+			for (i = 0; i < PERF_EVENT_MAX; i++) {
+				if (avail[i])
+					fprintf(out, " %14"PRIu64, slot->counters[i]);
+				else
+					fprintf(out, " %14s", "n/a");
+			}
+			if (avail[PERF_EVENT_CYCLES] && slot->counters[PERF_EVENT_CYCLES] > 0)
+				fprintf(out, " %6.2f\n", (double) slot->counters[PERF_EVENT_INSTRUCTIONS] /
+						slot->counters[PERF_EVENT_CYCLES]);
+			else
+				fprintf(out, " %6s\n", "n/a");
+		}
+	}
+}
@@ -0,0 +1,56 @@
+/*
+ * perf.h
+ *
+ *  Created on: 2026-10-19
+ *
+ * Opt-in per-stage and per-thread hardware counters (perf_event_open)
+ */
+
+#ifndef PERF_H_
+#define PERF_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define PERF_MAX_THREAD 256
+
+enum perf_stage {
+	PERF_STAGE_LIMITS,
+	PERF_STAGE_DRAW,
+	PERF_STAGE_RENDER,
+	PERF_STAGE_MAX,
+};
+
+enum perf_event {
+	PERF_EVENT_CYCLES,
+	PERF_EVENT_INSTRUCTIONS,
+	PERF_EVENT_LLC_MISSES,
+	PERF_EVENT_DTLB_MISSES,
+	PERF_EVENT_BRANCH_MISSES,
+	PERF_EVENT_PAGE_FAULTS,
+	PERF_EVENT_MAX,
+};
+
+/* snapshot taken at the beginning of a stage */
+struct perf_sample {
+	uint64_t ns;
+	uint64_t counters[PERF_EVENT_MAX];
+};
+
+/* accumulated values for one (thread, stage) pair */
+struct perf_slot {
+	uint64_t ns;
+	uint64_t calls;
+	uint64_t counters[PERF_EVENT_MAX];
+};
+
+extern int perf_enabled;
+
+void perf_stage_begin(struct perf_sample *sample);
+void perf_stage_end(struct perf_sample *sample, int stage, int thread);
+void perf_thread_exit(void);
+void perf_reset(void);
+uint64_t perf_stage_ns(int stage);
+void perf_report(FILE *out);
+
+#endif /* PERF_H_ */
@@ -0,0 +1,126 @@
+/*
+ * plan.c
+ *
+ *  Created on: 2026-10-19
+ *
+ * The limits come from the block hierarchy in O(log size), so a plan is
+ * made before anything large is allocated. Every strategy keeps the image
+ * of 3 bytes per pixel; on top of it:
+ *
+ *   full    one byte per canvas cell
+ *   packed  half a byte per cell, at most PACKED_COLORS threads
+ *   accum   four sums of 8 bytes per pixel
+ *   banded  the canvas rows of band_rows image rows, as many as fit
+ *
+ * The accumulator is serial but walks the curve once, in a buffer of the
+ * size of the image: it is faster than the bands, whose canvas is cleared
+ * and whose border leaves are traced again for each band.
+ *
+ * The buffers of the backends (seeds, dataflow, bins) are small next to
+ * these and are not counted.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "plan.h"
+#include "viewport.h"
+
+static const char *plan_names[PLAN_MAX] = { "full", "packed", "accum", "banded" };
+
+/* bytes with an optional K, M or G suffix, powers of 1024 */
+int plan_parse_bytes(const char *arg, uint64_t *bytes)
+{
+	char *end;
+	unsigned long long v = strtoull(arg, &end, 10);
+
+	if (end == arg)
+		return -1;
+	switch (*end) {
+	case 'G': case 'g':
+		v <<= 10;
+		/* fall through */
+	case 'M': case 'm':
+		v <<= 10;
+		/* fall through */
+	case 'K': case 'k':
+		v <<= 10;
+		end++;
+		break;
+	}
+	if (*end != '\0' || v == 0)
+		return -1;
+	*bytes = v;
+	return 0;
+}
+
+const char *plan_name(int strategy)
+{
+	if (strategy < 0 || strategy >= PLAN_MAX)
+		return "none";
+	return plan_names[strategy];
+}
+
+/*
+ * Fill the footprints and pick the first strategy within the budget, from
+ * PLAN_PACKED on when packed is set. Returns -1 when none fits.
+ */
+int plan_choose(struct dragon_plan *plan, uint64_t budget, uint64_t size, int width, int height,
+		int nb_thread, int packed)
+{
+	uint64_t image = sizeof(struct rgb) * (uint64_t) width * height;
+	uint64_t area, row;
+	limits_t limits;
+	int scale, scale_x, scale_y;
+	int s;
+
+	memset(plan, 0, sizeof(*plan));
+	plan->budget = budget;
+	plan->strategy = PLAN_MAX;
+	if (dragon_limits_blocks(&limits, size, nb_thread) < 0)
+		return -1;
+	plan->dragon_width = limits.maximums.x - limits.minimums.x;
+	plan->dragon_height = limits.maximums.y - limits.minimums.y;
+	area = (uint64_t) plan->dragon_width * plan->dragon_height;
+	scale_x = plan->dragon_width / width + 1;
+	scale_y = plan->dragon_height / height + 1;
+	scale = (scale_x > scale_y ? scale_x : scale_y);
+
+	if (!packed)
+		plan->bytes[PLAN_FULL] = image + canvas_bytes(area, 0);
+	if (nb_thread <= PACKED_COLORS)
+		plan->bytes[PLAN_PACKED] = image + canvas_bytes(area, 1);
+	/* the widest bands within the budget, at least one image row */
+	row = band_canvas_bytes(plan->dragon_width, scale, 1);
+	plan->band_rows = height;
+	if (row > 0 && (budget <= image || (budget - image) / row < (uint64_t) height))
+		plan->band_rows = budget > image ? (budget - image) / row : 1;
+	if (plan->band_rows < 1)
+		plan->band_rows = 1;
+	plan->bytes[PLAN_ACCUM] = image + 4 * sizeof(uint64_t) * (uint64_t) width * height;
+	plan->bytes[PLAN_BANDED] = image + band_canvas_bytes(plan->dragon_width, scale, plan->band_rows);
+
+	for (s = 0; s < PLAN_MAX; s++) {
+		if (plan->bytes[s] != 0 && plan->bytes[s] <= budget) {
+			plan->strategy = s;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+void plan_report(struct dragon_plan *plan, FILE *out)
+{
+	int s;
+
+	fprintf(out, "plan %s budget=%" PRIu64 " canvas=%dx%d", plan_name(plan->strategy), plan->budget,
+			plan->dragon_width, plan->dragon_height);
+	for (s = 0; s < PLAN_MAX; s++) {
+		if (plan->bytes[s] != 0)
+			fprintf(out, " %s=%" PRIu64, plan_name(s), plan->bytes[s]);
+	}
+	if (plan->strategy == PLAN_BANDED)
+		fprintf(out, " band_rows=%d", plan->band_rows);
+	fprintf(out, "\n");
+}
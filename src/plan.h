@@ -0,0 +1,40 @@
+/*
+ * plan.h
+ *
+ *  Created on: 2026-10-19
+ *
+ * Memory budget planner: the footprint of each strategy of a draw is
+ * estimated from the limits, and the fastest one fitting the budget is run
+ */
+
+#ifndef PLAN_H_
+#define PLAN_H_
+
+#include <stdio.h>
+#include "dragon.h"
+
+/* strategies from the fastest to the smallest */
+enum plan_strategy {
+	PLAN_FULL,	/* canvas of one byte per cell, any backend */
+	PLAN_PACKED,	/* canvas of two cells per byte, any backend */
+	PLAN_ACCUM,	/* segments summed in the pixels, serial */
+	PLAN_BANDED,	/* canvas of one band of image rows at a time, serial */
+	PLAN_MAX,
+};
+
+struct dragon_plan {
+	int strategy;			/* PLAN_MAX when none fits */
+	uint64_t budget;
+	uint64_t bytes[PLAN_MAX];	/* footprint of each strategy, 0 when it does not apply */
+	int band_rows;			/* image rows per band of PLAN_BANDED */
+	int dragon_width;
+	int dragon_height;
+};
+
+int plan_parse_bytes(const char *arg, uint64_t *bytes);
+const char *plan_name(int strategy);
+int plan_choose(struct dragon_plan *plan, uint64_t budget, uint64_t size, int width, int height,
+        int nb_thread, int packed);
+void plan_report(struct dragon_plan *plan, FILE *out);
+
+#endif /* PLAN_H_ */
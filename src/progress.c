@@ -0,0 +1,219 @@
+/*
+ * progress.c
+ *
+ *  Created on: 2026-10-19
+ *
+ * The kernels add to the counters with atomic adds, an exporter thread
+ * periodically rewrites the metrics file. The segments drawn also have a
+ * series per thread, labelled by the worker id of the thread: the slot it
+ * holds until it exits. The file is written aside and renamed, so a reader
+ * never sees a partial file.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <inttypes.h>
+
+#include "progress.h"
+
+int progress_enabled = 0;
+uint64_t progress_counters[PROGRESS_MAX];
+__thread struct progress_job *progress_job = NULL;
+
+static struct progress_worker progress_workers[PROGRESS_MAX_WORKER];
+/* slots ever used, the series exported */
+static int progress_nb_worker;
+/* slot of the thread, NULL before its first chunk */
+static __thread struct progress_worker *progress_slot;
+static pthread_key_t progress_worker_key;
+static pthread_once_t progress_worker_once = PTHREAD_ONCE_INIT;
+
+static uint64_t progress_expected[PROGRESS_MAX];
+static uint64_t progress_previous[PROGRESS_MAX];
+static uint64_t progress_previous_ns;
+static uint64_t progress_start_ns;
+
+static char *progress_path = NULL;
+static char *progress_tmp = NULL;
+static int progress_interval;
+static int progress_running;
+static pthread_t progress_thread;
+static pthread_mutex_t progress_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t progress_cond = PTHREAD_COND_INITIALIZER;
+
+static const struct {
+	const char *name;
+	const char *help;
+} progress_defs[PROGRESS_MAX] = {
+	{ "dragon_segments_limited", "Segments walked by the limits stage" },
+	{ "dragon_segments_drawn", "Segments traced into the canvas" },
+	{ "dragon_rows_rendered", "Image rows produced by scale_dragon" },
+	{ "dragon_bytes_written", "Image bytes written to disk" },
+	{ "dragon_renders", "Renders completed" },
+};
+
+static uint64_t progress_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* at the exit of a thread, its slot is free for the next one */
+static void progress_worker_exit(void *arg)
+{
+	struct progress_worker *w = (struct progress_worker *) arg;
+
+	__sync_lock_release(&w->used);
+}
+
+static void progress_worker_key_init(void)
+{
+	pthread_key_create(&progress_worker_key, progress_worker_exit);
+}
+
+/* the first free slot, NULL if PROGRESS_MAX_WORKER threads hold one */
+static struct progress_worker *progress_worker_take(void)
+{
+	int nb;
+	int i;
+
+	pthread_once(&progress_worker_once, progress_worker_key_init);
+	for (i = 0; i < PROGRESS_MAX_WORKER; i++) {
+		if (__sync_lock_test_and_set(&progress_workers[i].used, 1) == 0)
+			break;
+	}
+	if (i == PROGRESS_MAX_WORKER)
+		return NULL;
+	while ((nb = progress_nb_worker) <= i &&
+			!__sync_bool_compare_and_swap(&progress_nb_worker, nb, i + 1))
+		;
+	pthread_setspecific(progress_worker_key, &progress_workers[i]);
+	return &progress_workers[i];
+}
+
+void progress_worker_add(uint64_t n)
+{
+	struct progress_worker *w = progress_slot;
+
+	if (w == NULL && (w = progress_slot = progress_worker_take()) == NULL)
+		return;
+	w->drawn += n;
+	w->last_ns = progress_now();
+}
+
+void progress_expect(int counter, uint64_t n)
+{
+	if (progress_enabled)
+		__sync_fetch_and_add(&progress_expected[counter], n);
+}
+
+static int progress_write(void)
+{
+	uint64_t now = progress_now();
+	double elapsed = (now - progress_previous_ns) / 1e9;
+	FILE *f;
+	int nb_worker;
+	int i;
+
+	if ((f = fopen(progress_tmp, "w")) == NULL)
+		return -1;
+
+	for (i = 0; i < PROGRESS_MAX; i++) {
+		const char *name = progress_defs[i].name;
+		uint64_t value = progress_counters[i];
+		double rate = elapsed > 0 ? (value - progress_previous[i]) / elapsed : 0;
+
+		fprintf(f, "# HELP %s_total %s\n", name, progress_defs[i].help);
+		fprintf(f, "# TYPE %s_total counter\n", name);
+		fprintf(f, "%s_total %"PRIu64"\n", name, value);
+		fprintf(f, "# TYPE %s_expected gauge\n", name);
+		fprintf(f, "%s_expected %"PRIu64"\n", name, progress_expected[i]);
+		fprintf(f, "# TYPE %s_per_second gauge\n", name);
+		fprintf(f, "%s_per_second %.1f\n", name, rate);
+		progress_previous[i] = value;
+	}
+	nb_worker = progress_nb_worker;
+	fprintf(f, "# HELP dragon_worker_segments_drawn_total Segments traced into the canvas by a thread\n");
+	fprintf(f, "# TYPE dragon_worker_segments_drawn_total counter\n");
+	for (i = 0; i < nb_worker; i++)
+		fprintf(f, "dragon_worker_segments_drawn_total{worker=\"%d\"} %"PRIu64"\n", i,
+				progress_workers[i].drawn);
+	fprintf(f, "# HELP dragon_worker_last_progress_seconds Uptime at the last chunk drawn by a thread\n");
+	fprintf(f, "# TYPE dragon_worker_last_progress_seconds gauge\n");
+	for (i = 0; i < nb_worker; i++)
+		fprintf(f, "dragon_worker_last_progress_seconds{worker=\"%d\"} %.3f\n", i,
+				(progress_workers[i].last_ns - progress_start_ns) / 1e9);
+	fprintf(f, "# TYPE dragon_uptime_seconds gauge\n");
+	fprintf(f, "dragon_uptime_seconds %.3f\n", (now - progress_start_ns) / 1e9);
+	progress_previous_ns = now;
+
+	if (fclose(f) != 0)
+		return -1;
+	return rename(progress_tmp, progress_path);
+}
+
+static void *progress_worker(void *data)
+{
+	struct timespec deadline;
+
+	pthread_mutex_lock(&progress_mutex);
+	while (progress_running) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += progress_interval / 1000;
+		deadline.tv_nsec += (progress_interval % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&progress_cond, &progress_mutex, &deadline);
+		progress_write();
+	}
+	pthread_mutex_unlock(&progress_mutex);
+	return NULL;
+}
+
+int progress_start(const char *path, int interval_ms)
+{
+	if (asprintf(&progress_path, "%s", path) < 0)
+		return -1;
+	if (asprintf(&progress_tmp, "%s.tmp", path) < 0)
+		goto err;
+
+	progress_interval = interval_ms > 0 ? interval_ms : PROGRESS_DEFAULT_INTERVAL;
+	progress_start_ns = progress_previous_ns = progress_now();
+	progress_enabled = 1;
+	progress_running = 1;
+	if (pthread_create(&progress_thread, NULL, progress_worker, NULL) != 0) {
+		progress_enabled = 0;
+		goto err;
+	}
+	return 0;
+
+err:
+	free(progress_path);
+	free(progress_tmp);
+	progress_path = progress_tmp = NULL;
+	return -1;
+}
+
+/* stop the exporter, the file is rewritten one last time */
+void progress_stop(void)
+{
+	if (progress_path == NULL)
+		return;
+
+	pthread_mutex_lock(&progress_mutex);
+	progress_running = 0;
+	pthread_cond_signal(&progress_cond);
+	pthread_mutex_unlock(&progress_mutex);
+	pthread_join(progress_thread, NULL);
+
+	free(progress_path);
+	free(progress_tmp);
+	progress_path = progress_tmp = NULL;
+}
@@ -0,0 +1,81 @@
+/*
+ * progress.h
+ *
+ *  Created on: 2026-10-19
+ *
+ * Live progress counters, exported as a Prometheus text-format file
+ */
+
+#ifndef PROGRESS_H_
+#define PROGRESS_H_
+
+#include <stdint.h>
+
+/* kernels report their progress every PROGRESS_CHUNK steps */
+#define PROGRESS_CHUNK (1 << 16)
+#define PROGRESS_DEFAULT_INTERVAL 1000
+/* threads alive at once with their own series, the next ones are only in the totals */
+#define PROGRESS_MAX_WORKER 256
+
+enum progress_counter {
+	PROGRESS_SEGMENTS_LIMITED,
+	PROGRESS_SEGMENTS_DRAWN,
+	PROGRESS_ROWS_RENDERED,
+	PROGRESS_BYTES_WRITTEN,
+	PROGRESS_RENDERS,
+	PROGRESS_MAX,
+};
+
+extern int progress_enabled;
+extern uint64_t progress_counters[PROGRESS_MAX];
+
+/*
+ * Segments drawn by one thread, numbered by its first chunk, and the time
+ * of its last chunk: a straggler is the one behind, or quiet for long. The
+ * slot of a thread that exits is taken by the next new one.
+ */
+struct progress_worker {
+	uint64_t drawn;
+	uint64_t last_ns;
+	int used;
+} __attribute__((aligned(64)));
+
+void progress_worker_add(uint64_t n);
+
+static inline void progress_add(int counter, uint64_t n)
+{
+	if (progress_enabled)
+		__sync_fetch_and_add(&progress_counters[counter], n);
+}
+
+/*
+ * Render followed by the calling thread: the backends set it around the
+ * tasks of a context, NULL outside of an asynchronous render.
+ */
+struct progress_job {
+	volatile int cancel;
+	void (*chunk)(struct progress_job *job, int counter, uint64_t n);
+};
+
+extern __thread struct progress_job *progress_job;
+
+/* account n steps about to be done by a kernel, 0 if its render is cancelled */
+static inline int progress_chunk(int counter, uint64_t n)
+{
+	struct progress_job *job = progress_job;
+
+	if (job != NULL && job->cancel)
+		return 0;
+	progress_add(counter, n);
+	if (progress_enabled && counter == PROGRESS_SEGMENTS_DRAWN)
+		progress_worker_add(n);
+	if (job != NULL && job->chunk != NULL)
+		job->chunk(job, counter, n);
+	return 1;
+}
+
+void progress_expect(int counter, uint64_t n);
+int progress_start(const char *path, int interval_ms);
+void progress_stop(void);
+
+#endif /* PROGRESS_H_ */
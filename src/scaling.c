@@ -0,0 +1,215 @@
+/*
+ * scaling.c
+ *
+ *  Created on: 2026-10-19
+ *
+ * Each backend renders with 1, 2, 4... threads up to max_thread, in this
+ * process: once at a fixed size (strong scaling), once with the size
+ * growing with the threads to size at max_thread (weak scaling). The time
+ * of each stage is the span of its perf samples, from the first begin to
+ * the last end over all threads.
+ *
+ * The tables are in columns, the blocks separated by two empty lines for
+ * the gnuplot index. The serial fraction f is fitted by least squares:
+ * on strong scaling, Amdahl T(p) = T(1) (f + (1 - f) / p); on weak
+ * scaling, Gustafson S(p) = p - f (p - 1) with the scaled speedup
+ * S(p) = p T(1) / T(p). The points with more threads than processors
+ * measure the sharing of the processors, not the serial part: they are
+ * left out, and the fit is nan without any other point. Noise may still
+ * push f out of [0, 1], it is clamped.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "scaling.h"
+#include "tune.h"
+
+static const char *scaling_names[SCALING_TIMES] = {
+	"limits", "draw", "render", "total"
+};
+
+static double scaling_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* slope sxy / sxx within [0, 1], nan without points */
+static double scaling_fraction(double sxy, double sxx)
+{
+	double f;
+
+	if (sxx <= 0)
+		return NAN;
+	f = sxy / sxx;
+	return f < 0 ? 0 : (f > 1 ? 1 : f);
+}
+
+/* least squares of y = f x over the points with more than one thread, at most nb_cpu */
+double scaling_fit_amdahl(const struct scaling_point *points, int nb_point, int time, int nb_cpu)
+{
+	double sxy = 0, sxx = 0;
+	int i;
+
+	for (i = 0; i < nb_point; i++) {
+		double p = points[i].nb_thread;
+		if (p <= 1 || p > nb_cpu || points[0].ms[time] <= 0)
+			continue;
+		double x = 1 - 1 / p;
+		double y = points[i].ms[time] / points[0].ms[time] - 1 / p;
+		sxy += x * y;
+		sxx += x * x;
+	}
+	return scaling_fraction(sxy, sxx);
+}
+
+double scaling_fit_gustafson(const struct scaling_point *points, int nb_point, int time, int nb_cpu)
+{
+	double sxy = 0, sxx = 0;
+	int i;
+
+	for (i = 0; i < nb_point; i++) {
+		double p = points[i].nb_thread;
+		if (p <= 1 || p > nb_cpu || points[i].ms[time] <= 0)
+			continue;
+		double speedup = p * points[0].ms[time] / points[i].ms[time];
+		sxy += (p - 1) * (p - speedup);
+		sxx += (p - 1) * (p - 1);
+	}
+	return scaling_fraction(sxy, sxx);
+}
+
+/* best time of each stage over SCALING_REPEAT renders */
+static int scaling_measure(const struct dragon_backend *backend, struct scaling_point *point,
+		struct rgb *image, int width, int height)
+{
+	struct dragon_ctx ctx;
+	char *canvas = NULL;
+	double ms;
+	int i, t;
+
+	if (dragon_ctx_init(&ctx, backend, point->nb_thread, NULL) < 0)
+		return -1;
+	for (t = 0; t < SCALING_TIMES; t++)
+		point->ms[t] = -1;
+	for (i = 0; i <= SCALING_REPEAT; i++) {
+		perf_reset();
+		ms = scaling_now_ms();
+		if (dragon_ctx_draw(&ctx, &canvas, image, width, height, point->size) < 0)
+			goto err;
+		ms = scaling_now_ms() - ms;
+		dragon_ctx_free(&ctx, canvas);
+		canvas = NULL;
+		/* the first render starts the workers and the clock of the processors */
+		if (i == 0)
+			continue;
+		for (t = 0; t < PERF_STAGE_MAX; t++) {
+			double stage = perf_stage_ns(t) / 1e6;
+			if (point->ms[t] < 0 || stage < point->ms[t])
+				point->ms[t] = stage;
+		}
+		if (point->ms[SCALING_TOTAL] < 0 || ms < point->ms[SCALING_TOTAL])
+			point->ms[SCALING_TOTAL] = ms;
+	}
+	dragon_ctx_release(&ctx);
+	return 0;
+err:
+	dragon_ctx_release(&ctx);
+	return -1;
+}
+
+/* speedup against one thread: plain for strong scaling, scaled by the threads for weak */
+static void scaling_table(FILE *out, const char *name, struct scaling_point *points, int nb_point,
+		int weak)
+{
+	int i, t;
+
+	for (i = 0; i < nb_point; i++) {
+		for (t = 0; t < SCALING_TIMES; t++) {
+			double p = points[i].nb_thread;
+			double ms = points[i].ms[t];
+			double speedup = ms > 0 ? points[0].ms[t] / ms : NAN;
+			if (weak)
+				speedup *= p;
+			fprintf(out, "%-14s %7d %12"PRIu64" %-6s %10.3f %8.3f %8.3f\n", name,
+					points[i].nb_thread, points[i].size, scaling_names[t], ms,
+					speedup, speedup / p);
+		}
+	}
+}
+
+/* backends is NULL terminated */
+int scaling_run(FILE *out, const struct dragon_backend * const *backends, int width, int height,
+		uint64_t size, int max_thread)
+{
+	struct scaling_point *strong = NULL, *weak = NULL;
+	int saved_perf = perf_enabled;
+	int nb_cpu = tune_cpus();
+	struct rgb *image = NULL;
+	int nb_point = 0;
+	int b, i, t, ret = 0;
+
+	if (max_thread <= 0)
+		return -1;
+	for (t = 1; t < max_thread; t *= 2)
+		nb_point++;
+	nb_point++;
+	strong = calloc(nb_point, sizeof(struct scaling_point));
+	weak = calloc(nb_point, sizeof(struct scaling_point));
+	if (strong == NULL || weak == NULL || (image = make_canvas(width, height)) == NULL)
+		goto err;
+	for (i = 0, t = 1; i < nb_point; i++, t = t * 2 < max_thread ? t * 2 : max_thread) {
+		strong[i].nb_thread = weak[i].nb_thread = t;
+		strong[i].size = size;
+		weak[i].size = size / max_thread * t;
+		if (weak[i].size == 0)
+			weak[i].size = t;
+	}
+
+	/* the stage spans come from the perf samples */
+	perf_enabled = 1;
+	for (b = 0; backends[b] != NULL; b++) {
+		for (i = 0; i < nb_point; i++) {
+			if (scaling_measure(backends[b], &strong[i], image, width, height) < 0 ||
+					scaling_measure(backends[b], &weak[i], image, width, height) < 0)
+				goto err;
+		}
+		fprintf(out, "# strong scaling %s: size %"PRIu64", image %dx%d\n", backends[b]->name,
+				size, width, height);
+		fprintf(out, "# %-12s %7s %12s %-6s %10s %8s %8s\n", "lib", "threads", "size", "stage",
+				"ms", "speedup", "eff");
+		scaling_table(out, backends[b]->name, strong, nb_point, 0);
+		fprintf(out, "\n\n# weak scaling %s: %"PRIu64" segments per thread\n", backends[b]->name,
+				size / max_thread);
+		fprintf(out, "# %-12s %7s %12s %-6s %10s %8s %8s\n", "lib", "threads", "size", "stage",
+				"ms", "scaled", "eff");
+		scaling_table(out, backends[b]->name, weak, nb_point, 1);
+		fprintf(out, "\n\n# serial fraction %s: Amdahl on strong, Gustafson on weak scaling\n",
+				backends[b]->name);
+		if (max_thread > nb_cpu)
+			fprintf(out, "# oversubscribed: %d processors, the points with more threads are not fitted\n",
+					nb_cpu);
+		fprintf(out, "# %-12s %-6s %8s %8s\n", "lib", "stage", "amdahl", "gustafson");
+		for (t = 0; t < SCALING_TIMES; t++)
+			fprintf(out, "%-14s %-6s %8.4f %8.4f\n", backends[b]->name, scaling_names[t],
+					scaling_fit_amdahl(strong, nb_point, t, nb_cpu),
+					scaling_fit_gustafson(weak, nb_point, t, nb_cpu));
+		fprintf(out, "\n\n");
+		fflush(out);
+	}
+done:
+	perf_enabled = saved_perf;
+	ARENA_FREE(image);
+	FREE(strong);
+	FREE(weak);
+	return ret;
+err:
+	ret = -1;
+	goto done;
+}
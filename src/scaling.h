@@ -0,0 +1,32 @@
+/*
+ * scaling.h
+ *
+ *  Created on: 2026-10-19
+ *
+ * Strong and weak scaling of the backends, measured in the process
+ */
+
+#ifndef SCALING_H_
+#define SCALING_H_
+
+#include <stdio.h>
+#include "context.h"
+
+/* best of a few renders, after one to start the workers */
+#define SCALING_REPEAT	3
+/* the perf stages, then the whole render */
+#define SCALING_TOTAL	PERF_STAGE_MAX
+#define SCALING_TIMES	(PERF_STAGE_MAX + 1)
+
+struct scaling_point {
+	int nb_thread;
+	uint64_t size;
+	double ms[SCALING_TIMES];
+};
+
+double scaling_fit_amdahl(const struct scaling_point *points, int nb_point, int time, int nb_cpu);
+double scaling_fit_gustafson(const struct scaling_point *points, int nb_point, int time, int nb_cpu);
+int scaling_run(FILE *out, const struct dragon_backend * const *backends, int width, int height,
+        uint64_t size, int max_thread);
+
+#endif /* SCALING_H_ */
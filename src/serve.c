@@ -0,0 +1,584 @@
+/*
+ * serve.c
+ *
+ *  Created on: 2026-10-19
+ *
+ * Render daemon. Clients connect to a Unix socket and send one job per
+ * line (see job.c), plus the control lines "stats" and "shutdown". Every
+ * job gets one reply line, in completion order:
+ *
+ *   ok id=N cmd=draw wait_ms=W ms=T output=PATH
+ *   ok id=N cmd=draw wait_ms=W ms=T shm=NAME bytes=B
+ *   ok id=N cmd=limits wait_ms=W ms=T limits=MINX,MINY,MAXX,MAXY
+ *   err id=N MESSAGE
+ *   busy id=N
+ *
+ * Jobs wait in a priority queue (higher priority first, then arrival
+ * order) and start when the threads they ask for are free in the budget
+ * of the server, so that concurrent jobs never oversubscribe the machine.
+ * A job asking for more than the budget is given the whole budget. When
+ * the queue is full, jobs are rejected at once with a busy reply instead
+ * of making the latency of every queued job grow.
+ *
+ * On shutdown, the server stops accepting jobs, runs the queued ones and
+ * exits once they are done. The connections still open are then shut
+ * down, and the server waits for their readers before it goes away.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "serve.h"
+
+#define SERVE_REPLY_MAX 512
+
+struct serve;
+
+struct serve_conn {
+	int fd;
+	pthread_mutex_t lock;	/* one reply at a time */
+	int refs;		/* reader + jobs not replied yet */
+	struct serve *srv;
+	struct serve_conn *prev;	/* connections with a reader, under srv->lock */
+	struct serve_conn *next;
+};
+
+struct serve_job {
+	struct dragon_job job;
+	struct serve_conn *conn;
+	uint64_t seq;
+	uint64_t queued_ns;
+};
+
+struct serve {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct serve_job **heap;
+	int len;
+	int budget;
+	int free_threads;
+	int running;
+	int stopping;
+	uint64_t seq;
+	uint64_t done;
+	uint64_t failed;
+	uint64_t rejected;
+	int listen_fd;
+	job_runner run;
+	struct serve_conn *conns;	/* readers still running */
+	int readers;
+};
+
+static uint64_t serve_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void conn_reply(struct serve_conn *conn, const char *format, ...)
+{
+	char buf[SERVE_REPLY_MAX];
+	va_list ap;
+	int len;
+
+	va_start(ap, format);
+	len = vsnprintf(buf, sizeof(buf) - 1, format, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+	if (len > (int) sizeof(buf) - 2)
+		len = sizeof(buf) - 2;
+	buf[len++] = '\n';
+
+	/* a client gone away is not an error of the server */
+	pthread_mutex_lock(&conn->lock);
+	write_all(conn->fd, buf, len);
+	pthread_mutex_unlock(&conn->lock);
+}
+
+static void conn_put(struct serve_conn *conn)
+{
+	int refs;
+
+	pthread_mutex_lock(&conn->lock);
+	refs = --conn->refs;
+	pthread_mutex_unlock(&conn->lock);
+	if (refs > 0)
+		return;
+	close(conn->fd);
+	pthread_mutex_destroy(&conn->lock);
+	free(conn);
+}
+
+/* a runs before b */
+static inline int job_before(struct serve_job *a, struct serve_job *b)
+{
+	if (a->job.priority != b->job.priority)
+		return a->job.priority > b->job.priority;
+	return a->seq < b->seq;
+}
+
+static void heap_push(struct serve *srv, struct serve_job *sj)
+{
+	int i = srv->len++;
+
+	while (i > 0 && job_before(sj, srv->heap[(i - 1) / 2])) {
+		srv->heap[i] = srv->heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	srv->heap[i] = sj;
+}
+
+static struct serve_job *heap_pop(struct serve *srv)
+{
+	struct serve_job *top = srv->heap[0];
+	struct serve_job *last = srv->heap[--srv->len];
+	int i = 0, child;
+
+	while ((child = 2 * i + 1) < srv->len) {
+		if (child + 1 < srv->len && job_before(srv->heap[child + 1], srv->heap[child]))
+			child++;
+		if (!job_before(srv->heap[child], last))
+			break;
+		srv->heap[i] = srv->heap[child];
+		i = child;
+	}
+	srv->heap[i] = last;
+	return top;
+}
+
+static void serve_stop(struct serve *srv)
+{
+	pthread_mutex_lock(&srv->lock);
+	srv->stopping = 1;
+	pthread_cond_broadcast(&srv->cond);
+	pthread_mutex_unlock(&srv->lock);
+	/* wake up accept() */
+	shutdown(srv->listen_fd, SHUT_RDWR);
+}
+
+static void serve_reply_job(struct serve_job *sj, struct job_result *res, int ret, uint64_t wait_ns)
+{
+	struct dragon_job *job = &sj->job;
+	limits_t *l = &res->limits;
+
+	if (ret < 0) {
+		conn_reply(sj->conn, "err id=%"PRIu64" %s", job->id,
+				job->error != NULL ? job->error : "job failed");
+		return;
+	}
+	switch (job->cmd) {
+	case JOB_CMD_LIMITS:
+		conn_reply(sj->conn, "ok id=%"PRIu64" cmd=limits wait_ms=%.3f ms=%.3f "
+				"limits=%"PRId64",%"PRId64",%"PRId64",%"PRId64, job->id,
+				wait_ns / 1e6, res->ms, l->minimums.x, l->minimums.y,
+				l->maximums.x, l->maximums.y);
+		break;
+	case JOB_CMD_DRAW:
+		if (res->shm[0] != '\0')
+			conn_reply(sj->conn, "ok id=%"PRIu64" cmd=draw wait_ms=%.3f ms=%.3f "
+					"shm=%s bytes=%"PRIu64, job->id, wait_ns / 1e6, res->ms,
+					res->shm, res->bytes);
+		else
+			conn_reply(sj->conn, "ok id=%"PRIu64" cmd=draw wait_ms=%.3f ms=%.3f "
+					"output=%s", job->id, wait_ns / 1e6, res->ms, job->output);
+		break;
+	}
+}
+
+static void *serve_runner(void *arg)
+{
+	struct serve *srv = (struct serve *) arg;
+	struct serve_job *sj;
+	struct job_result res;
+	uint64_t start;
+	int nb_thread;
+	int ret;
+
+	for (;;) {
+		pthread_mutex_lock(&srv->lock);
+		while (!(srv->len > 0 && srv->heap[0]->job.nb_thread <= srv->free_threads) &&
+				!(srv->stopping && srv->len == 0))
+			pthread_cond_wait(&srv->cond, &srv->lock);
+		if (srv->len == 0) {
+			pthread_mutex_unlock(&srv->lock);
+			break;
+		}
+		sj = heap_pop(srv);
+		nb_thread = sj->job.nb_thread;
+		srv->free_threads -= nb_thread;
+		srv->running++;
+		pthread_mutex_unlock(&srv->lock);
+
+		memset(&res, 0, sizeof(res));
+		start = serve_now();
+		ret = srv->run(&sj->job, &res);
+		res.ms = (serve_now() - start) / 1e6;
+
+		pthread_mutex_lock(&srv->lock);
+		srv->free_threads += nb_thread;
+		srv->running--;
+		if (ret < 0)
+			srv->failed++;
+		else
+			srv->done++;
+		pthread_cond_broadcast(&srv->cond);
+		pthread_mutex_unlock(&srv->lock);
+
+		serve_reply_job(sj, &res, ret, start - sj->queued_ns);
+		conn_put(sj->conn);
+		free(sj);
+	}
+	return NULL;
+}
+
+static void serve_submit(struct serve_conn *conn, const char *line)
+{
+	struct serve *srv = conn->srv;
+	struct serve_job *sj;
+
+	if ((sj = calloc(1, sizeof(struct serve_job))) == NULL) {
+		conn_reply(conn, "err id=0 out of memory");
+		return;
+	}
+	if (job_parse(line, &sj->job) < 0) {
+		conn_reply(conn, "err id=%"PRIu64" %s", sj->job.id, sj->job.error);
+		free(sj);
+		return;
+	}
+	if (sj->job.nb_thread > srv->budget)
+		sj->job.nb_thread = srv->budget;
+	sj->conn = conn;
+
+	pthread_mutex_lock(&srv->lock);
+	sj->seq = ++srv->seq;
+	if (sj->job.id == 0)
+		sj->job.id = sj->seq;
+	if (srv->stopping || srv->len >= SERVE_MAX_QUEUE) {
+		int stopping = srv->stopping;
+		srv->rejected++;
+		pthread_mutex_unlock(&srv->lock);
+		if (stopping)
+			conn_reply(conn, "err id=%"PRIu64" server is shutting down", sj->job.id);
+		else
+			conn_reply(conn, "busy id=%"PRIu64, sj->job.id);
+		free(sj);
+		return;
+	}
+	pthread_mutex_lock(&conn->lock);
+	conn->refs++;
+	pthread_mutex_unlock(&conn->lock);
+	sj->queued_ns = serve_now();
+	heap_push(srv, sj);
+	pthread_cond_broadcast(&srv->cond);
+	pthread_mutex_unlock(&srv->lock);
+}
+
+/* under srv->lock */
+static void conn_link(struct serve *srv, struct serve_conn *conn)
+{
+	conn->prev = NULL;
+	conn->next = srv->conns;
+	if (srv->conns != NULL)
+		srv->conns->prev = conn;
+	srv->conns = conn;
+	srv->readers++;
+}
+
+static void conn_unlink(struct serve *srv, struct serve_conn *conn)
+{
+	if (conn->prev != NULL)
+		conn->prev->next = conn->next;
+	else
+		srv->conns = conn->next;
+	if (conn->next != NULL)
+		conn->next->prev = conn->prev;
+	srv->readers--;
+}
+
+/* end of input on the connections still open, then wait for their readers */
+static void serve_close_readers(struct serve *srv)
+{
+	struct serve_conn *conn;
+
+	pthread_mutex_lock(&srv->lock);
+	for (conn = srv->conns; conn != NULL; conn = conn->next)
+		shutdown(conn->fd, SHUT_RD);
+	while (srv->readers > 0)
+		pthread_cond_wait(&srv->cond, &srv->lock);
+	pthread_mutex_unlock(&srv->lock);
+}
+
+/* the counters are copied under the lock, the reply may block on a slow client */
+static void serve_stats(struct serve_conn *conn)
+{
+	struct serve *srv = conn->srv;
+	int budget, free_threads, queued, running;
+	uint64_t done, failed, rejected;
+
+	pthread_mutex_lock(&srv->lock);
+	budget = srv->budget;
+	free_threads = srv->free_threads;
+	queued = srv->len;
+	running = srv->running;
+	done = srv->done;
+	failed = srv->failed;
+	rejected = srv->rejected;
+	pthread_mutex_unlock(&srv->lock);
+	conn_reply(conn, "stats budget=%d free=%d queued=%d running=%d done=%"PRIu64" failed=%"PRIu64
+			" rejected=%"PRIu64, budget, free_threads, queued, running, done, failed, rejected);
+}
+
+static void *serve_reader(void *arg)
+{
+	struct serve_conn *conn = (struct serve_conn *) arg;
+	struct serve *srv = conn->srv;
+	char *line = NULL;
+	size_t cap = 0;
+	FILE *in;
+	int fd;
+
+	if ((fd = dup(conn->fd)) < 0 || (in = fdopen(fd, "r")) == NULL) {
+		if (fd >= 0)
+			close(fd);
+		goto done;
+	}
+	while (getline(&line, &cap, in) > 0) {
+		char *p = line + strspn(line, " \t");
+		p[strcspn(p, "\r\n")] = '\0';
+		if (*p == '\0' || *p == '#')
+			continue;
+		if (strcmp(p, "stats") == 0) {
+			serve_stats(conn);
+		} else if (strcmp(p, "shutdown") == 0) {
+			serve_stop(srv);
+			conn_reply(conn, "ok shutdown");
+		} else {
+			serve_submit(conn, p);
+		}
+	}
+	free(line);
+	fclose(in);
+done:
+	/* the last use of srv, serve_run may return once readers drops to zero */
+	pthread_mutex_lock(&srv->lock);
+	conn_unlink(srv, conn);
+	pthread_cond_broadcast(&srv->cond);
+	pthread_mutex_unlock(&srv->lock);
+	conn_put(conn);
+	return NULL;
+}
+
+int serve_run(const char *path, int budget, job_runner run)
+{
+	struct serve srv;
+	struct sockaddr_un addr;
+	pthread_t *runners = NULL;
+	pthread_attr_t attr;
+	int nb_runner = 0;
+	int ret = 0;
+	int i;
+
+	memset(&srv, 0, sizeof(srv));
+	pthread_mutex_init(&srv.lock, NULL);
+	pthread_cond_init(&srv.cond, NULL);
+	srv.budget = budget > 0 ? budget : 1;
+	srv.free_threads = srv.budget;
+	srv.run = run;
+	srv.listen_fd = -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		printf("Error: socket path too long %s\n", path);
+		goto err;
+	}
+	strcpy(addr.sun_path, path);
+
+	signal(SIGPIPE, SIG_IGN);
+	if ((srv.heap = calloc(SERVE_MAX_QUEUE, sizeof(struct serve_job *))) == NULL)
+		goto err;
+	if ((srv.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		perror("socket");
+		goto err;
+	}
+	unlink(path);
+	if (bind(srv.listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+			listen(srv.listen_fd, 64) < 0) {
+		perror(path);
+		goto err;
+	}
+
+	/* a job holds at least one thread, budget runners are always enough */
+	if ((runners = calloc(srv.budget, sizeof(pthread_t))) == NULL)
+		goto err;
+	for (nb_runner = 0; nb_runner < srv.budget; nb_runner++) {
+		if (pthread_create(&runners[nb_runner], NULL, serve_runner, &srv) != 0) {
+			printf("%s(): pthread_create error\n", __FUNCTION__);
+			goto err;
+		}
+	}
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for (;;) {
+		struct serve_conn *conn;
+		pthread_t reader;
+		int fd = accept(srv.listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR && !srv.stopping)
+				continue;
+			break;
+		}
+		if ((conn = calloc(1, sizeof(struct serve_conn))) == NULL) {
+			close(fd);
+			continue;
+		}
+		conn->fd = fd;
+		conn->refs = 1;
+		conn->srv = &srv;
+		pthread_mutex_init(&conn->lock, NULL);
+		pthread_mutex_lock(&srv.lock);
+		conn_link(&srv, conn);
+		pthread_mutex_unlock(&srv.lock);
+		if (pthread_create(&reader, &attr, serve_reader, conn) != 0) {
+			pthread_mutex_lock(&srv.lock);
+			conn_unlink(&srv, conn);
+			pthread_mutex_unlock(&srv.lock);
+			close(fd);
+			pthread_mutex_destroy(&conn->lock);
+			free(conn);
+		}
+	}
+	pthread_attr_destroy(&attr);
+
+done:
+	serve_stop(&srv);
+	for (i = 0; i < nb_runner; i++)
+		pthread_join(runners[i], NULL);
+	/* every job is replied, the readers only hold srv now */
+	serve_close_readers(&srv);
+	printf("served %"PRIu64" jobs, %"PRIu64" failed, %"PRIu64" rejected\n",
+			srv.done, srv.failed, srv.rejected);
+	if (srv.listen_fd >= 0) {
+		close(srv.listen_fd);
+		unlink(path);
+	}
+	FREE(runners);
+	FREE(srv.heap);
+	pthread_cond_destroy(&srv.cond);
+	pthread_mutex_destroy(&srv.lock);
+	return ret;
+err:
+	ret = -1;
+	goto done;
+}
+
+struct submit_writer {
+	int fd;
+	FILE *in;
+};
+
+static void *submit_write(void *arg)
+{
+	struct submit_writer *w = (struct submit_writer *) arg;
+	char *line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+
+	while ((len = getline(&line, &cap, w->in)) > 0) {
+		if (write_all(w->fd, line, len) < 0)
+			break;
+		if (line[len - 1] != '\n' && write_all(w->fd, "\n", 1) < 0)
+			break;
+	}
+	free(line);
+	shutdown(w->fd, SHUT_WR);
+	return NULL;
+}
+
+/*
+ * Send the lines of in to the server and copy the replies to out, until
+ * the server has replied to every job. Replies are read while the jobs
+ * are sent, so that a long list of jobs never fills both socket buffers.
+ */
+int submit_run(const char *path, FILE *in, FILE *out)
+{
+	struct sockaddr_un addr;
+	struct submit_writer w;
+	pthread_t writer;
+	char *line = NULL;
+	size_t cap = 0;
+	FILE *replies;
+	int errors = 0;
+	int fd, rfd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		printf("Error: socket path too long %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		perror("socket");
+		return -1;
+	}
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+	if ((rfd = dup(fd)) < 0 || (replies = fdopen(rfd, "r")) == NULL) {
+		perror("fdopen");
+		close(fd);
+		return -1;
+	}
+
+	w.fd = fd;
+	w.in = in;
+	if (pthread_create(&writer, NULL, submit_write, &w) != 0) {
+		printf("%s(): pthread_create error\n", __FUNCTION__);
+		fclose(replies);
+		close(fd);
+		return -1;
+	}
+	while (getline(&line, &cap, replies) > 0) {
+		fputs(line, out);
+		fflush(out);
+		if (strncmp(line, "err", 3) == 0 || strncmp(line, "busy", 4) == 0)
+			errors++;
+	}
+	pthread_join(writer, NULL);
+	free(line);
+	fclose(replies);
+	close(fd);
+	return errors > 0 ? -1 : 0;
+}
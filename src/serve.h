@@ -0,0 +1,21 @@
+/*
+ * serve.h
+ *
+ *  Created on: 2026-10-19
+ *
+ * Render daemon listening on a Unix socket, and its client
+ */
+
+#ifndef SERVE_H_
+#define SERVE_H_
+
+#include <stdio.h>
+#include "job.h"
+
+/* jobs waiting for threads, more are rejected with a busy reply */
+#define SERVE_MAX_QUEUE 1024
+
+int serve_run(const char *path, int budget, job_runner run);
+int submit_run(const char *path, FILE *in, FILE *out);
+
+#endif /* SERVE_H_ */
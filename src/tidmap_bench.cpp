@@ -0,0 +1,48 @@
+/*
+ * tidmap_bench.cpp
+ *
+ *  Created on: 2026-10-19
+ *
+ * C entry points used by dragonbench to measure TidMap under contention
+ */
+
+#include "TidMap.h"
+extern "C" {
+#include "utils.h"
+}
+#include "tidmap_bench.h"
+
+void *tidmap_bench_new(int size)
+{
+	return new TidMap(size);
+}
+
+void tidmap_bench_free(void *map)
+{
+	delete (TidMap *) map;
+}
+
+/* lookups through the tid, as done before getId() existed */
+int tidmap_bench_lookup_tid(void *map, uint64_t count)
+{
+	TidMap *tidMap = (TidMap *) map;
+	int tid = gettid();
+	int sum = 0;
+	uint64_t i;
+
+	for (i = 0; i < count; i++)
+		sum += tidMap->getIdFromTid(tid);
+	return sum;
+}
+
+/* lookups of the calling thread, as done by the TBB bodies */
+int tidmap_bench_lookup(void *map, uint64_t count)
+{
+	TidMap *tidMap = (TidMap *) map;
+	int sum = 0;
+	uint64_t i;
+
+	for (i = 0; i < count; i++)
+		sum += tidMap->getId();
+	return sum;
+}
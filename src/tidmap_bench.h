@@ -0,0 +1,23 @@
+/*
+ * tidmap_bench.h
+ *
+ *  Created on: 2026-10-19
+ */
+
+#ifndef TIDMAP_BENCH_H_
+#define TIDMAP_BENCH_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void *tidmap_bench_new(int size);
+void tidmap_bench_free(void *map);
+int tidmap_bench_lookup_tid(void *map, uint64_t count);
+int tidmap_bench_lookup(void *map, uint64_t count);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TIDMAP_BENCH_H_ */
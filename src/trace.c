@@ -0,0 +1,176 @@
+/*
+ * trace.c
+ *
+ *  Created on: 2026-10-19
+ *
+ * Each thread records its events in its own chunk, no lock is taken on
+ * the recording path. A full chunk is replaced by a new one, and chunks
+ * are published on a global list with a compare-and-swap so that they
+ * can be written at exit, even for threads that are gone.
+ *
+ * Event names must be string literals, they are stored by pointer.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "trace.h"
+#include "utils.h"
+
+#define TRACE_CHUNK_EVENTS 65536
+
+struct trace_event {
+	uint64_t ts;
+	const char *name;
+	uint64_t start;
+	uint64_t end;
+	char phase;
+	char has_range;
+};
+
+struct trace_chunk {
+	struct trace_chunk *next;
+	int tid;
+	int len;
+	struct trace_event events[TRACE_CHUNK_EVENTS];
+};
+
+int trace_enabled = 0;
+
+static char *trace_path = NULL;
+static uint64_t trace_origin = 0;
+static struct trace_chunk *trace_chunks = NULL;
+static __thread struct trace_chunk *trace_current = NULL;
+
+static uint64_t trace_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct trace_chunk *trace_chunk_new(void)
+{
+	struct trace_chunk *chunk;
+
+	chunk = (struct trace_chunk *) malloc(sizeof(struct trace_chunk));
+	if (chunk == NULL)
+		return NULL;
+	chunk->tid = gettid();
+	chunk->len = 0;
+	do {
+		chunk->next = trace_chunks;
+	} while (!__sync_bool_compare_and_swap(&trace_chunks, chunk->next, chunk));
+	return chunk;
+}
+
+static inline struct trace_event *trace_record(const char *name, char phase)
+{
+	struct trace_chunk *chunk = trace_current;
+	struct trace_event *ev;
+
+	if (chunk == NULL || chunk->len == TRACE_CHUNK_EVENTS) {
+		chunk = trace_chunk_new();
+		if (chunk == NULL)
+			return NULL;
+		trace_current = chunk;
+	}
+	ev = &chunk->events[chunk->len];
+	ev->ts = trace_now();
+	ev->name = name;
+	ev->phase = phase;
+	ev->has_range = 0;
+	chunk->len++;
+	return ev;
+}
+
+void trace_begin(const char *name)
+{
+	if (!trace_enabled)
+		return;
+	trace_record(name, 'B');
+}
+
+void trace_begin_range(const char *name, uint64_t start, uint64_t end)
+{
+	struct trace_event *ev;
+
+	if (!trace_enabled)
+		return;
+	ev = trace_record(name, 'B');
+	if (ev == NULL)
+		return;
+	ev->start = start;
+	ev->end = end;
+	ev->has_range = 1;
+}
+
+void trace_end(const char *name)
+{
+	if (!trace_enabled)
+		return;
+	trace_record(name, 'E');
+}
+
+static void trace_atexit(void)
+{
+	trace_flush();
+}
+
+int trace_open(const char *path)
+{
+	if (asprintf(&trace_path, "%s", path) < 0)
+		return -1;
+	trace_origin = trace_now();
+	trace_enabled = 1;
+	atexit(trace_atexit);
+	return 0;
+}
+
+/* write every chunk recorded so far, the chunks are released */
+int trace_flush(void)
+{
+	struct trace_chunk *chunk, *next;
+	FILE *f;
+	int first = 1;
+	int pid = getpid();
+	int i;
+
+	if (trace_path == NULL)
+		return 0;
+	trace_enabled = 0;
+
+	if ((f = fopen(trace_path, "w")) == NULL) {
+		perror("Failed to open trace output");
+		return -1;
+	}
+
+	fprintf(f, "{\"traceEvents\":[\n");
+	chunk = __sync_lock_test_and_set(&trace_chunks, NULL);
+	for (; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		for (i = 0; i < chunk->len; i++) {
+			struct trace_event *ev = &chunk->events[i];
+			fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+					first ? "" : ",\n", ev->name, ev->phase,
+					(ev->ts - trace_origin) / 1e3, pid, chunk->tid);
+			if (ev->has_range)
+				fprintf(f, ",\"args\":{\"start\":%"PRIu64",\"end\":%"PRIu64"}",
+						ev->start, ev->end);
+			fprintf(f, "}");
+			first = 0;
+		}
+		free(chunk);
+	}
+	fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+	fclose(f);
+
+	free(trace_path);
+	trace_path = NULL;
+	return 0;
+}
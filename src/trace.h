@@ -0,0 +1,22 @@
+/*
+ * trace.h
+ *
+ *  Created on: 2026-10-19
+ *
+ * Timeline of begin/end events, exported in Chrome trace-event format
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+
+extern int trace_enabled;
+
+int trace_open(const char *path);
+void trace_begin(const char *name);
+void trace_end(const char *name);
+void trace_begin_range(const char *name, uint64_t start, uint64_t end);
+int trace_flush(void);
+
+#endif /* TRACE_H_ */
@@ -0,0 +1,321 @@
+/*
+ * tune.c
+ *
+ *  Created on: 2026-10-19
+ *
+ * Calibration of the backends on this machine. For each power, every
+ * backend renders with 1, 2, 4... threads up to the processors usable by
+ * the process; the best one then tries a few splits of each stage. The
+ * processors are those of the affinity mask, fewer when the cgroup has a
+ * CPU quota.
+ *
+ * The profile is a text file, one measured power per line:
+ *
+ *   entry <power> <backend> <threads> <split limits> <split draw> <split render> <ms>
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tune.h"
+
+static int tune_splits[] = TUNE_SPLITS;
+#define NB_SPLITS ((int) (sizeof(tune_splits) / sizeof(tune_splits[0])))
+
+/* processors of a CPU quota, rounded up: quota and period in the same unit */
+static int quota_cpus(long long quota, long long period)
+{
+	if (quota <= 0 || period <= 0)
+		return 0;
+	return (int) ((quota + period - 1) / period);
+}
+
+/* cgroup v2: "max 100000" or "<quota> <period>" in cpu.max, the smallest of the ancestors */
+static int cgroup2_cpus(void)
+{
+	char line[4096], path[4200];
+	char *dir = NULL, *slash;
+	long long quota, period;
+	int cpus = 0, n;
+	FILE *f;
+
+	if ((f = fopen("/proc/self/cgroup", "r")) == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (strncmp(line, "0::", 3) == 0) {
+			line[strcspn(line, "\n")] = '\0';
+			dir = strdup(line + 3);
+			break;
+		}
+	}
+	fclose(f);
+	if (dir == NULL)
+		return 0;
+	for (;;) {
+		snprintf(path, sizeof(path), "/sys/fs/cgroup%s/cpu.max", dir);
+		if ((f = fopen(path, "r")) != NULL) {
+			if (fscanf(f, "%lld %lld", &quota, &period) == 2) {
+				n = quota_cpus(quota, period);
+				if (n > 0 && (cpus == 0 || n < cpus))
+					cpus = n;
+			}
+			fclose(f);
+		}
+		if ((slash = strrchr(dir, '/')) == NULL || dir[1] == '\0')
+			break;
+		if (slash == dir)
+			slash[1] = '\0';
+		else
+			*slash = '\0';
+	}
+	free(dir);
+	return cpus;
+}
+
+/* cgroup v1: cpu.cfs_quota_us is -1 without quota */
+static int cgroup1_cpus(void)
+{
+	long long quota = -1, period = 0;
+	FILE *f;
+
+	if ((f = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r")) != NULL) {
+		if (fscanf(f, "%lld", &quota) != 1)
+			quota = -1;
+		fclose(f);
+	}
+	if ((f = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r")) != NULL) {
+		if (fscanf(f, "%lld", &period) != 1)
+			period = 0;
+		fclose(f);
+	}
+	return quota_cpus(quota, period);
+}
+
+int tune_cpus(void)
+{
+	cpu_set_t set;
+	int cpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	int quota;
+
+	if (sched_getaffinity(0, sizeof(set), &set) == 0)
+		cpus = CPU_COUNT(&set);
+	if ((quota = cgroup2_cpus()) == 0)
+		quota = cgroup1_cpus();
+	if (quota > 0 && quota < cpus)
+		cpus = quota;
+	return cpus > 0 ? cpus : 1;
+}
+
+static double tune_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* best time of TUNE_REPEAT renders, negative on error */
+static double tune_time(struct dragon_ctx *ctx, uint64_t size, struct rgb *image, int width, int height)
+{
+	double best = -1, t;
+	char *canvas = NULL;
+	int i;
+
+	for (i = 0; i < TUNE_REPEAT; i++) {
+		t = tune_now_ms();
+		if (dragon_ctx_draw(ctx, &canvas, image, width, height, size) < 0)
+			return -1;
+		t = tune_now_ms() - t;
+		dragon_ctx_free(ctx, canvas);
+		canvas = NULL;
+		if (best < 0 || t < best)
+			best = t;
+	}
+	return best;
+}
+
+/* splits of the stages, one after the other, for the best backend of the power */
+static int tune_split(struct tune_entry *best, uint64_t size, struct rgb *image, int width, int height)
+{
+	struct dragon_ctx ctx;
+	int stage, i, keep;
+	double ms;
+
+	if (dragon_ctx_init(&ctx, best->backend, best->nb_thread, NULL) < 0)
+		return -1;
+	for (stage = 0; stage < PERF_STAGE_MAX; stage++) {
+		keep = ctx.split[stage];
+		for (i = 0; i < NB_SPLITS; i++) {
+			if (tune_splits[i] == keep)
+				continue;
+			ctx.split[stage] = tune_splits[i];
+			if ((ms = tune_time(&ctx, size, image, width, height)) < 0)
+				goto err;
+			if (ms < best->ms) {
+				best->ms = ms;
+				memcpy(best->split, ctx.split, sizeof(best->split));
+			}
+		}
+		ctx.split[stage] = best->split[stage];
+	}
+	dragon_ctx_release(&ctx);
+	return 0;
+err:
+	dragon_ctx_release(&ctx);
+	return -1;
+}
+
+/* backends is NULL terminated, each one is measured at each power of TUNE_POWER_* */
+int tune_calibrate(struct tune_profile *prof, const struct dragon_backend * const *backends,
+		int width, int height, int verbose)
+{
+	struct rgb *image;
+	struct dragon_ctx ctx;
+	int power, b, t, stop, serial = 1;
+	double ms;
+
+	memset(prof, 0, sizeof(*prof));
+	prof->nb_cpu = tune_cpus();
+	prof->width = width;
+	prof->height = height;
+	prof->serial_cutoff = -1;
+	if ((image = make_canvas(width, height)) == NULL)
+		return -1;
+
+	for (power = TUNE_POWER_MIN; power <= TUNE_POWER_MAX; power += TUNE_POWER_STEP) {
+		struct tune_entry *best = &prof->entries[prof->nb_entry];
+		uint64_t size = 1ULL << power;
+
+		best->power = power;
+		best->ms = -1;
+		for (b = 0; backends[b] != NULL; b++) {
+			/* 1, 2, 4... and every processor */
+			for (t = 1, stop = 0; !stop; t = t * 2 < prof->nb_cpu ? t * 2 : prof->nb_cpu) {
+				stop = t == prof->nb_cpu || backends[b] == &dragon_backend_serial;
+				if (dragon_ctx_init(&ctx, backends[b], t, NULL) < 0)
+					goto err;
+				ms = tune_time(&ctx, size, image, width, height);
+				dragon_ctx_release(&ctx);
+				if (ms < 0)
+					goto err;
+				if (verbose)
+					printf("tune power=%d lib=%s thread=%d ms=%.3f\n", power,
+							backends[b]->name, t, ms);
+				if (best->ms < 0 || ms < best->ms) {
+					best->backend = backends[b];
+					best->nb_thread = t;
+					best->ms = ms;
+				}
+			}
+		}
+		if (best->backend->split && tune_split(best, size, image, width, height) < 0)
+			goto err;
+		if (serial && best->backend == &dragon_backend_serial)
+			prof->serial_cutoff = power;
+		else
+			serial = 0;
+		prof->nb_entry++;
+	}
+	ARENA_FREE(image);
+	return 0;
+err:
+	ARENA_FREE(image);
+	return -1;
+}
+
+/*
+ * Returns 0 on success, -1 when the file is missing, not a profile, or
+ * names a backend not in backends.
+ */
+int tune_load(struct tune_profile *prof, const char *path, const struct dragon_backend * const *backends)
+{
+	char line[256], name[64];
+	struct tune_entry *e;
+	FILE *f;
+	int b, ret = 0;
+
+	memset(prof, 0, sizeof(*prof));
+	prof->serial_cutoff = -1;
+	if ((f = fopen(path, "r")) == NULL)
+		return -1;
+	if (fgets(line, sizeof(line), f) == NULL || strncmp(line, TUNE_HEADER, strlen(TUNE_HEADER)) != 0)
+		goto err;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "cpus %d", &prof->nb_cpu) == 1 ||
+				sscanf(line, "image %d %d", &prof->width, &prof->height) == 2 ||
+				sscanf(line, "cutoff %d", &prof->serial_cutoff) == 1)
+			continue;
+		if (prof->nb_entry == TUNE_ENTRIES)
+			goto err;
+		e = &prof->entries[prof->nb_entry];
+		if (sscanf(line, "entry %d %63s %d %d %d %d %lf", &e->power, name, &e->nb_thread,
+				&e->split[PERF_STAGE_LIMITS], &e->split[PERF_STAGE_DRAW],
+				&e->split[PERF_STAGE_RENDER], &e->ms) != 7 || e->nb_thread <= 0)
+			goto err;
+		for (b = 0; backends[b] != NULL; b++) {
+			if (strcmp(backends[b]->name, name) == 0)
+				e->backend = backends[b];
+		}
+		if (e->backend == NULL)
+			goto err;
+		prof->nb_entry++;
+	}
+	if (prof->nb_entry == 0)
+		goto err;
+done:
+	fclose(f);
+	return ret;
+err:
+	ret = -1;
+	goto done;
+}
+
+int tune_save(struct tune_profile *prof, const char *path)
+{
+	struct tune_entry *e;
+	FILE *f;
+	int i;
+
+	if ((f = fopen(path, "w")) == NULL)
+		return -1;
+	fprintf(f, "%s\n", TUNE_HEADER);
+	fprintf(f, "cpus %d\n", prof->nb_cpu);
+	fprintf(f, "image %d %d\n", prof->width, prof->height);
+	fprintf(f, "cutoff %d\n", prof->serial_cutoff);
+	for (i = 0; i < prof->nb_entry; i++) {
+		e = &prof->entries[i];
+		fprintf(f, "entry %d %s %d %d %d %d %.3f\n", e->power, e->backend->name, e->nb_thread,
+				e->split[PERF_STAGE_LIMITS], e->split[PERF_STAGE_DRAW],
+				e->split[PERF_STAGE_RENDER], e->ms);
+	}
+	return fclose(f) == 0 ? 0 : -1;
+}
+
+/*
+ * Serial up to the cutoff, then the entry of the largest measured power not
+ * above the size: the first one after the cutoff for the sizes in between.
+ */
+const struct tune_entry *tune_pick(struct tune_profile *prof, uint64_t size)
+{
+	static const struct tune_entry serial = { .backend = &dragon_backend_serial, .nb_thread = 1 };
+	const struct tune_entry *pick = NULL;
+	int power = 0, i;
+
+	while ((1ULL << (power + 1)) <= size)
+		power++;
+	if (power <= prof->serial_cutoff)
+		return &serial;
+	for (i = 0; i < prof->nb_entry; i++) {
+		const struct tune_entry *e = &prof->entries[i];
+		if (e->power <= prof->serial_cutoff)
+			continue;
+		if (pick == NULL || e->power <= power)
+			pick = e;
+	}
+	return pick != NULL ? pick : &serial;
+}
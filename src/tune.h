@@ -0,0 +1,50 @@
+/*
+ * tune.h
+ *
+ *  Created on: 2026-10-19
+ *
+ * Tuning profile of the machine: backend, threads and split of the stages
+ * measured for a few powers, and picked for each size to render
+ */
+
+#ifndef TUNE_H_
+#define TUNE_H_
+
+#include "context.h"
+
+/* powers measured by the calibration */
+#define TUNE_POWER_MIN	8
+#define TUNE_POWER_MAX	20
+#define TUNE_POWER_STEP	2
+#define TUNE_ENTRIES	((TUNE_POWER_MAX - TUNE_POWER_MIN) / TUNE_POWER_STEP + 1)
+/* best time of a few renders */
+#define TUNE_REPEAT	3
+/* ranges per thread tried for each stage, 0 is the split of the backend */
+#define TUNE_SPLITS	{ 0, 1, 4, 16 }
+#define TUNE_HEADER	"# dragonizer tuning profile 1"
+
+struct tune_entry {
+	int power;
+	const struct dragon_backend *backend;
+	int nb_thread;
+	int split[PERF_STAGE_MAX];
+	double ms;
+};
+
+struct tune_profile {
+	int nb_cpu;
+	int width;
+	int height;
+	int serial_cutoff;	/* powers up to it are drawn serially, -1 if none */
+	int nb_entry;
+	struct tune_entry entries[TUNE_ENTRIES];
+};
+
+int tune_cpus(void);
+int tune_calibrate(struct tune_profile *prof, const struct dragon_backend * const *backends,
+        int width, int height, int verbose);
+int tune_load(struct tune_profile *prof, const char *path, const struct dragon_backend * const *backends);
+int tune_save(struct tune_profile *prof, const char *path);
+const struct tune_entry *tune_pick(struct tune_profile *prof, uint64_t size);
+
+#endif /* TUNE_H_ */
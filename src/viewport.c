@@ -0,0 +1,804 @@
+/*
+ * viewport.c
+ *
+ *  Created on: 2026-10-19
+ *
+ * Block hierarchy of the dragon. The segments ]b 2^k, (b + 1) 2^k] form
+ * the block b of level k. Inside the block, only the turn in its middle
+ * depends on b, through its parity, so every block is a rotated and
+ * translated copy of one of two prototypes:
+ *
+ *   Q(0, p) = one segment: position (1,1), orientation (1,1), limits (0,0)-(1,1)
+ *   Q(k, p) = Q(k-1, 0), turn (left if p is odd), Q(k-1, 1)
+ *
+ * The prototypes stop before the turn following their last segment, which
+ * depends on the blocks after them. They are composed with piece_merge,
+ * so the limits of the whole curve cost O(log size), and the bounding box
+ * of any block is known before tracing it: a viewport only descends into
+ * the blocks crossing its window and traces the leaves.
+ *
+ * A block has no two segments in the same cell, so a block whose cells all
+ * fall in one pixel of the image adds exactly its 2^k segments to the pixel
+ * without being traced: this is the preview. The prototypes up to one
+ * pixel wide also carry the fill counts of a lod x lod grid over their
+ * bounding box. A block of one color straddling pixels adds the count of
+ * each box of the grid to the pixels it covers, in proportion to the area
+ * of the box in each. A pixel then misses at most min(count, area) cells
+ * per straddling box, which bounds its color error.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "viewport.h"
+#include "color.h"
+#include "perf.h"
+#include "trace.h"
+
+static piece_t blocks[BLOCK_LEVELS][2];
+static pthread_once_t blocks_once = PTHREAD_ONCE_INIT;
+
+static void blocks_init(void)
+{
+	int k, p;
+
+	for (p = 0; p < 2; p++) {
+		piece_t *q = &blocks[0][p];
+		q->position.x = 1;
+		q->position.y = 1;
+		q->orientation.x = 1;
+		q->orientation.y = 1;
+		q->limits.minimums.x = 0;
+		q->limits.minimums.y = 0;
+		q->limits.maximums.x = 1;
+		q->limits.maximums.y = 1;
+	}
+	for (k = 1; k < BLOCK_LEVELS; k++) {
+		for (p = 0; p < 2; p++) {
+			piece_t q = blocks[k - 1][0];
+			if (p)
+				rotate_left(&q.orientation);
+			else
+				rotate_right(&q.orientation);
+			piece_merge(&q, blocks[k - 1][1]);
+			blocks[k][p] = q;
+		}
+	}
+}
+
+/* prototype of the blocks of level k and of parity p */
+const piece_t *dragon_block(int k, int parity)
+{
+	pthread_once(&blocks_once, blocks_init);
+	return &blocks[k][parity & 1];
+}
+
+/* turn following segment n */
+static inline void block_turn(xy_t *orientation, uint64_t n)
+{
+	if (((n & -n) << 1) & n)
+		rotate_left(orientation);
+	else
+		rotate_right(orientation);
+}
+
+/* the block placed at the end of m, m is left at the end of the block */
+static inline void block_append(piece_t *m, int k, uint64_t b)
+{
+	piece_merge(m, *dragon_block(k, b & 1));
+}
+
+/* position and orientation at the start of the second half of the block b of level k */
+static inline void block_half(int k, uint64_t b, xy_t *position, xy_t *orientation)
+{
+	piece_t m;
+
+	m.position = *position;
+	m.orientation = *orientation;
+	m.limits.minimums = *position;
+	m.limits.maximums = *position;
+	block_append(&m, k - 1, 2 * b);
+	block_turn(&m.orientation, (b << k) + (1ULL << (k - 1)));
+	*position = m.position;
+	*orientation = m.orientation;
+}
+
+/* limits of ]0, size] from the aligned blocks of the binary decomposition of size */
+int dragon_limits_blocks(limits_t *limits, uint64_t size, __attribute__((unused)) int nb_thread)
+{
+	piece_t m;
+	uint64_t start = 0;
+	int k;
+
+	if (size >> BLOCK_LEVELS)
+		return -1;
+	piece_init(&m);
+	for (k = BLOCK_LEVELS - 1; k >= 0; k--) {
+		if (!((size >> k) & 1))
+			continue;
+		block_append(&m, k, start >> k);
+		start += 1ULL << k;
+		block_turn(&m.orientation, start);
+	}
+	*limits = m.limits;
+	return 0;
+}
+
+/* limits of the segments ]lo, hi], from the aligned blocks covering them */
+void dragon_range_limits(uint64_t lo, uint64_t hi, limits_t *limits)
+{
+	piece_t m;
+	int k;
+
+	m.position = compute_position(lo);
+	m.orientation = compute_orientation(lo);
+	m.limits.minimums = m.position;
+	m.limits.maximums = m.position;
+	while (lo < hi) {
+		for (k = 0; k + 1 < BLOCK_LEVELS && !((lo >> k) & 1) &&
+				lo + (2ULL << k) <= hi; k++)
+			;
+		block_append(&m, k, lo >> k);
+		lo += 1ULL << k;
+		block_turn(&m.orientation, lo);
+	}
+	*limits = m.limits;
+}
+
+int viewport_parse(const char *arg, struct dragon_viewport *vp)
+{
+	if (sscanf(arg, "%lf,%lf,%lf,%lf", &vp->x0, &vp->y0, &vp->x1, &vp->y1) != 4)
+		return -1;
+	if (vp->x0 < 0 || vp->y0 < 0 || vp->x1 > 1 || vp->y1 > 1 ||
+			vp->x0 >= vp->x1 || vp->y0 >= vp->y1)
+		return -1;
+	return 0;
+}
+
+void viewport_cells(struct dragon_viewport *vp, limits_t *limits, struct viewport_cells *cells)
+{
+	int64_t width = limits->maximums.x - limits->minimums.x;
+	int64_t height = limits->maximums.y - limits->minimums.y;
+
+	cells->j0 = (int64_t) floor(vp->x0 * width);
+	cells->i0 = (int64_t) floor(vp->y0 * height);
+	cells->j1 = (int64_t) ceil(vp->x1 * width);
+	cells->i1 = (int64_t) ceil(vp->y1 * height);
+	if (cells->j1 > width)
+		cells->j1 = width;
+	if (cells->i1 > height)
+		cells->i1 = height;
+	if (cells->j1 <= cells->j0)
+		cells->j1 = cells->j0 + 1;
+	if (cells->i1 <= cells->i0)
+		cells->i1 = cells->i0 + 1;
+}
+
+struct viewport_walk {
+	char *dragon;
+	int width;
+	int height;
+	limits_t full;		/* limits of the whole curve */
+	limits_t window;	/* limits shifted to the origin of the window */
+	struct viewport_cells cells;
+	uint64_t size;
+	int nb_colors;
+	int ret;
+};
+
+/* the cells of a block of positions in limits cross the window */
+static inline int viewport_hit(struct viewport_walk *vw, limits_t *limits)
+{
+	int64_t j_min = limits->minimums.x - vw->full.minimums.x;
+	int64_t j_max = limits->maximums.x - vw->full.minimums.x - 1;
+	int64_t i_min = limits->minimums.y - vw->full.minimums.y;
+	int64_t i_max = limits->maximums.y - vw->full.minimums.y - 1;
+
+	return j_min < vw->cells.j1 && j_max >= vw->cells.j0 &&
+			i_min < vw->cells.i1 && i_max >= vw->cells.i0;
+}
+
+/* trace ]lo, hi] in the window, with the colors of dragon_draw_serial */
+static void viewport_trace(struct viewport_walk *vw, uint64_t lo, uint64_t hi)
+{
+	uint64_t m = lo * vw->nb_colors / vw->size;
+
+	for (; m < (uint64_t) vw->nb_colors; m++) {
+		uint64_t start = m * vw->size / vw->nb_colors;
+		uint64_t end = (m + 1) * vw->size / vw->nb_colors;
+		if (start >= hi)
+			break;
+		if (end <= lo)
+			continue;
+		if (start < lo)
+			start = lo;
+		if (end > hi)
+			end = hi;
+		if (dragon_draw_walk(start, end, vw->dragon, vw->width, vw->height,
+				vw->window, m, WALK_CLIP) < 0)
+			vw->ret = -1;
+	}
+}
+
+/* block b of level k, starting at position facing orientation */
+static void viewport_block(struct viewport_walk *vw, int k, uint64_t b, xy_t position, xy_t orientation)
+{
+	piece_t m;
+
+	m.position = position;
+	m.orientation = orientation;
+	m.limits.minimums = position;
+	m.limits.maximums = position;
+	block_append(&m, k, b);
+	if (!viewport_hit(vw, &m.limits))
+		return;
+
+	if (k <= VIEWPORT_LEAF) {
+		viewport_trace(vw, b << k, (b + 1) << k);
+		return;
+	}
+
+	viewport_block(vw, k - 1, 2 * b, position, orientation);
+	block_half(k, b, &position, &orientation);
+	viewport_block(vw, k - 1, 2 * b + 1, position, orientation);
+}
+
+/* trace the blocks of the whole curve crossing the window */
+static void viewport_blocks(struct viewport_walk *vw)
+{
+	piece_t s;
+	uint64_t start = 0;
+	int k;
+
+	piece_init(&s);
+	for (k = BLOCK_LEVELS - 1; k >= 0; k--) {
+		if (!((vw->size >> k) & 1))
+			continue;
+		viewport_block(vw, k, start >> k, s.position, s.orientation);
+		block_append(&s, k, start >> k);
+		start += 1ULL << k;
+		block_turn(&s.orientation, start);
+	}
+}
+
+/* canvas of the window of cells of vw, its limits are shifted to the window */
+static void viewport_window(struct viewport_walk *vw)
+{
+	vw->width = vw->cells.j1 - vw->cells.j0;
+	vw->height = vw->cells.i1 - vw->cells.i0;
+	vw->window.minimums.x = vw->full.minimums.x + vw->cells.j0;
+	vw->window.minimums.y = vw->full.minimums.y + vw->cells.i0;
+	vw->window.maximums.x = vw->window.minimums.x + vw->width;
+	vw->window.maximums.y = vw->window.minimums.y + vw->height;
+}
+
+/*
+ * Draw the window vp of the dragon of size segments in a canvas of the
+ * size of the window, then scale it to the image. The canvas is the crop
+ * of the one of dragon_draw_serial, only the blocks crossing the window
+ * are traced.
+ */
+int dragon_draw_viewport(char **canvas, struct rgb *image, int width, int height, uint64_t size,
+		int nb_thread, struct dragon_viewport *vp, struct viewport_cells *cells)
+{
+	struct viewport_walk vw;
+	struct palette *palette = NULL;
+	struct perf_sample ps;
+	int ret = 0;
+
+	*canvas = NULL;
+	memset(&vw, 0, sizeof(vw));
+	trace_begin("limits");
+	perf_stage_begin(&ps);
+	ret = dragon_limits_blocks(&vw.full, size, nb_thread);
+	perf_stage_end(&ps, PERF_STAGE_LIMITS, 0);
+	trace_end("limits");
+	if (ret < 0)
+		goto err;
+
+	viewport_cells(vp, &vw.full, &vw.cells);
+	*cells = vw.cells;
+	viewport_window(&vw);
+	vw.size = size;
+	vw.nb_colors = nb_thread;
+
+	if ((vw.dragon = make_dragon((uint64_t) vw.width * vw.height)) == NULL) {
+		printf("malloc error dragon\n");
+		goto err;
+	}
+	if ((palette = init_palette(nb_thread)) == NULL)
+		goto err;
+
+	trace_begin("draw");
+	perf_stage_begin(&ps);
+	viewport_blocks(&vw);
+	perf_stage_end(&ps, PERF_STAGE_DRAW, 0);
+	trace_end("draw");
+	if (vw.ret < 0)
+		goto err;
+
+	trace_begin("render");
+	perf_stage_begin(&ps);
+	scale_dragon(0, height, image, width, height, vw.dragon, vw.width, vw.height, palette);
+	perf_stage_end(&ps, PERF_STAGE_RENDER, 0);
+	trace_end("render");
+
+	*canvas = vw.dragon;
+done:
+	free_palette(palette);
+	return ret;
+err:
+	ARENA_FREE(vw.dragon);
+	ret = -1;
+	goto done;
+}
+
+/* canvas of a band of band_rows image rows, scale canvas rows each */
+uint64_t band_canvas_bytes(int dragon_width, int scale, int band_rows)
+{
+	return (uint64_t) dragon_width * scale * band_rows;
+}
+
+/*
+ * Image of dragon_draw_serial, drawn band by band of band_rows image rows:
+ * a band is the window of the canvas rows read by its image rows, so only
+ * the canvas of one band is allocated. The leaves crossing two bands are
+ * traced for each of them.
+ */
+int dragon_draw_banded(struct rgb *image, int width, int height, uint64_t size, int nb_thread,
+		int band_rows)
+{
+	struct viewport_walk vw;
+	struct palette *palette = NULL;
+	struct perf_sample ps;
+	int dragon_width, dragon_height;
+	int scale, scale_x, scale_y, deltaI;
+	int y;
+	int ret = 0;
+
+	memset(&vw, 0, sizeof(vw));
+	trace_begin("limits");
+	perf_stage_begin(&ps);
+	ret = dragon_limits_blocks(&vw.full, size, nb_thread);
+	perf_stage_end(&ps, PERF_STAGE_LIMITS, 0);
+	trace_end("limits");
+	if (ret < 0 || band_rows <= 0)
+		goto err;
+
+	dragon_width = vw.full.maximums.x - vw.full.minimums.x;
+	dragon_height = vw.full.maximums.y - vw.full.minimums.y;
+	scale_x = dragon_width / width + 1;
+	scale_y = dragon_height / height + 1;
+	scale = (scale_x > scale_y ? scale_x : scale_y);
+	deltaI = (scale * height - dragon_height) / 2;
+	vw.size = size;
+	vw.nb_colors = nb_thread;
+
+	if ((vw.dragon = make_dragon(band_canvas_bytes(dragon_width, scale, band_rows))) == NULL) {
+		printf("malloc error dragon\n");
+		goto err;
+	}
+	if ((palette = init_palette(nb_thread)) == NULL)
+		goto err;
+
+	for (y = 0; y < height; y += band_rows) {
+		int end = y + band_rows < height ? y + band_rows : height;
+		int64_t i0 = (int64_t) y * scale - deltaI;
+		int64_t i1 = (int64_t) end * scale - deltaI;
+
+		if (i0 < 0)
+			i0 = 0;
+		if (i1 > dragon_height)
+			i1 = dragon_height;
+		if (i1 > i0) {
+			vw.cells.j0 = 0;
+			vw.cells.j1 = dragon_width;
+			vw.cells.i0 = i0;
+			vw.cells.i1 = i1;
+			viewport_window(&vw);
+			memset(vw.dragon, 0, (uint64_t) vw.width * vw.height);
+			trace_begin_range("draw", i0, i1);
+			perf_stage_begin(&ps);
+			viewport_blocks(&vw);
+			perf_stage_end(&ps, PERF_STAGE_DRAW, 0);
+			trace_end("draw");
+			if (vw.ret < 0)
+				goto err;
+		}
+
+		trace_begin_range("render", y, end);
+		perf_stage_begin(&ps);
+		scale_dragon_band(y, end, image, width, height, vw.dragon, i0, dragon_width, dragon_height,
+				palette);
+		perf_stage_end(&ps, PERF_STAGE_RENDER, 0);
+		trace_end("render");
+	}
+
+done:
+	ARENA_FREE(vw.dragon);
+	free_palette(palette);
+	return ret;
+err:
+	ret = -1;
+	goto done;
+}
+
+/*
+ * Image of dragon_draw_serial without a canvas: each segment is summed in
+ * its pixel. No two segments share a cell, so the sums are the ones of the
+ * canvas cells.
+ */
+int dragon_draw_accum(struct rgb *image, int width, int height, uint64_t size, int nb_thread)
+{
+	struct dragon_accum acc;
+	struct palette *palette = NULL;
+	struct perf_sample ps;
+	limits_t limits;
+	int m;
+	int ret = 0;
+
+	memset(&acc, 0, sizeof(acc));
+	trace_begin("limits");
+	perf_stage_begin(&ps);
+	ret = dragon_limits_blocks(&limits, size, nb_thread);
+	perf_stage_end(&ps, PERF_STAGE_LIMITS, 0);
+	trace_end("limits");
+	if (ret < 0)
+		goto err;
+
+	if (accum_init(&acc, width, height, limits.maximums.x - limits.minimums.x,
+			limits.maximums.y - limits.minimums.y) < 0)
+		goto err;
+	if ((palette = init_palette(nb_thread)) == NULL)
+		goto err;
+
+	trace_begin("draw");
+	perf_stage_begin(&ps);
+	for (m = 0; m < nb_thread; m++) {
+		uint64_t start = m * size / nb_thread;
+		uint64_t end = (m + 1) * size / nb_thread;
+		if (dragon_accum_raw(start, end, &acc, limits, palette->colors[m], DRAW_FLAGS) < 0)
+			goto err;
+	}
+	perf_stage_end(&ps, PERF_STAGE_DRAW, 0);
+	trace_end("draw");
+
+	trace_begin("render");
+	perf_stage_begin(&ps);
+	accum_render(&acc, 0, height, image);
+	perf_stage_end(&ps, PERF_STAGE_RENDER, 0);
+	trace_end("render");
+
+done:
+	accum_free(&acc);
+	free_palette(palette);
+	return ret;
+err:
+	ret = -1;
+	goto done;
+}
+
+struct preview_walk {
+	struct dragon_accum acc;
+	uint64_t *spread;	/* cells of the pixel placed by proportion */
+	uint64_t *grids;	/* fill counts of the prototypes, lod x lod by level and parity */
+	int grid_levels;	/* prototypes with a grid */
+	int lod;
+	limits_t full;
+	struct palette *palette;
+	uint64_t size;
+	int nb_colors;
+};
+
+/* edge e of the grid of lod boxes over a side of w cells */
+static inline int64_t grid_edge(int64_t w, int e, int lod)
+{
+	return w * e / lod;
+}
+
+static inline uint64_t *preview_grid(struct preview_walk *pw, int k, int parity)
+{
+	return pw->grids + ((uint64_t) k * 2 + (parity & 1)) * pw->lod * pw->lod;
+}
+
+/* count the cells of the prototype (k, parity) in the boxes of its grid */
+static void preview_grid_fill(struct preview_walk *pw, int k, int parity)
+{
+	const piece_t *q = dragon_block(k, parity);
+	uint64_t *grid = preview_grid(pw, k, parity);
+	int64_t w = q->limits.maximums.x - q->limits.minimums.x;
+	int64_t h = q->limits.maximums.y - q->limits.minimums.y;
+	uint64_t base = (uint64_t) (parity & 1) << k;
+	uint64_t r;
+	xy_t p = { 0, 0 }, o = { 1, 1 };
+	int u, v;
+
+	for (r = 1; r <= 1ULL << k; r++) {
+		int64_t cx = (o.x < 0 ? p.x - 1 : p.x) - q->limits.minimums.x;
+		int64_t cy = (o.y < 0 ? p.y - 1 : p.y) - q->limits.minimums.y;
+		for (u = 0; u + 1 < pw->lod && grid_edge(w, u + 1, pw->lod) <= cx; u++)
+			;
+		for (v = 0; v + 1 < pw->lod && grid_edge(h, v + 1, pw->lod) <= cy; v++)
+			;
+		grid[v * pw->lod + u]++;
+		p.x += o.x;
+		p.y += o.y;
+		block_turn(&o, base + r);
+	}
+}
+
+/* grids of the prototypes at most one pixel wide */
+static int preview_grids_init(struct preview_walk *pw)
+{
+	int k, p;
+
+	pw->grids = (uint64_t *) calloc((uint64_t) BLOCK_LEVELS * 2 * pw->lod * pw->lod, sizeof(uint64_t));
+	if (pw->grids == NULL)
+		return -1;
+	for (k = 0; k < BLOCK_LEVELS; k++) {
+		for (p = 0; p < 2; p++) {
+			const piece_t *q = dragon_block(k, p);
+			if (q->limits.maximums.x - q->limits.minimums.x > pw->acc.scale ||
+					q->limits.maximums.y - q->limits.minimums.y > pw->acc.scale)
+				return 0;
+		}
+		preview_grid_fill(pw, k, 0);
+		preview_grid_fill(pw, k, 1);
+		pw->grid_levels = k + 1;
+	}
+	return 0;
+}
+
+/* share num / den of the segments ]lo, hi] in the pixel index, with their colors */
+static void preview_add(struct preview_walk *pw, uint64_t lo, uint64_t hi, uint64_t index,
+		uint64_t num, uint64_t den)
+{
+	uint64_t *sum = pw->acc.sums + 4 * index;
+	uint64_t m = lo * pw->nb_colors / pw->size;
+
+	for (; m < (uint64_t) pw->nb_colors; m++) {
+		uint64_t start = m * pw->size / pw->nb_colors;
+		uint64_t end = (m + 1) * pw->size / pw->nb_colors;
+		uint64_t cnt;
+		if (start >= hi)
+			break;
+		if (end <= lo)
+			continue;
+		if (start < lo)
+			start = lo;
+		if (end > hi)
+			end = hi;
+		cnt = (end - start) * num / den;
+		sum[0] += pw->palette->colors[m].r * cnt;
+		sum[1] += pw->palette->colors[m].g * cnt;
+		sum[2] += pw->palette->colors[m].b * cnt;
+		sum[3] += cnt;
+	}
+}
+
+/* the segments ]lo, hi] have the same color */
+static inline int preview_one_color(struct preview_walk *pw, uint64_t lo, uint64_t hi)
+{
+	uint64_t m = lo * pw->nb_colors / pw->size;
+
+	while ((m + 1) * pw->size / pw->nb_colors <= lo)
+		m++;
+	return (m + 1) * pw->size / pw->nb_colors >= hi;
+}
+
+/* pixel of the cell c, along an axis shifted by delta */
+static inline int64_t preview_pixel(struct preview_walk *pw, int64_t c, int delta)
+{
+	return (c + delta) / pw->acc.scale;
+}
+
+/* cells [c0, c1) in the pixels [p0, p1] of an axis shifted by delta */
+static inline void preview_pixels(struct preview_walk *pw, int64_t c0, int64_t c1, int delta,
+		int64_t *p0, int64_t *p1)
+{
+	*p0 = preview_pixel(pw, c0, delta);
+	*p1 = preview_pixel(pw, c1 - 1, delta);
+}
+
+/* count cells in the box [j0, j1) x [i0, i1) of the block ]lo, hi], spread over its pixels */
+static void preview_spread(struct preview_walk *pw, uint64_t lo, uint64_t hi, uint64_t count,
+		int64_t j0, int64_t j1, int64_t i0, int64_t i1)
+{
+	struct dragon_accum *acc = &pw->acc;
+	uint64_t box = (j1 - j0) * (i1 - i0);
+	int64_t x0, x1, y0, y1, x, y;
+
+	preview_pixels(pw, j0, j1, acc->deltaJ, &x0, &x1);
+	preview_pixels(pw, i0, i1, acc->deltaI, &y0, &y1);
+	if (x0 == x1 && y0 == y1) {
+		preview_add(pw, lo, hi, y0 * acc->image_width + x0, count, hi - lo);
+		return;
+	}
+	for (y = y0; y <= y1; y++) {
+		int64_t ci0 = y * acc->scale - acc->deltaI, ci1 = ci0 + acc->scale;
+		if (ci0 < i0) ci0 = i0;
+		if (ci1 > i1) ci1 = i1;
+		for (x = x0; x <= x1; x++) {
+			int64_t cj0 = x * acc->scale - acc->deltaJ, cj1 = cj0 + acc->scale;
+			uint64_t area, index = y * acc->image_width + x;
+			if (cj0 < j0) cj0 = j0;
+			if (cj1 > j1) cj1 = j1;
+			area = (cj1 - cj0) * (ci1 - ci0);
+			preview_add(pw, lo, hi, index, count * area / box, hi - lo);
+			pw->spread[index] += area < count ? area : count;
+		}
+	}
+}
+
+/* the block b of level k, placed at position facing orientation, by the boxes of its grid */
+static void preview_grid_spread(struct preview_walk *pw, int k, uint64_t b, xy_t position, xy_t orientation)
+{
+	const piece_t *q = dragon_block(k, b & 1);
+	uint64_t *grid = preview_grid(pw, k, b);
+	int64_t w = q->limits.maximums.x - q->limits.minimums.x;
+	int64_t h = q->limits.maximums.y - q->limits.minimums.y;
+	int u, v;
+
+	for (v = 0; v < pw->lod; v++) {
+		for (u = 0; u < pw->lod; u++) {
+			xy_t c0, c1, ref = { 1, 1 };
+			if (grid[v * pw->lod + u] == 0)
+				continue;
+			c0.x = q->limits.minimums.x + grid_edge(w, u, pw->lod);
+			c0.y = q->limits.minimums.y + grid_edge(h, v, pw->lod);
+			c1.x = q->limits.minimums.x + grid_edge(w, u + 1, pw->lod);
+			c1.y = q->limits.minimums.y + grid_edge(h, v + 1, pw->lod);
+			/* the prototype starts facing (1, 1) */
+			while (ref.x != orientation.x || ref.y != orientation.y) {
+				rotate_left(&ref);
+				rotate_left(&c0);
+				rotate_left(&c1);
+			}
+			preview_spread(pw, b << k, (b + 1) << k, grid[v * pw->lod + u],
+					(c0.x < c1.x ? c0.x : c1.x) + position.x - pw->full.minimums.x,
+					(c0.x < c1.x ? c1.x : c0.x) + position.x - pw->full.minimums.x,
+					(c0.y < c1.y ? c0.y : c1.y) + position.y - pw->full.minimums.y,
+					(c0.y < c1.y ? c1.y : c0.y) + position.y - pw->full.minimums.y);
+		}
+	}
+}
+
+static void preview_block(struct preview_walk *pw, int k, uint64_t b, xy_t position, xy_t orientation)
+{
+	struct dragon_accum *acc = &pw->acc;
+	uint64_t lo = b << k, hi = (b + 1) << k;
+	int64_t j0, j1, i0, i1, x0, x1, y0, y1;
+	piece_t m;
+
+	m.position = position;
+	m.orientation = orientation;
+	m.limits.minimums = position;
+	m.limits.maximums = position;
+	block_append(&m, k, b);
+
+	j0 = m.limits.minimums.x - pw->full.minimums.x;
+	j1 = m.limits.maximums.x - pw->full.minimums.x;
+	i0 = m.limits.minimums.y - pw->full.minimums.y;
+	i1 = m.limits.maximums.y - pw->full.minimums.y;
+	preview_pixels(pw, j0, j1, acc->deltaJ, &x0, &x1);
+	preview_pixels(pw, i0, i1, acc->deltaI, &y0, &y1);
+
+	if (x0 == x1 && y0 == y1) {
+		preview_add(pw, lo, hi, y0 * acc->image_width + x0, 1, 1);
+	} else if (k < pw->grid_levels && preview_one_color(pw, lo, hi)) {
+		preview_grid_spread(pw, k, b, position, orientation);
+	} else {
+		preview_block(pw, k - 1, 2 * b, position, orientation);
+		block_half(k, b, &position, &orientation);
+		preview_block(pw, k - 1, 2 * b + 1, position, orientation);
+	}
+}
+
+/*
+ * Preview of the dragon of size segments, in the pixels of scale_dragon,
+ * with the fill counts of a lod x lod grid over the straddling blocks.
+ * max_error receives the bound of the color error of a channel against
+ * dragon_draw_serial.
+ */
+int dragon_draw_preview(struct rgb *image, int width, int height, uint64_t size, int nb_thread,
+		int lod, struct preview_error *error)
+{
+	struct preview_walk pw;
+	struct perf_sample ps;
+	piece_t s;
+	uint64_t start = 0;
+	uint64_t hist[256];
+	uint64_t total = 0, pixels, seen;
+	int k, x, y;
+	int ret = 0;
+
+	memset(&pw, 0, sizeof(pw));
+	memset(error, 0, sizeof(*error));
+	memset(hist, 0, sizeof(hist));
+	trace_begin("limits");
+	perf_stage_begin(&ps);
+	ret = dragon_limits_blocks(&pw.full, size, nb_thread);
+	perf_stage_end(&ps, PERF_STAGE_LIMITS, 0);
+	trace_end("limits");
+	if (ret < 0)
+		goto err;
+
+	if (accum_init(&pw.acc, width, height, pw.full.maximums.x - pw.full.minimums.x,
+			pw.full.maximums.y - pw.full.minimums.y) < 0)
+		goto err;
+	pw.spread = (uint64_t *) arena_alloc_zero(&dragon_arena, sizeof(uint64_t) * width * height);
+	if (pw.spread == NULL)
+		goto err;
+	if ((pw.palette = init_palette(nb_thread)) == NULL)
+		goto err;
+	pw.size = size;
+	pw.nb_colors = nb_thread;
+	pw.lod = lod < 1 ? 1 : (lod > PREVIEW_LOD_MAX ? PREVIEW_LOD_MAX : lod);
+	if (preview_grids_init(&pw) < 0)
+		goto err;
+
+	trace_begin("draw");
+	perf_stage_begin(&ps);
+	piece_init(&s);
+	for (k = BLOCK_LEVELS - 1; k >= 0; k--) {
+		if (!((size >> k) & 1))
+			continue;
+		preview_block(&pw, k, start >> k, s.position, s.orientation);
+		block_append(&s, k, start >> k);
+		start += 1ULL << k;
+		block_turn(&s.orientation, start);
+	}
+	perf_stage_end(&ps, PERF_STAGE_DRAW, 0);
+	trace_end("draw");
+
+	trace_begin("render");
+	perf_stage_begin(&ps);
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			uint64_t index = (uint64_t) y * width + x;
+			uint64_t *sum = pw.acc.sums + 4 * index;
+			uint64_t cnt = accum_cells(&pw.acc, x, y);
+			int err;
+			/* the boxes overlap, keep the pixel within its cells */
+			if (sum[3] > cnt) {
+				sum[0] = sum[0] * cnt / sum[3];
+				sum[1] = sum[1] * cnt / sum[3];
+				sum[2] = sum[2] * cnt / sum[3];
+				sum[3] = cnt;
+			}
+			if (cnt == 0 || pw.spread[index] == 0) {
+				hist[0]++;
+				continue;
+			}
+			err = (255 * pw.spread[index] + cnt - 1) / cnt;
+			if (err > 255)
+				err = 255;
+			hist[err]++;
+			total += err;
+			if (err > error->max)
+				error->max = err;
+		}
+	}
+	/* a few pixels straddling many blocks set the max, the rest is closer */
+	pixels = (uint64_t) width * height;
+	error->mean = pixels > 0 ? (double) total / pixels : 0;
+	for (k = 0, seen = hist[0]; k < 255 && seen * 100 < pixels * 99; seen += hist[++k])
+		;
+	error->p99 = k;
+	accum_render(&pw.acc, 0, height, image);
+	perf_stage_end(&ps, PERF_STAGE_RENDER, 0);
+	trace_end("render");
+
+done:
+	accum_free(&pw.acc);
+	ARENA_FREE(pw.spread);
+	FREE(pw.grids);
+	free_palette(pw.palette);
+	return ret;
+err:
+	ret = -1;
+	goto done;
+}
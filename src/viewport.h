@@ -0,0 +1,61 @@
+/*
+ * viewport.h
+ *
+ *  Created on: 2026-10-19
+ *
+ * Rendering of a window of the dragon through the hierarchy of aligned
+ * blocks of segments
+ */
+
+#ifndef VIEWPORT_H_
+#define VIEWPORT_H_
+
+#include "dragon.h"
+
+/* levels of the block hierarchy, a block of level k has 2^k segments */
+#define BLOCK_LEVELS	40
+/* blocks of 2^VIEWPORT_LEAF segments are traced, not split */
+#define VIEWPORT_LEAF	10
+
+/* preview: grid of fill counts over the blocks straddling pixels */
+#define PREVIEW_LOD		4
+#define PREVIEW_LOD_MAX	16
+
+/* bound of the color error of the preview pixels, in 0..255 */
+struct preview_error {
+	int max;
+	int p99;		/* 99% of the pixels are within it */
+	double mean;
+};
+
+/* window in fractions of the bounding box of the dragon, (0,0) is its minimums */
+struct dragon_viewport {
+	double x0;
+	double y0;
+	double x1;
+	double y1;
+};
+
+/* cells of the full canvas covered by the window, [j0, j1) x [i0, i1) */
+struct viewport_cells {
+	int64_t j0;
+	int64_t i0;
+	int64_t j1;
+	int64_t i1;
+};
+
+const piece_t *dragon_block(int k, int parity);
+int dragon_limits_blocks(limits_t *limits, uint64_t size, int nb_thread);
+void dragon_range_limits(uint64_t lo, uint64_t hi, limits_t *limits);
+int viewport_parse(const char *arg, struct dragon_viewport *vp);
+void viewport_cells(struct dragon_viewport *vp, limits_t *limits, struct viewport_cells *cells);
+int dragon_draw_viewport(char **canvas, struct rgb *image, int width, int height, uint64_t size,
+        int nb_thread, struct dragon_viewport *vp, struct viewport_cells *cells);
+int dragon_draw_banded(struct rgb *image, int width, int height, uint64_t size, int nb_thread,
+        int band_rows);
+uint64_t band_canvas_bytes(int dragon_width, int scale, int band_rows);
+int dragon_draw_accum(struct rgb *image, int width, int height, uint64_t size, int nb_thread);
+int dragon_draw_preview(struct rgb *image, int width, int height, uint64_t size, int nb_thread,
+        int lod, struct preview_error *error);
+
+#endif /* VIEWPORT_H_ */
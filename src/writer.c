@@ -0,0 +1,223 @@
+/*
+ * writer.c
+ *
+ *  Created on: 2026-10-19
+ *
+ * Double buffering of the output images. writer_submit queues the image,
+ * writer_buffer returns a buffer already written, or a new one while fewer
+ * than WRITER_DEPTH are in flight: the caller renders the next image while
+ * the writer thread writes the previous one, and waits only when the disk
+ * is WRITER_DEPTH images behind.
+ *
+ * The files are written with O_DIRECT, through an aligned chunk, then
+ * truncated to the size of the image. The file systems refusing O_DIRECT
+ * (tmpfs, some network file systems) get buffered writes.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "writer.h"
+#include "arena.h"
+#include "progress.h"
+#include "trace.h"
+
+static int write_all(int fd, const char *buf, uint64_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* header and pixels through the aligned chunk, every write but the last is full */
+static int write_direct(int fd, char *chunk, const char *header, int header_len,
+		const char *pixels, uint64_t len)
+{
+	uint64_t done = 0, fill;
+	uint64_t total = header_len + len;
+
+	memcpy(chunk, header, header_len);
+	fill = header_len;
+	while (done < len) {
+		uint64_t n = WRITER_CHUNK - fill;
+		if (n > len - done)
+			n = len - done;
+		memcpy(chunk + fill, pixels + done, n);
+		done += n;
+		fill += n;
+		if (fill < WRITER_CHUNK)
+			fill = (fill + WRITER_ALIGN - 1) & ~((uint64_t) WRITER_ALIGN - 1);
+		if (write_all(fd, chunk, fill) < 0)
+			return -1;
+		fill = 0;
+	}
+	return ftruncate(fd, total);
+}
+
+static int writer_write(struct img_writer *w, struct writer_job *job)
+{
+	char header[64];
+	int header_len;
+	uint64_t len = sizeof(struct rgb) * (uint64_t) job->width * job->height;
+	int fd;
+	int ret = 0;
+
+	header_len = snprintf(header, sizeof(header), "P6\n%d %d\n%d\n", job->width, job->height, 255);
+
+	fd = open(job->path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+	if (fd >= 0 && write_direct(fd, w->chunk, header, header_len, (char *) job->image, len) < 0) {
+		if (errno != EINVAL)
+			goto err;
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0) {
+		/* no O_DIRECT here, buffered writes */
+		if ((fd = open(job->path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+			goto err;
+		if (write_all(fd, header, header_len) < 0 ||
+				write_all(fd, (char *) job->image, len) < 0)
+			goto err;
+	}
+	progress_add(PROGRESS_BYTES_WRITTEN, header_len + len);
+done:
+	if (fd >= 0)
+		close(fd);
+	return ret;
+err:
+	perror(job->path);
+	ret = -1;
+	goto done;
+}
+
+static void *writer_main(void *arg)
+{
+	struct img_writer *w = (struct img_writer *) arg;
+	struct writer_job job;
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (w->count == 0 && !w->stop)
+			pthread_cond_wait(&w->cond, &w->lock);
+		if (w->count == 0)
+			break;
+		job = w->queue[w->head];
+		pthread_mutex_unlock(&w->lock);
+
+		trace_begin("write");
+		if (writer_write(w, &job) < 0)
+			w->error = 1;
+		trace_end("write");
+		FREE(job.path);
+
+		pthread_mutex_lock(&w->lock);
+		w->head = (w->head + 1) % WRITER_DEPTH;
+		w->count--;
+		w->free[w->nb_free] = job.image;
+		w->free_bytes[w->nb_free] = sizeof(struct rgb) * (uint64_t) job.width * job.height;
+		w->nb_free++;
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+int writer_start(struct img_writer *w)
+{
+	memset(w, 0, sizeof(*w));
+	if (posix_memalign((void **) &w->chunk, WRITER_ALIGN, WRITER_CHUNK) != 0)
+		return -1;
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	if (pthread_create(&w->thread, NULL, writer_main, w) != 0) {
+		FREE(w->chunk);
+		return -1;
+	}
+	return 0;
+}
+
+/* hand image off to be written to path, the writer owns it from now on */
+int writer_submit(struct img_writer *w, struct rgb *image, const char *path, int width, int height)
+{
+	struct writer_job *job;
+	char *copy;
+
+	if (image == NULL)
+		return -1;
+	if ((copy = strdup(path)) == NULL) {
+		ARENA_FREE(image);
+		return -1;
+	}
+	pthread_mutex_lock(&w->lock);
+	while (w->count == WRITER_DEPTH)
+		pthread_cond_wait(&w->cond, &w->lock);
+	job = &w->queue[(w->head + w->count) % WRITER_DEPTH];
+	job->image = image;
+	job->path = copy;
+	job->width = width;
+	job->height = height;
+	w->count++;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+	return 0;
+}
+
+/*
+ * Buffer of width x height pixels for the next image: a written one, or a
+ * new one while fewer than WRITER_DEPTH are in flight. NULL on error.
+ */
+struct rgb *writer_buffer(struct img_writer *w, int width, int height)
+{
+	uint64_t bytes = sizeof(struct rgb) * (uint64_t) width * height;
+	struct rgb *next = NULL;
+
+	pthread_mutex_lock(&w->lock);
+	/* backpressure: wait for a written buffer once WRITER_DEPTH are allocated */
+	while (w->nb_free == 0 && w->nb_buffers == WRITER_DEPTH)
+		pthread_cond_wait(&w->cond, &w->lock);
+	if (w->nb_free > 0) {
+		w->nb_free--;
+		next = w->free[w->nb_free];
+		if (w->free_bytes[w->nb_free] < bytes)
+			ARENA_FREE(next);
+	} else {
+		w->nb_buffers++;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	if (next == NULL)
+		next = make_canvas(width, height);
+	return next;
+}
+
+/* wait for the queued images, -1 if one of them could not be written */
+int writer_finish(struct img_writer *w)
+{
+	int i;
+
+	pthread_mutex_lock(&w->lock);
+	w->stop = 1;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+	pthread_join(w->thread, NULL);
+
+	for (i = 0; i < w->nb_free; i++)
+		ARENA_FREE(w->free[i]);
+	FREE(w->chunk);
+	pthread_mutex_destroy(&w->lock);
+	pthread_cond_destroy(&w->cond);
+	return w->error ? -1 : 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * writer.h
+ *
+ *  Created on: 2026-10-19
+ *
+ * Asynchronous image writer: the images are handed off to a writer thread
+ * and the caller continues with another buffer
+ */
+
+#ifndef WRITER_H_
+#define WRITER_H_
+
+#include <pthread.h>
+#include "dragon.h"
+
+/* images queued or being written, the caller blocks beyond */
+#define WRITER_DEPTH	2
+/* O_DIRECT writes go through an aligned buffer of this size */
+#define WRITER_CHUNK	(4 << 20)
+#define WRITER_ALIGN	4096
+
+struct writer_job {
+	struct rgb *image;
+	char *path;
+	int width;
+	int height;
+};
+
+struct img_writer {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct writer_job queue[WRITER_DEPTH];
+	int head;
+	int count;
+	struct rgb *free[WRITER_DEPTH];	/* written buffers, ready for the caller */
+	uint64_t free_bytes[WRITER_DEPTH];
+	int nb_free;
+	int nb_buffers;			/* buffers allocated by the writer */
+	char *chunk;
+	int stop;
+	int error;
+};
+
+int writer_start(struct img_writer *w);
+int writer_submit(struct img_writer *w, struct rgb *image, const char *path, int width, int height);
+struct rgb *writer_buffer(struct img_writer *w, int width, int height);
+int writer_finish(struct img_writer *w);
+
+#endif /* WRITER_H_ */
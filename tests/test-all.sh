@@ -1,4 +1,41 @@
 #!/bin/sh
 
-${abs_top_srcdir}/src/dragonizer --cmd check --power 22 --thread 10
+${abs_top_srcdir}/src/dragonizer --cmd check --power 22 --thread 10 || exit 1
+# small dragons, whose canvas is smaller than some plans
+${abs_top_srcdir}/src/dragonizer --cmd check --power 14 --thread 4 || exit 1
 
+# scaling tables of the pthread backends, on up to 4 threads
+${abs_top_srcdir}/src/dragonizer --cmd scaling --lib pthread --power 18 --thread 4 > /dev/null || exit 1
+
+# deadline: a generous one delivers the requested size
+${abs_top_srcdir}/src/dragonizer --cmd draw --lib pthread --power 18 --thread 4 --deadline 10000 \
+	--width 256 --height 256 --output /dev/null | grep -q "delivered size=262144 " || exit 1
+
+# render daemon: a few jobs through the socket, then shutdown
+sock=$(mktemp -u /tmp/dragonizer-test.XXXXXX)
+img=$(mktemp /tmp/dragonizer-test.XXXXXX)
+${abs_top_srcdir}/src/dragonizer --serve $sock --thread 4 &
+server=$!
+for i in $(seq 50); do
+	[ -S $sock ] && break
+	sleep 0.1
+done
+${abs_top_srcdir}/src/dragonizer --submit $sock <<JOBS || { rm -f $img; kill $server; exit 1; }
+cmd=limits lib=tbb power=20 thread=2
+cmd=draw lib=pthread power=18 thread=2 width=256 height=256 output=$img priority=1
+cmd=draw lib=tbb power=18 thread=8 width=256 height=256 output=$img
+shutdown
+JOBS
+wait $server || { rm -f $img; exit 1; }
+test -s $img || { rm -f $img; exit 1; }
+
+# tuning profile: calibrated by the first run, read back by the second
+prof=$(mktemp -u /tmp/dragonizer-test.XXXXXX)
+for i in 1 2; do
+	${abs_top_srcdir}/src/dragonizer --cmd draw --auto $prof --power 8 --max 18 \
+		--width 256 --height 256 --output $img || { rm -f $img $prof; exit 1; }
+done
+grep -q "^entry" $prof
+ret=$?
+rm -f $img $prof
+exit $ret